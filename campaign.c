@@ -0,0 +1,482 @@
+/*
+
+    CHAOS: campaign.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "campaign.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+extern volatile sig_atomic_t keep_running;
+
+extern char infoHeader[50];
+
+static const char *campaignDirectories[6] = {"todo", "claimed", "done", "failed", "logs", "workers"};
+
+static int makeDirectory(const char *path)
+{
+    if (mkdir(path, 0775) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "%sCould not create %s: %s\n", infoHeader, path, strerror(errno));
+        return CAMPAIGN_DIRECTORY;
+    }
+
+    return CAMPAIGN_OK;
+}
+
+int initCampaign(const char *jobDir)
+{
+    char path[FILENAME_MAX] = {0};
+    int status = makeDirectory(jobDir);
+    for (int i = 0; i < 6 && status == CAMPAIGN_OK; i++)
+    {
+        snprintf(path, FILENAME_MAX, "%s/%s", jobDir, campaignDirectories[i]);
+        status = makeDirectory(path);
+    }
+
+    return status;
+}
+
+// Entries of a campaign directory not starting with '.', which are files being written
+static int visibleEntry(const struct dirent *entry)
+{
+    return entry->d_name[0] != '.';
+}
+
+// Sorted entries of jobDir/state, or -1
+static int listJobs(const char *jobDir, const char *state, struct dirent ***entries)
+{
+    char path[FILENAME_MAX] = {0};
+    snprintf(path, FILENAME_MAX, "%s/%s", jobDir, state);
+
+    return scandir(path, entries, visibleEntry, alphasort);
+}
+
+static void freeJobList(struct dirent **entries, int nEntries)
+{
+    for (int i = 0; i < nEntries; i++)
+        free(entries[i]);
+    free(entries);
+
+    return;
+}
+
+// Job a claimed/ entry is for: its name up to the '@'. False if that is too long to be a job name.
+static bool claimedJobName(const char *entry, char *name)
+{
+    const char *at = strrchr(entry, '@');
+    size_t length = at != NULL ? (size_t)(at - entry) : strlen(entry);
+    if (length >= CAMPAIGN_JOB_NAME_SIZE)
+        return false;
+    memcpy(name, entry, length);
+    name[length] = '\0';
+
+    return true;
+}
+
+static bool jobKnown(const char *jobDir, const char *name)
+{
+    char path[FILENAME_MAX] = {0};
+    const char *states[3] = {"todo", "done", "failed"};
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(path, FILENAME_MAX, "%s/%s/%s", jobDir, states[i], name);
+        if (access(path, F_OK) == 0)
+            return true;
+    }
+
+    struct dirent **entries = NULL;
+    int nEntries = listJobs(jobDir, "claimed", &entries);
+    char claimed[CAMPAIGN_JOB_NAME_SIZE] = {0};
+    bool known = false;
+    for (int i = 0; i < nEntries && !known; i++)
+    {
+        known = claimedJobName(entries[i]->d_name, claimed) && strcmp(claimed, name) == 0;
+    }
+    if (nEntries > 0)
+        freeJobList(entries, nEntries);
+
+    return known;
+}
+
+// Writes text to path through a hidden file in the same directory, so readers never see it partly written
+static int writeFileAtomically(const char *directory, const char *name, const char *text)
+{
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    char temporary[FILENAME_MAX] = {0};
+    char path[FILENAME_MAX] = {0};
+    snprintf(temporary, FILENAME_MAX, "%s/.%s.%s.%ld", directory, name, host, (long)getpid());
+    snprintf(path, FILENAME_MAX, "%s/%s", directory, name);
+
+    FILE *f = fopen(temporary, "w");
+    if (f == NULL)
+        return CAMPAIGN_JOB_FILE;
+    bool ok = fputs(text, f) >= 0;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temporary, path) != 0)
+    {
+        unlink(temporary);
+        return CAMPAIGN_JOB_FILE;
+    }
+
+    return CAMPAIGN_OK;
+}
+
+int addCampaignJob(const char *jobDir, const char *name, const char *outputFilename, int nArgs, char **args)
+{
+    if (jobKnown(jobDir, name))
+        return CAMPAIGN_JOB_EXISTS;
+
+    size_t size = strlen(outputFilename) + 2;
+    for (int i = 0; i < nArgs; i++)
+        size += strlen(args[i]) + 1;
+    char *text = malloc(size);
+    if (text == NULL)
+        return CAMPAIGN_JOB_FILE;
+    char *end = text + sprintf(text, "%s\n", outputFilename);
+    for (int i = 0; i < nArgs; i++)
+        end += sprintf(end, "%s\n", args[i]);
+
+    char directory[FILENAME_MAX] = {0};
+    snprintf(directory, FILENAME_MAX, "%s/todo", jobDir);
+    int status = writeFileAtomically(directory, name, text);
+    free(text);
+
+    return status;
+}
+
+// Output filename and arguments of a job file. The arguments point into text; free both.
+static int readJob(const char *path, char *outputFilename, char **jobText, char ***args, int *nArgs)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return CAMPAIGN_JOB_FILE;
+    struct stat info;
+    char *text = NULL;
+    if (fstat(fileno(f), &info) == 0)
+        text = calloc((size_t)info.st_size + 1, 1);
+    bool ok = text != NULL && fread(text, 1, (size_t)info.st_size, f) == (size_t)info.st_size;
+    fclose(f);
+
+    // One line each
+    int nLines = 0;
+    for (char *c = text; ok && *c != '\0'; c++)
+        if (*c == '\n')
+            nLines++;
+    *args = ok && nLines >= 1 ? calloc(nLines, sizeof(char *)) : NULL;
+    if (*args == NULL)
+    {
+        free(text);
+        return CAMPAIGN_JOB_FILE;
+    }
+    char *line = text;
+    char *newline = strchr(line, '\n');
+    *newline = '\0';
+    snprintf(outputFilename, FILENAME_MAX, "%s", line);
+    *nArgs = 0;
+    for (line = newline + 1; (newline = strchr(line, '\n')) != NULL; line = newline + 1)
+    {
+        *newline = '\0';
+        (*args)[(*nArgs)++] = line;
+    }
+    *jobText = text;
+
+    return CAMPAIGN_OK;
+}
+
+// The file server's current time, read from a file the worker touches, so that workers
+// on hosts with unsynchronized clocks agree on the age of claims
+static time_t serverTime(const char *workerFile)
+{
+    int fd = open(workerFile, O_WRONLY | O_CREAT, 0664);
+    if (fd >= 0)
+        close(fd);
+    struct stat info;
+    if (utime(workerFile, NULL) != 0 || stat(workerFile, &info) != 0)
+        return time(NULL);
+
+    return info.st_mtime;
+}
+
+// Renames claims untouched for leaseSeconds back to todo/
+static void reclaimExpiredJobs(const char *jobDir, time_t now, double leaseSeconds)
+{
+    struct dirent **entries = NULL;
+    int nEntries = listJobs(jobDir, "claimed", &entries);
+    char claimedPath[FILENAME_MAX] = {0};
+    char todoPath[FILENAME_MAX] = {0};
+    char name[CAMPAIGN_JOB_NAME_SIZE] = {0};
+    struct stat info;
+    for (int i = 0; i < nEntries; i++)
+    {
+        snprintf(claimedPath, FILENAME_MAX, "%s/claimed/%s", jobDir, entries[i]->d_name);
+        if (stat(claimedPath, &info) != 0 || difftime(now, info.st_mtime) <= leaseSeconds || !claimedJobName(entries[i]->d_name, name))
+            continue;
+        snprintf(todoPath, FILENAME_MAX, "%s/todo/%s", jobDir, name);
+        // Only one worker's rename succeeds
+        if (rename(claimedPath, todoPath) == 0)
+            fprintf(stdout, "%sReclaimed %s, untouched for %.0f s\n", infoHeader, entries[i]->d_name, difftime(now, info.st_mtime));
+    }
+    if (nEntries > 0)
+        freeJobList(entries, nEntries);
+
+    return;
+}
+
+static void recordJob(const char *jobDir, const char *state, const char *name, const char *host, time_t start, double seconds, int exitStatus, const char *note)
+{
+    char text[FILENAME_MAX] = {0};
+    char startString[32] = {0};
+    struct tm date;
+    gmtime_r(&start, &date);
+    strftime(startString, sizeof(startString), "%Y-%m-%dT%H:%M:%SZ", &date);
+    snprintf(text, FILENAME_MAX, "host %s\npid %ld\nstart %s\nseconds %.3f\nexit %d\nnote %s\n", host, (long)getpid(), startString, seconds, exitStatus, note);
+
+    char directory[FILENAME_MAX] = {0};
+    snprintf(directory, FILENAME_MAX, "%s/%s", jobDir, state);
+    if (writeFileAtomically(directory, name, text) != CAMPAIGN_OK)
+        fprintf(stderr, "%sCould not record %s as %s\n", infoHeader, name, state);
+
+    return;
+}
+
+static double secondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)(now.tv_sec - start->tv_sec) + 1e-9 * (double)(now.tv_nsec - start->tv_nsec);
+}
+
+// Runs a claimed job to completion, touching its claim every quarter lease
+static void runJob(const char *jobDir, const char *name, const char *claimedPath, const char *host, const char *executable, double leaseSeconds)
+{
+    char outputFilename[FILENAME_MAX] = {0};
+    char *text = NULL;
+    char **args = NULL;
+    int nArgs = 0;
+    time_t start = time(NULL);
+    struct timespec started;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    if (readJob(claimedPath, outputFilename, &text, &args, &nArgs) != CAMPAIGN_OK)
+    {
+        recordJob(jobDir, "failed", name, host, start, 0.0, -1, "unreadable job file");
+        unlink(claimedPath);
+        return;
+    }
+    if (access(outputFilename, F_OK) == 0)
+    {
+        fprintf(stdout, "%s%s: output exists\n", infoHeader, name);
+        recordJob(jobDir, "done", name, host, start, 0.0, 0, "output exists");
+        unlink(claimedPath);
+        free(text);
+        free(args);
+        return;
+    }
+
+    fprintf(stdout, "%s%s: running\n", infoHeader, name);
+    fflush(stdout);
+    char logFilename[FILENAME_MAX] = {0};
+    snprintf(logFilename, FILENAME_MAX, "%s/logs/%s.log", jobDir, name);
+    pid_t child = fork();
+    if (child == 0)
+    {
+        int log = open(logFilename, O_WRONLY | O_CREAT | O_APPEND, 0664);
+        if (log >= 0)
+        {
+            dup2(log, STDOUT_FILENO);
+            dup2(log, STDERR_FILENO);
+            close(log);
+        }
+        char **childArgs = calloc(nArgs + 2, sizeof(char *));
+        if (childArgs != NULL)
+        {
+            childArgs[0] = (char *)executable;
+            memcpy(childArgs + 1, args, nArgs * sizeof(char *));
+            execv(executable, childArgs);
+        }
+        _exit(127);
+    }
+
+    int waitStatus = 0;
+    int exitStatus = -1;
+    bool leaseLost = false;
+    double lastTouch = 0.0;
+    if (child > 0)
+    {
+        while (waitpid(child, &waitStatus, WNOHANG) == 0)
+        {
+            sleep(1);
+            if (secondsSince(&started) - lastTouch >= leaseSeconds / 4.0)
+            {
+                lastTouch = secondsSince(&started);
+                if (utime(claimedPath, NULL) != 0 && !leaseLost)
+                {
+                    leaseLost = true;
+                    fprintf(stdout, "%s%s: claim was reclaimed; finishing anyway\n", infoHeader, name);
+                }
+            }
+        }
+        exitStatus = WIFEXITED(waitStatus) ? WEXITSTATUS(waitStatus) : -1;
+    }
+    double seconds = secondsSince(&started);
+
+    char todoPath[FILENAME_MAX] = {0};
+    snprintf(todoPath, FILENAME_MAX, "%s/todo/%s", jobDir, name);
+    if (keep_running == 0 && !leaseLost)
+    {
+        // Left for another worker
+        rename(claimedPath, todoPath);
+        fprintf(stdout, "%s%s: interrupted; returned to the queue\n", infoHeader, name);
+    }
+    else
+    {
+        bool produced = exitStatus == 0 && access(outputFilename, F_OK) == 0;
+        recordJob(jobDir, produced ? "done" : "failed", name, host, start, seconds, exitStatus, produced ? "exported" : (child > 0 ? "no output" : "could not start"));
+        fprintf(stdout, "%s%s: %s in %.1f s\n", infoHeader, name, produced ? "done" : "failed", seconds);
+        if (!leaseLost)
+            unlink(claimedPath);
+    }
+
+    free(text);
+    free(args);
+
+    return;
+}
+
+int runCampaignWorker(const char *jobDir, const char *executable, double leaseSeconds)
+{
+    char host[256] = {0};
+    gethostname(host, sizeof(host) - 1);
+    char workerFile[FILENAME_MAX] = {0};
+    snprintf(workerFile, FILENAME_MAX, "%s/workers/%s.%ld", jobDir, host, (long)getpid());
+
+    struct dirent **entries = NULL;
+    int nEntries = 0;
+    char todoPath[FILENAME_MAX] = {0};
+    char claimedPath[FILENAME_MAX] = {0};
+    struct stat info;
+    int jobsRun = 0;
+    while (keep_running == 1)
+    {
+        reclaimExpiredJobs(jobDir, serverTime(workerFile), leaseSeconds);
+
+        // The first job this worker renames is its own; the list is rescanned after each
+        // job so that reclaimed and earlier jobs are taken first
+        bool claimed = false;
+        nEntries = listJobs(jobDir, "todo", &entries);
+        if (nEntries < 0)
+        {
+            fprintf(stderr, "%sCould not read %s/todo\n", infoHeader, jobDir);
+            unlink(workerFile);
+            return CAMPAIGN_DIRECTORY;
+        }
+        for (int i = 0; i < nEntries && !claimed; i++)
+        {
+            snprintf(todoPath, FILENAME_MAX, "%s/todo/%s", jobDir, entries[i]->d_name);
+            snprintf(claimedPath, FILENAME_MAX, "%s/claimed/%s@%s.%ld", jobDir, entries[i]->d_name, host, (long)getpid());
+            // Renaming keeps the job file's time, so it is touched first to start the lease.
+            // A rename retransmitted over NFS can fail after succeeding, so the new name decides.
+            if (utime(todoPath, NULL) != 0)
+                continue;
+            claimed = rename(todoPath, claimedPath) == 0 || stat(claimedPath, &info) == 0;
+            if (claimed)
+            {
+                runJob(jobDir, entries[i]->d_name, claimedPath, host, executable, leaseSeconds);
+                jobsRun++;
+            }
+        }
+        freeJobList(entries, nEntries);
+        if (claimed)
+            continue;
+
+        // Nothing waiting: done unless claims of other workers may yet expire
+        nEntries = listJobs(jobDir, "claimed", &entries);
+        if (nEntries > 0)
+            freeJobList(entries, nEntries);
+        if (nEntries <= 0)
+            break;
+        sleep(leaseSeconds / 4.0 < 10.0 ? (unsigned int)(leaseSeconds / 4.0) + 1 : 10);
+    }
+    unlink(workerFile);
+    fprintf(stdout, "%sWorker %s.%ld ran %d jobs\n", infoHeader, host, (long)getpid(), jobsRun);
+
+    return CAMPAIGN_OK;
+}
+
+// Seconds recorded in a done/ or failed/ file
+static double recordedSeconds(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+        return 0.0;
+    char line[FILENAME_MAX] = {0};
+    double seconds = 0.0;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (sscanf(line, "seconds %lf", &seconds) == 1)
+            break;
+    fclose(f);
+
+    return seconds;
+}
+
+int printCampaignStatus(const char *jobDir)
+{
+    struct dirent **entries = NULL;
+    int nEntries = 0;
+    char path[FILENAME_MAX] = {0};
+    const char *states[5] = {"todo", "claimed", "done", "failed", "workers"};
+    for (int s = 0; s < 5; s++)
+    {
+        nEntries = listJobs(jobDir, states[s], &entries);
+        if (nEntries < 0)
+        {
+            fprintf(stderr, "%sCould not read %s/%s\n", infoHeader, jobDir, states[s]);
+            return CAMPAIGN_DIRECTORY;
+        }
+        double seconds = 0.0;
+        for (int i = 0; i < nEntries && (s == 2 || s == 3); i++)
+        {
+            snprintf(path, FILENAME_MAX, "%s/%s/%s", jobDir, states[s], entries[i]->d_name);
+            seconds += recordedSeconds(path);
+        }
+        if (s == 2 || s == 3)
+            fprintf(stdout, "%-8s %6d jobs, %.1f s\n", states[s], nEntries, seconds);
+        else
+            fprintf(stdout, "%-8s %6d\n", states[s], nEntries);
+        for (int i = 0; i < nEntries && s == 1; i++)
+            fprintf(stdout, "  %s\n", entries[i]->d_name);
+        freeJobList(entries, nEntries);
+    }
+
+    return CAMPAIGN_OK;
+}
@@ -0,0 +1,61 @@
+/*
+
+    CHAOS: campaign.h
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CHAOS_CAMPAIGN_H
+#define _CHAOS_CAMPAIGN_H
+
+#include <stdbool.h>
+
+// Reprocessing campaigns shared through a directory, for workers on hosts that share
+// only a filesystem (NFS included). A job is one chaos run, stored as a file holding its
+// output filename and arguments:
+//
+//   todo/<job>                  waiting; names sort in the order they are taken
+//   claimed/<job>@<host>.<pid>  being run; the worker touches it while the job runs
+//   done/<job>, failed/<job>    host, pid, start time, seconds taken and exit status
+//   logs/<job>.log              output of the run
+//   workers/<host>.<pid>        touched by each worker to read the server's clock
+//
+// Jobs are claimed by renaming them from todo/ to a name unique to the worker, which is
+// atomic on NFS as on local filesystems. Claims not touched for the lease time are
+// renamed back to todo/ by any worker.
+
+#define CAMPAIGN_DEFAULT_LEASE_S 600.0
+#define CAMPAIGN_JOB_NAME_SIZE 64
+
+enum CAMPAIGN_STATUS {
+    CAMPAIGN_OK = 0,
+    CAMPAIGN_DIRECTORY,
+    CAMPAIGN_JOB_FILE,
+    CAMPAIGN_JOB_EXISTS
+};
+
+// Creates the directories of a campaign, if needed
+int initCampaign(const char *jobDir);
+// Adds a job running chaos with the nArgs arguments args (without the program name) for
+// outputFilename, unless a job of that name is waiting, claimed or finished
+int addCampaignJob(const char *jobDir, const char *name, const char *outputFilename, int nArgs, char **args);
+// Runs the campaign's jobs with executable until none are waiting or claimed, reclaiming
+// claims older than leaseSeconds. Jobs whose output exists are recorded as done unrun.
+int runCampaignWorker(const char *jobDir, const char *executable, double leaseSeconds);
+// Numbers of jobs in each state, and the time the finished ones took
+int printCampaignStatus(const char *jobDir);
+
+#endif // _CHAOS_CAMPAIGN_H
@@ -208,7 +208,30 @@ CDFstatus addVariableAttributes(CDFid id, varAttr attr)
     return status;
 }
 
-void addAttributes(CDFid id, const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, const char *softwareVersion, const char satellite, const char *dataset, const char *version, double minTime, double maxTime)
+void versionVariableName(const char *base, const char *version, char *name)
+{
+    size_t len = strlen(base);
+    sprintf(name, "%s_%s", base, version);
+    for (char *c = name + len + 1; *c != '\0'; c++)
+    {
+        if (!isalnum(*c))
+            *c = '_';
+    }
+
+    return;
+}
+
+void modelComponentKeys(const ChaosCoefficients *coeffs, const ModelWorkspace *workspace, char *coreKey, char *crustKey)
+{
+    // Kernels round differently, so values are reused only from the same evaluator
+    const char *kernel = getFieldKernel() == CHAOS_FIELD_KERNEL_REFERENCE ? "reference" : batchKernelDescription();
+    snprintf(coreKey, MODEL_COMPONENT_KEY_SIZE, "core %016llx extrapolated %016llx epochs %.17g tolerance %.17g kernel %s software %s", (unsigned long long)coeffs->core.contentHash, (unsigned long long)coeffs->coreExtrapolation.contentHash, workspace->coreUpdateIntervalSeconds, workspace->truncationToleranceNT, kernel, SOFTWARE_VERSION_STRING);
+    snprintf(crustKey, MODEL_COMPONENT_KEY_SIZE, "static %016llx tolerance %.17g precision %s kernel %s software %s", (unsigned long long)coeffs->crust.contentHash, workspace->truncationToleranceNT, workspace->singlePrecisionCrust ? "single" : "double", kernel, SOFTWARE_VERSION_STRING);
+
+    return;
+}
+
+void addAttributes(CDFid id, const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, int nVersions, const ModelWorkspace *workspace, const char *softwareVersion, const char satellite, const char *dataset, const char *version, double minTime, double maxTime)
 {
     long attrNum = 0;
     char buf[1000] = {0};
@@ -244,6 +267,42 @@ void addAttributes(CDFid id, const char *cdfFilename, const char *magFilename, C
         addgEntry(id, attrNum, 1, basename((char *)coeffs->core.coeffFilename));
         addgEntry(id, attrNum, 2, basename((char *)coeffs->coreExtrapolation.coeffFilename));
         addgEntry(id, attrNum, 3, basename((char *)coeffs->crust.coeffFilename));
+    for (int v = 1; v < nVersions; v++)
+    {
+        addgEntry(id, attrNum, 3 * v + 1, basename((char *)coeffs[v].core.coeffFilename));
+        addgEntry(id, attrNum, 3 * v + 2, basename((char *)coeffs[v].coreExtrapolation.coeffFilename));
+        addgEntry(id, attrNum, 3 * v + 3, basename((char *)coeffs[v].crust.coeffFilename));
+    }
+    CDFcreateAttr(id, "Model_versions", GLOBAL_SCOPE, &attrNum);
+    for (int v = 0; v < nVersions; v++)
+        addgEntry(id, attrNum, v, coeffs[v].version);
+    char coreKey[MODEL_COMPONENT_KEY_SIZE] = {0};
+    char crustKey[MODEL_COMPONENT_KEY_SIZE] = {0};
+    modelComponentKeys(coeffs, workspace, coreKey, crustKey);
+    CDFcreateAttr(id, "Model_component_keys", GLOBAL_SCOPE, &attrNum);
+    addgEntry(id, attrNum, 0, coreKey);
+    addgEntry(id, attrNum, 1, crustKey);
+
+    CDFcreateAttr(id, "Model_truncation", GLOBAL_SCOPE, &attrNum);
+    if (workspace->truncationToleranceNT > 0.0)
+        sprintf(buf, "Tolerance %g nT", workspace->truncationToleranceNT);
+    else
+        sprintf(buf, "None");
+    addgEntry(id, attrNum, 0, buf);
+    sprintf(buf, "Core maximum degree %d", maximumDegreeUsed(&coeffs->core, workspace));
+    addgEntry(id, attrNum, 1, buf);
+    sprintf(buf, "Crust maximum degree %d", maximumDegreeUsed(&coeffs->crust, workspace));
+    addgEntry(id, attrNum, 2, buf);
+    CDFcreateAttr(id, "Model_crust_precision", GLOBAL_SCOPE, &attrNum);
+    addgEntry(id, attrNum, 0, workspace->singlePrecisionCrust ? "Single" : "Double");
+    CDFcreateAttr(id, "Model_core_epochs", GLOBAL_SCOPE, &attrNum);
+    if (workspace->coreUpdateIntervalSeconds < 0.0)
+        sprintf(buf, "Start of day");
+    else if (workspace->coreUpdateIntervalSeconds == 0.0)
+        sprintf(buf, "Each sample");
+    else
+        sprintf(buf, "Centre of each %g s interval", workspace->coreUpdateIntervalSeconds);
+    addgEntry(id, attrNum, 0, buf);
 
     CDFcreateAttr(id, "File_naming_convention", GLOBAL_SCOPE, &attrNum);
     sprintf(buf, "SW_%s_MAGxC7%c_2_", CHAOS_PRODUCT_TYPE, dataset[0]);
@@ -320,6 +379,30 @@ void addAttributes(CDFid id, const char *cdfFilename, const char *magFilename, C
         addVariableAttributes(id, variableAttrs[i]);
     }
 
+    // Optional variables
+    const varAttr secularVariationAttrs = {"dBdt_core_nec", "CDF_REAL8", "nT/year", "CHAOS 7 core magnetic field secular variation (interpolated)", -500., 500., "%8.2f"};
+    if (CDFvarNum(id, secularVariationAttrs.name) >= 0)
+        addVariableAttributes(id, secularVariationAttrs);
+
+    // Variables of further model versions, described as those of the first
+    char name[CDF_VAR_NAME_LEN256] = {0};
+    char desc[CDF_VAR_NAME_LEN256] = {0};
+    varAttr versionAttrs = {0};
+    for (int v = 1; v < nVersions; v++)
+    {
+        for (uint8_t i = 4; i <= NUMBER_OF_EXPORT_VARIABLES; i++)
+        {
+            versionAttrs = i < NUMBER_OF_EXPORT_VARIABLES ? variableAttrs[i] : secularVariationAttrs;
+            versionVariableName(versionAttrs.name, coeffs[v].version, name);
+            if (CDFvarNum(id, name) < 0)
+                continue;
+            snprintf(desc, sizeof(desc), "%s, CHAOS-%s", versionAttrs.desc, coeffs[v].version);
+            versionAttrs.name = name;
+            versionAttrs.desc = desc;
+            addVariableAttributes(id, versionAttrs);
+        }
+    }
+
 }
 
 
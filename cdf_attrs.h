@@ -24,6 +24,7 @@
 #define CDF_ATTRS_H
 
 #include "shc.h"
+#include "model.h"
 
 #include <cdf.h>
 
@@ -43,7 +44,18 @@ typedef struct varAttr {
 
 CDFstatus addVariableAttributes(CDFid id, varAttr attr);
 
-void addAttributes(CDFid id, const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, const char *softwareVersion, const char satellite, const char *dataset, const char *version, double minTime, double maxTime);
+// Name of a variable for a model version other than the first: base_7_11 for version 7.11
+void versionVariableName(const char *base, const char *version, char *name);
+
+#define MODEL_COMPONENT_KEY_SIZE 256
+
+// Strings identifying what the core (with dB/dt) and crustal fields of the first model
+// version depend on: SHC content hashes, the evaluation settings, the field kernel and the
+// software version. A product whose Model_component_keys entries match can supply those
+// fields for the same samples.
+void modelComponentKeys(const ChaosCoefficients *coeffs, const ModelWorkspace *workspace, char *coreKey, char *crustKey);
+
+void addAttributes(CDFid id, const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, int nVersions, const ModelWorkspace *workspace, const char *softwareVersion, const char satellite, const char *dataset, const char *version, double minTime, double maxTime);
 
 
 #endif // CDF_ATTRS_H
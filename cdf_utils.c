@@ -30,166 +30,194 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
 #include <fts.h>
 #include <cdf.h>
 #include <signal.h>
 #include <time.h>
 #include <math.h>
+#include <sys/stat.h>
 
 extern volatile sig_atomic_t keep_running;
 
 extern char infoHeader[50];
 
-void loadCdf(const char *cdfFile, double firstTime, double lastTime, char *variables[], int nVariables, uint8_t **dataBuffers, size_t *numberOfRecords)
-{
-    // Open the CDF file with validation
-    CDFsetValidate(VALIDATEFILEoff);
-    CDFid cdfId;
-    CDFstatus status;
-    // Attributes
-    long attrN;
-    long entryN;
-    char attrName[CDF_ATTR_NAME_LEN256+1];
-    long attrScope, maxEntry;
+// Variables loadMagColumns reads, in MagColumns order
+static char *magVariableNames[5] = {"Timestamp", "Latitude", "Longitude", "Radius", "B_NEC"};
+static long magVariableWidths[5] = {1, 1, 1, 1, 3};
 
-    // Check CDF info
-    long decoding, encoding, majority, maxrRec, numrVars, maxzRec, numzVars, numAttrs, format;
+// Index of the first record from start on with a time at or after (orLater) or after
+// threshold, or numRecs if there is none. Timestamps increase, so this is a binary search
+// reading one record per probe rather than the times in between.
+static long findRecord(CDFid id, long varNum, long numRecs, long start, double threshold, bool orLater, CDFstatus *status)
+{
+    long low = start;
+    long high = numRecs;
+    double time = 0.0;
+    while (low < high)
+    {
+        long middle = low + (high - low) / 2;
+        *status = CDFgetzVarRecordData(id, varNum, middle, &time);
+        if (*status != CDF_OK)
+            return numRecs;
+        if (orLater ? time >= threshold : time > threshold)
+            high = middle;
+        else
+            low = middle + 1;
+    }
 
-    long numBytesToAdd, numVarBytes, numValues;
-    long varNum, dataType, numElems, numRecs, numDims, recVary;
-    long dimSizes[CDF_MAX_DIMS], dimVarys[CDF_MAX_DIMS];
-    CDFdata data;
+    return low;
+}
 
-    status = CDFopenCDF(cdfFile, &cdfId);
-    if (status != CDF_OK) 
+CDFstatus getCdfRecordRange(CDFid id, double firstTime, double lastTime, long *firstRecord, long *lastRecord)
+{
+    long varNum = CDFgetVarNum(id, magVariableNames[0]);
+    long maxRec = -1;
+    CDFstatus status = CDFgetzVarMaxWrittenRecNum(id, varNum, &maxRec);
+    long numRecs = maxRec + 1;
+    if (status != CDF_OK || numRecs == 0)
     {
         printErrorMessage(status);
-        fprintf(stdout, "%s Could not open CDF file. Skipping this date.\n", infoHeader);
-        return;
+        fprintf(stdout, "%s Error loading data for %s. Skipping this date.\n", infoHeader, magVariableNames[0]);
+        return status != CDF_OK ? status : NO_SUCH_RECORD;
     }
 
-    status = CDFgetFormat(cdfId, &format);
-    status = CDFgetDecoding(cdfId, &decoding);
-    status = CDFinquireCDF(cdfId, &numDims, dimSizes, &encoding, &majority, &maxrRec, &numrVars, &maxzRec, &numzVars, &numAttrs);
+    // The range starts one record after the first at or after firstTime, and ends one record
+    // after the first later than lastTime, as it always has
+    long firstRec = findRecord(id, varNum, numRecs, 0, firstTime, true, &status) + 1;
     if (status != CDF_OK)
     {
         printErrorMessage(status);
-        fprintf(stdout, "\n%s Problem with CDF file. Skipping this date.\n", infoHeader);
-        closeCdf(cdfId);
-        return;
+        return status;
     }
-    uint8_t nVars = numzVars;
-    for (uint8_t i = 0; i<nVariables; i++)
+    if (firstRec >= numRecs)
     {
-        status = CDFconfirmzVarExistence(cdfId, variables[i]);
-        if (status != CDF_OK)
-        {
-            printErrorMessage(status);
-            fprintf(stdout, "\n%s Error reading variable %s from CDF file. Skipping this date.\n", infoHeader, variables[i]);
-            closeCdf(cdfId);
-                return;
-        }
+        fprintf(stderr, "No records within requested time range.\n");
+        return NO_SUCH_RECORD;
     }
-    
-
-    void *newMem = NULL;
 
-    // Calculate first and last records to read
-    double *time = NULL;
-    varNum = CDFgetVarNum(cdfId, variables[0]); // First var is expected to be time
-    status = CDFreadzVarAllByVarID(cdfId, varNum, &numRecs, &dataType, &numElems, &numDims, dimSizes, &recVary, dimVarys, &data);
-    if (status != CDF_OK || numRecs == 0)
+    long lastRec = findRecord(id, varNum, numRecs, firstRec, lastTime, false, &status) + 1;
+    if (status != CDF_OK)
     {
         printErrorMessage(status);
-        fprintf(stdout, "%s Error loading data for %s. Skipping this date.\n", infoHeader, variables[0]);
-        closeCdf(cdfId);
-        CDFdataFree(data);
-        return;
+        return status;
     }
-
-    long firstRec = 0;
-    while (firstRec < numRecs && ((double*)data)[firstRec++] < firstTime);
-
-    if (firstRec == numRecs)
-    {
-        fprintf(stderr, "No records within requested time range.\n");
-        closeCdf(cdfId);
-        return;
-    }
-
-    long lastRec = firstRec;
-    while (lastRec < numRecs && ((double*)data)[lastRec++] <= lastTime);
-    if (lastRec == numRecs)
+    if (lastRec >= numRecs)
         lastRec = numRecs - 1;
 
-    double t0 = ((double *)data)[0];
-    printf("FirstTime: %lf, LastTime: %lf\n", (((double*)data)[firstRec] - t0)/1000., (((double*)data)[lastRec] - t0)/1000.);
+    double t0 = 0.0;
+    double t1 = 0.0;
+    double t2 = 0.0;
+    CDFgetzVarRecordData(id, varNum, 0, &t0);
+    CDFgetzVarRecordData(id, varNum, firstRec, &t1);
+    CDFgetzVarRecordData(id, varNum, lastRec, &t2);
+    printf("FirstTime: %lf, LastTime: %lf\n", (t1 - t0)/1000., (t2 - t0)/1000.);
+
+    *firstRecord = firstRec;
+    *lastRecord = lastRec;
 
-    CDFdataFree(data);
+    return CDF_OK;
+}
 
-    numRecs = lastRec - firstRec + 1;
+CDFstatus loadMagColumns(CDFid id, long firstRecord, long lastRecord, MagColumns *columns)
+{
+    size_t nRecords = (size_t)(lastRecord - firstRecord + 1);
+    if (lastRecord < firstRecord || columns->nRecords + nRecords > columns->capacity)
+        return BAD_REC_COUNT;
 
-    for (uint8_t i = 0; i < nVariables && keep_running == 1; i++)
+    double *destinations[5] = {columns->times, columns->latitudes, columns->longitudes, columns->radii, columns->bNEC};
+    CDFstatus status = CDF_OK;
+    for (int i = 0; i < 5 && keep_running == 1; i++)
     {
-        varNum = CDFgetVarNum(cdfId, variables[i]);
-        status = CDFgetzVarNumDims(cdfId, varNum, &numDims);
+        // Straight into the columns; openMagCdf checked the values are doubles
+        status = CDFgetzVarRangeRecordsByVarID(id, CDFgetVarNum(id, magVariableNames[i]), firstRecord, lastRecord, destinations[i] + magVariableWidths[i] * columns->nRecords);
         if (status != CDF_OK)
         {
             printErrorMessage(status);
-            fprintf(stdout, "%s Error reading variable dimension for %s. Skipping this date.\n", infoHeader, variables[i]);
-            closeCdf(cdfId);
-            return;
+            fprintf(stdout, "%s Error loading data for %s. Skipping this date.\n", infoHeader, magVariableNames[i]);
+            return status;
         }
-        status = CDFgetzVarDimSizes(cdfId, varNum, dimSizes);
+    }
+    columns->nRecords += nRecords;
+
+    return CDF_OK;
+}
+
+CDFstatus openMagCdf(const char *cdfFile, CDFid *id)
+{
+    // Open the CDF file with validation
+    CDFsetValidate(VALIDATEFILEoff);
+    CDFstatus status = CDFopenCDF(cdfFile, id);
+    if (status != CDF_OK) 
+    {
+        printErrorMessage(status);
+        fprintf(stdout, "%s Could not open CDF file. Skipping this date.\n", infoHeader);
+        return status;
+    }
+
+    for (uint8_t i = 0; i < 5; i++)
+    {
+        status = CDFconfirmzVarExistence(*id, magVariableNames[i]);
         if (status != CDF_OK)
         {
             printErrorMessage(status);
-            fprintf(stdout, "%s Error reading variable dimension sizes for %s. Skipping this date.\n", infoHeader, variables[i]);
-            closeCdf(cdfId);
-            return;
+            fprintf(stdout, "\n%s Error reading variable %s from CDF file. Skipping this date.\n", infoHeader, magVariableNames[i]);
+            closeCdf(*id);
+            return status;
         }
-        // Calculate new size of memory to allocate
-        status = CDFgetDataTypeSize(dataType, &numVarBytes);
+        // loadMagColumns reads records into the columns as they are stored
+        long varNum = CDFgetVarNum(*id, magVariableNames[i]);
+        long dataType = 0;
+        long numDims = 0;
+        long dimSizes[CDF_MAX_DIMS] = {0};
+        status = CDFgetzVarDataType(*id, varNum, &dataType);
+        if (status == CDF_OK)
+            status = CDFgetzVarNumDims(*id, varNum, &numDims);
+        if (status == CDF_OK)
+            status = CDFgetzVarDimSizes(*id, varNum, dimSizes);
+        long values = 1;
+        for (long d = 0; d < numDims; d++)
+            values *= dimSizes[d];
+        if (status == CDF_OK && ((dataType != CDF_DOUBLE && dataType != CDF_REAL8 && dataType != CDF_EPOCH) || values != magVariableWidths[i]))
+            status = BAD_DATA_TYPE;
         if (status != CDF_OK)
         {
             printErrorMessage(status);
-            fprintf(stdout, "%s Error reading variable byte size for %s. Skipping this date.\n", infoHeader, variables[i]);
-            closeCdf(cdfId);
-            return;
-        }
-        numValues = 1;
-        for (uint8_t j = 0; j < numDims; j++)
-        {
-            numValues *= dimSizes[j];
-        }
-        numBytesToAdd = numValues * numRecs * numVarBytes;
-        newMem = realloc(dataBuffers[i], (size_t) numBytesToAdd);
-        if (newMem == NULL)
-        {
-            printf("Memory issue while realloc'ing input variables.\n");
-            exit(EXIT_FAILURE);
+            fprintf(stdout, "\n%s Unexpected type or shape of variable %s in CDF file. Skipping this date.\n", infoHeader, magVariableNames[i]);
+            closeCdf(*id);
+            return status;
         }
-        dataBuffers[i] = (uint8_t*) newMem;
+    }
 
-        status = CDFreadzVarRangeDataByVarID(cdfId, varNum, firstRec, lastRec, &data);
-        if (status != CDF_OK)
-        {
-            printErrorMessage(status);
-            fprintf(stdout, "%s Error loading data for %s. Skipping this date.\n", infoHeader, variables[i]);
-            closeCdf(cdfId);
-            CDFdataFree(data);
-            return;
-        }
-        memcpy(dataBuffers[i], data, numBytesToAdd);
-        CDFdataFree(data);
+    return CDF_OK;
+}
+
+void loadCdf(const char *cdfFile, double firstTime, double lastTime, MagColumns *columns)
+{
+    CDFid cdfId;
+    long firstRec = 0;
+    long lastRec = 0;
+
+    if (openMagCdf(cdfFile, &cdfId) != CDF_OK)
+        return;
+
+    if (getCdfRecordRange(cdfId, firstTime, lastTime, &firstRec, &lastRec) != CDF_OK)
+    {
+        closeCdf(cdfId);
+        return;
+    }
+
+    if (initMagColumns(columns, (size_t)(lastRec - firstRec + 1)) != CHAOS_MODEL_OK)
+    {
+        printf("Memory issue while allocating input variables.\n");
+        exit(EXIT_FAILURE);
     }
+    if (loadMagColumns(cdfId, firstRec, lastRec, columns) != CDF_OK)
+        columns->nRecords = 0;
+
     // close CDF
     closeCdf(cdfId);
 
-    // Update number of records found and memory allocated
-    *numberOfRecords += numRecs;
-    // *totalMemoryAllocated = fpMemorySize;
-
 }
 
 void printErrorMessage(CDFstatus status)
@@ -209,6 +237,30 @@ void closeCdf(CDFid id)
     }
 }
 
+// Satellite, date and version of a Swarm MAG file of the dataset, from its name
+static bool parseInputFilename(const char *name, const char *dataset, char satelliteLetter, long *year, long *month, long *day, long *version)
+{
+    // Most Swarm CDF file names have a length of 59 characters. The MDR_MAG_HR files have a length of 70 characters.
+    // The MDR_MAG_HR files have the same filename structure up to character 55.
+    if ((strlen(name) != 59 && strlen(name) != 70) || *(name+11) != satelliteLetter || strncmp(name+13, dataset, 5) != 0)
+        return false;
+
+    char fyear[5] = { 0 };
+    char fmonth[3] = { 0 };
+    char fday[3] = { 0 };
+    char fversion[5] = { 0 };
+    strncpy(fyear, name + 19, 4);
+    *year = atol(fyear);
+    strncpy(fmonth, name + 23, 2);
+    *month = atol(fmonth);
+    strncpy(fday, name + 25, 2);
+    *day = atol(fday);
+    strncpy(fversion, name + 51, 4);
+    *version = atol(fversion);
+
+    return true;
+}
+
 int getInputFilename(const char satelliteLetter, long year, long month, long day, const char *path, const char *dataset, char *filename)
 {
     char *searchPath[2] = {NULL, NULL};
@@ -230,22 +282,8 @@ int getInputFilename(const char satelliteLetter, long year, long month, long day
     long fileVersion;
     while(f != NULL)
     {
-        // Most Swarm CDF file names have a length of 59 characters. The MDR_MAG_HR files have a length of 70 characters.
-        // The MDR_MAG_HR files have the same filename structure up to character 55.
-        if ((strlen(f->fts_name) == 59 || strlen(f->fts_name) == 70) && *(f->fts_name+11) == satelliteLetter && strncmp(f->fts_name+13, dataset, 5) == 0)
+        if (parseInputFilename(f->fts_name, dataset, satelliteLetter, &fileYear, &fileMonth, &fileDay, &fileVersion))
         {
-            char fyear[5] = { 0 };
-            char fmonth[3] = { 0 };
-            char fday[3] = { 0 };
-            char version[5] = { 0 };
-            strncpy(fyear, f->fts_name + 19, 4);
-            fileYear = atol(fyear);
-            strncpy(fmonth, f->fts_name + 23, 2);
-            fileMonth = atol(fmonth);
-            strncpy(fday, f->fts_name + 25, 2);
-            fileDay = atol(fday);
-            strncpy(version, f->fts_name + 51, 4);
-            fileVersion = atol(version);
             if (fileYear == year && fileMonth == month && fileDay == day && fileVersion > lastVersion)
             {
                 lastVersion = fileVersion;
@@ -268,6 +306,90 @@ int getInputFilename(const char satelliteLetter, long year, long month, long day
 
 }
 
+int indexInputFiles(const char *satellites, const char *path, const char *dataset, InputFileIndex *index)
+{
+    bzero(index, sizeof(InputFileIndex));
+
+    char *searchPath[2] = {(char *)path, NULL};
+    FTS *fts = fts_open(searchPath, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    if (fts == NULL)
+    {
+        printf("Could not open directory %s for reading.", path);
+        return CDF_FIND_FILENAME;
+    }
+
+    InputFile file = {0};
+    InputFile *entry = NULL;
+    size_t capacity = 0;
+    void *newMem = NULL;
+    FTSENT *f = fts_read(fts);
+    while (f != NULL)
+    {
+        for (const char *s = satellites; *s != '\0'; s++)
+        {
+            if (!parseInputFilename(f->fts_name, dataset, *s, &file.year, &file.month, &file.day, &file.version))
+                continue;
+            file.satellite = *s;
+            // Newest version of each satellite-day
+            entry = NULL;
+            for (size_t i = 0; i < index->nFiles && entry == NULL; i++)
+                if (index->files[i].satellite == file.satellite && index->files[i].year == file.year && index->files[i].month == file.month && index->files[i].day == file.day)
+                    entry = &index->files[i];
+            if (entry != NULL && entry->version >= file.version)
+                break;
+            if (entry == NULL)
+            {
+                if (index->nFiles == capacity)
+                {
+                    capacity = capacity > 0 ? 2 * capacity : 1024;
+                    newMem = realloc(index->files, capacity * sizeof(InputFile));
+                    if (newMem == NULL)
+                    {
+                        fts_close(fts);
+                        freeInputFileIndex(index);
+                        return CDF_FIND_FILENAME;
+                    }
+                    index->files = newMem;
+                }
+                entry = &index->files[index->nFiles++];
+                entry->path = NULL;
+            }
+            free(entry->path);
+            file.path = strdup(f->fts_path);
+            *entry = file;
+            break;
+        }
+        f = fts_read(fts);
+    }
+    fts_close(fts);
+
+    return CDF_ALL_GOOD;
+}
+
+int findInputFilename(const InputFileIndex *index, const char satellite, long year, long month, long day, char *filename)
+{
+    for (size_t i = 0; i < index->nFiles; i++)
+    {
+        if (index->files[i].satellite == satellite && index->files[i].year == year && index->files[i].month == month && index->files[i].day == day && index->files[i].path != NULL)
+        {
+            snprintf(filename, FILENAME_MAX, "%s", index->files[i].path);
+            return CDF_ALL_GOOD;
+        }
+    }
+
+    return CDF_FIND_FILENAME;
+}
+
+void freeInputFileIndex(InputFileIndex *index)
+{
+    for (size_t i = 0; i < index->nFiles; i++)
+        free(index->files[i].path);
+    free(index->files);
+    bzero(index, sizeof(InputFileIndex));
+
+    return;
+}
+
 int getOutputFilename(const char satellite, long year, long month, long day, char *firstTimeString, char *lastTimeString, const char *exportDir, char *cdfFileName, char *magDataset)
 {
 
@@ -283,7 +405,7 @@ int getOutputFilename(const char satellite, long year, long month, long day, cha
 }
 
 
-CDFstatus exportCdf(const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, const char satellite, const char *dataset, const char *exportVersion, double *times, double *latitudes, double *longitudes, double *radii, double *bCore, double *bCrust, double *dbMeas, size_t nVectors)
+CDFstatus exportCdf(const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, int nVersions, const ModelWorkspace *workspace, const char satellite, const char *dataset, const char *exportVersion, double *times, double *latitudes, double *longitudes, double *radii, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas, size_t nVectors)
 {
 
     fprintf(stdout, "%sExporting CHAOS model data.\n",infoHeader);
@@ -307,8 +429,29 @@ CDFstatus exportCdf(const char *cdfFilename, const char *magFilename, ChaosCoeff
         createVarFrom2DVar(exportCdfId, "B_core_nec", CDF_REAL8, 0, nVectors-1, bCore, 3);
         createVarFrom2DVar(exportCdfId, "B_crust_nec", CDF_REAL8, 0, nVectors-1, bCrust, 3);
         createVarFrom2DVar(exportCdfId, "dB_nec", CDF_REAL8, 0, nVectors-1, dbMeas, 3);
+        if (dBdtCore != NULL)
+            createVarFrom2DVar(exportCdfId, "dBdt_core_nec", CDF_REAL8, 0, nVectors-1, dBdtCore, 3);
 
-        addAttributes(exportCdfId, cdfFilename, magFilename, coeffs, SOFTWARE_VERSION_STRING, satellite, dataset, SOFTWARE_VERSION, times[0], times[nVectors-1]);
+        // Further model versions
+        char name[CDF_VAR_NAME_LEN256] = {0};
+        size_t offset = 0;
+        for (int v = 1; v < nVersions; v++)
+        {
+            offset = (size_t)v * 3 * nVectors;
+            versionVariableName("B_core_nec", coeffs[v].version, name);
+            createVarFrom2DVar(exportCdfId, name, CDF_REAL8, 0, nVectors-1, bCore + offset, 3);
+            versionVariableName("B_crust_nec", coeffs[v].version, name);
+            createVarFrom2DVar(exportCdfId, name, CDF_REAL8, 0, nVectors-1, bCrust + offset, 3);
+            versionVariableName("dB_nec", coeffs[v].version, name);
+            createVarFrom2DVar(exportCdfId, name, CDF_REAL8, 0, nVectors-1, dbMeas + offset, 3);
+            if (dBdtCore != NULL)
+            {
+                versionVariableName("dBdt_core_nec", coeffs[v].version, name);
+                createVarFrom2DVar(exportCdfId, name, CDF_REAL8, 0, nVectors-1, dBdtCore + offset, 3);
+            }
+        }
+
+        addAttributes(exportCdfId, cdfFilename, magFilename, coeffs, nVersions, workspace, SOFTWARE_VERSION_STRING, satellite, dataset, SOFTWARE_VERSION, times[0], times[nVectors-1]);
 
         fprintf(stdout, "%sExported %ld records to %s.cdf\n", infoHeader, nVectors, cdfFilename);
         fflush(stdout);
@@ -322,6 +465,220 @@ cleanup:
 
 }
 
+// Names of the model output variables of version v, in appendExportRecords order
+static void exportModelVariableNames(const ChaosCoefficients *coeffs, int v, char names[4][CDF_VAR_NAME_LEN256])
+{
+    const char *baseNames[4] = {"B_core_nec", "B_crust_nec", "dB_nec", "dBdt_core_nec"};
+    for (int i = 0; i < 4; i++)
+    {
+        if (v == 0)
+            snprintf(names[i], CDF_VAR_NAME_LEN256, "%s", baseNames[i]);
+        else
+            versionVariableName(baseNames[i], coeffs[v].version, names[i]);
+    }
+
+    return;
+}
+
+CDFstatus createExportCdf(const char *cdfFilename, const ChaosCoefficients *coeffs, int nVersions, bool secularVariation, CDFid *id)
+{
+    CDFstatus status = CDFcreateCDF((char *)cdfFilename, id);
+    if (status != CDF_OK)
+    {
+        printErrorMessage(status);
+        return status;
+    }
+
+    long varNumber = 0;
+    createVar(*id, "Timestamp", CDF_EPOCH, 0, &varNumber);
+    createVar(*id, "Latitude", CDF_REAL8, 0, &varNumber);
+    createVar(*id, "Longitude", CDF_REAL8, 0, &varNumber);
+    createVar(*id, "Radius", CDF_REAL8, 0, &varNumber);
+    char names[4][CDF_VAR_NAME_LEN256] = {{0}};
+    for (int v = 0; v < nVersions; v++)
+    {
+        exportModelVariableNames(coeffs, v, names);
+        for (int i = 0; i < (secularVariation ? 4 : 3); i++)
+            status = createVar(*id, names[i], CDF_REAL8, 3, &varNumber);
+    }
+    if (status != CDF_OK)
+        closeCdf(*id);
+
+    return status;
+}
+
+CDFstatus appendExportRecords(CDFid id, const ChaosCoefficients *coeffs, int nVersions, long firstRecord, size_t nRecords, double *times, double *latitudes, double *longitudes, double *radii, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas, size_t stride)
+{
+    if (nRecords == 0)
+        return CDF_OK;
+
+    long lastRecord = firstRecord + (long)nRecords - 1;
+    CDFstatus status = CDF_OK;
+    double *columns[4] = {times, latitudes, longitudes, radii};
+    for (int i = 0; i < 4 && status == CDF_OK; i++)
+        status = CDFputVarRangeRecordsByVarName(id, magVariableNames[i], firstRecord, lastRecord, columns[i]);
+
+    char names[4][CDF_VAR_NAME_LEN256] = {{0}};
+    double *values[4] = {NULL};
+    size_t offset = 0;
+    for (int v = 0; v < nVersions && status == CDF_OK; v++)
+    {
+        exportModelVariableNames(coeffs, v, names);
+        offset = (size_t)v * stride;
+        values[0] = bCore + offset;
+        values[1] = bCrust + offset;
+        values[2] = dbMeas + offset;
+        values[3] = dBdtCore != NULL ? dBdtCore + offset : NULL;
+        for (int i = 0; i < 4 && values[i] != NULL && status == CDF_OK; i++)
+            status = CDFputVarRangeRecordsByVarName(id, names[i], firstRecord, lastRecord, values[i]);
+    }
+    if (status != CDF_OK)
+        printErrorMessage(status);
+
+    return status;
+}
+
+CDFstatus finishExportCdf(CDFid id, const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, int nVersions, const ModelWorkspace *workspace, const char satellite, const char *dataset, double firstTime, double lastTime, size_t nVectors)
+{
+    addAttributes(id, cdfFilename, magFilename, coeffs, nVersions, workspace, SOFTWARE_VERSION_STRING, satellite, dataset, SOFTWARE_VERSION, firstTime, lastTime);
+    closeCdf(id);
+
+    fprintf(stdout, "%sExported %ld records to %s.cdf\n", infoHeader, nVectors, cdfFilename);
+    fflush(stdout);
+
+    return CDF_OK;
+}
+
+
+int getPreviousOutputFilename(const char *outputFilename, const char *path, char *previousFilename)
+{
+    struct stat info;
+    if (stat(path, &info) != 0)
+        return CDF_FIND_FILENAME;
+    if (!S_ISDIR(info.st_mode))
+    {
+        snprintf(previousFilename, FILENAME_MAX, "%s", path);
+        return CDF_ALL_GOOD;
+    }
+
+    // Output names end in a 4-character version
+    const char *name = strrchr(outputFilename, '/');
+    name = name != NULL ? name + 1 : outputFilename;
+    size_t prefixLength = strlen(name) - strlen(EXPORT_VERSION_STRING);
+
+    char *searchPath[2] = {(char *)path, NULL};
+    FTS *fts = fts_open(searchPath, FTS_PHYSICAL | FTS_NOCHDIR, NULL);
+    if (fts == NULL)
+        return CDF_FIND_FILENAME;
+
+    bool gotFile = false;
+    long lastVersion = -1;
+    long fileVersion = 0;
+    long exportVersion = atol(EXPORT_VERSION_STRING);
+    char version[5] = {0};
+    FTSENT *f = fts_read(fts);
+    while (f != NULL)
+    {
+        if (f->fts_namelen == prefixLength + 8 && strncmp(f->fts_name, name, prefixLength) == 0 && strcmp(f->fts_name + prefixLength + 4, ".cdf") == 0 && isdigit(f->fts_name[prefixLength]) && isdigit(f->fts_name[prefixLength + 1]) && isdigit(f->fts_name[prefixLength + 2]) && isdigit(f->fts_name[prefixLength + 3]))
+        {
+            strncpy(version, f->fts_name + prefixLength, 4);
+            fileVersion = atol(version);
+            // Earlier versions only, never a newer product
+            if (fileVersion < exportVersion && fileVersion > lastVersion)
+            {
+                lastVersion = fileVersion;
+                snprintf(previousFilename, FILENAME_MAX, "%s", f->fts_path);
+                gotFile = true;
+            }
+        }
+        f = fts_read(fts);
+    }
+    fts_close(fts);
+
+    return gotFile ? CDF_ALL_GOOD : CDF_FIND_FILENAME;
+}
+
+// Entry of a global character attribute, or "" if it is absent or does not fit in bufSize
+static void getgEntryString(CDFid id, const char *attrName, long entryNum, char *buf, size_t bufSize)
+{
+    long numElems = 0;
+    buf[0] = '\0';
+
+    long attrNum = CDFgetAttrNum(id, (char *)attrName);
+    if (attrNum < 0 || CDFgetAttrgEntryNumElements(id, attrNum, entryNum, &numElems) != CDF_OK || numElems < 0 || (size_t)numElems >= bufSize)
+        return;
+    if (CDFgetAttrgEntry(id, attrNum, entryNum, buf) != CDF_OK)
+        numElems = 0;
+    buf[numElems] = '\0';
+
+    return;
+}
+
+// All records of a double-valued variable with nValues values per record into values,
+// if it has nRecords records
+static bool readPreviousVariable(CDFid id, const char *name, size_t nRecords, size_t nValues, double *values)
+{
+    long numRecs = 0, dataType = 0, numElems = 0, numDims = 0, recVary = 0;
+    long dimSizes[CDF_MAX_DIMS] = {0};
+    long dimVarys[CDF_MAX_DIMS] = {0};
+    CDFdata data = NULL;
+
+    CDFstatus status = CDFreadzVarAllByVarName(id, (char *)name, &numRecs, &dataType, &numElems, &numDims, dimSizes, &recVary, dimVarys, &data);
+    bool ok = status == CDF_OK && numRecs == (long)nRecords && (dataType == CDF_REAL8 || dataType == CDF_EPOCH) && (size_t)(numDims == 0 ? 1 : dimSizes[0]) == nValues;
+    if (ok)
+        memcpy(values, data, nRecords * nValues * sizeof(double));
+    if (data != NULL)
+        CDFdataFree(data);
+
+    return ok;
+}
+
+CDFstatus loadPreviousModelFields(const char *cdfFile, const ChaosCoefficients *coeffs, const ModelWorkspace *workspace, const MagColumns *inputs, double *bCore, double *bCrust, double *dBdtCore, bool *reuseCore, bool *reuseCrust)
+{
+    *reuseCore = false;
+    *reuseCrust = false;
+
+    CDFid id;
+    CDFstatus status = CDFopenCDF(cdfFile, &id);
+    if (status != CDF_OK)
+    {
+        printErrorMessage(status);
+        return status;
+    }
+
+    char coreKey[MODEL_COMPONENT_KEY_SIZE] = {0};
+    char crustKey[MODEL_COMPONENT_KEY_SIZE] = {0};
+    char previousKey[MODEL_COMPONENT_KEY_SIZE] = {0};
+    modelComponentKeys(coeffs, workspace, coreKey, crustKey);
+    getgEntryString(id, "Model_component_keys", 0, previousKey, MODEL_COMPONENT_KEY_SIZE);
+    bool coreMatches = strcmp(previousKey, coreKey) == 0;
+    getgEntryString(id, "Model_component_keys", 1, previousKey, MODEL_COMPONENT_KEY_SIZE);
+    bool crustMatches = strcmp(previousKey, crustKey) == 0;
+
+    // Same samples: times and positions as read from the MAG file
+    size_t nInputs = inputs->nRecords;
+    bool sameSamples = false;
+    double *previous = NULL;
+    if (coreMatches || crustMatches)
+        previous = malloc(nInputs * sizeof(double));
+    if (previous != NULL)
+    {
+        const double *samples[4] = {inputs->times, inputs->latitudes, inputs->longitudes, inputs->radii};
+        sameSamples = true;
+        for (int i = 0; i < 4 && sameSamples; i++)
+            sameSamples = readPreviousVariable(id, magVariableNames[i], nInputs, 1, previous) && memcmp(previous, samples[i], nInputs * sizeof(double)) == 0;
+        free(previous);
+    }
+
+    if (crustMatches && sameSamples)
+        *reuseCrust = readPreviousVariable(id, "B_crust_nec", nInputs, 3, bCrust);
+    if (coreMatches && sameSamples)
+        *reuseCore = readPreviousVariable(id, "B_core_nec", nInputs, 3, bCore) && (dBdtCore == NULL || readPreviousVariable(id, "dBdt_core_nec", nInputs, 3, dBdtCore));
+
+    closeCdf(id);
+
+    return CDF_OK;
+}
 
 void exportMetaInfo(const char *outputFilename, const char *magFilename, const char *chaosCoreFilename, const char *chaosStaticFilename, long nVectors, time_t startTime, time_t stopTime)
 {
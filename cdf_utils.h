@@ -24,6 +24,7 @@
 #define _LOAD_CDF_H
 
 #include "shc.h"
+#include "model.h"
 
 #include <stdint.h>
 #include <stdlib.h>
@@ -34,7 +35,16 @@ enum CDF_UTILS {
     CDF_FIND_FILENAME = -1
 };
 
-void loadCdf(const char *cdfFile, double firstTime, double lastTime, char *variables[], int nVariables, uint8_t **dataBuffers, size_t *numberOfRecords);
+// Timestamp, Latitude, Longitude, Radius and B_NEC of the records in the time range into
+// columns, which it allocates. columns->nRecords is 0 if none could be read.
+void loadCdf(const char *cdfFile, double firstTime, double lastTime, MagColumns *columns);
+// Opens a MAG CDF after checking it has the variables of MagColumns
+CDFstatus openMagCdf(const char *cdfFile, CDFid *id);
+// First and last records loadCdf reads for the time range, found by binary search over Timestamp records
+CDFstatus getCdfRecordRange(CDFid id, double firstTime, double lastTime, long *firstRecord, long *lastRecord);
+// Appends records firstRecord through lastRecord to columns, which must have room for them.
+// The CDF library reads them directly into the columns.
+CDFstatus loadMagColumns(CDFid id, long firstRecord, long lastRecord, MagColumns *columns);
 
 void printErrorMessage(CDFstatus status);
 
@@ -42,9 +52,50 @@ void closeCdf(CDFid id);
 
 int getInputFilename(const char satelliteLetter, long year, long month, long day, const char *path, const char *dataset, char *filename);
 
+// Newest MAG file of each satellite-day under a directory, for looking up many days from one scan
+typedef struct InputFile
+{
+    char satellite;
+    long year;
+    long month;
+    long day;
+    long version;
+    char *path;
+} InputFile;
+
+typedef struct InputFileIndex
+{
+    size_t nFiles;
+    InputFile *files;
+} InputFileIndex;
+
+// Indexes the files of the dataset under path for the satellites, a string of letters such as "ABC"
+int indexInputFiles(const char *satellites, const char *path, const char *dataset, InputFileIndex *index);
+// As getInputFilename, from the index
+int findInputFilename(const InputFileIndex *index, const char satellite, long year, long month, long day, char *filename);
+void freeInputFileIndex(InputFileIndex *index);
+
 int getOutputFilename(const char satellite, long year, long month, long day, char *firstTimeString, char *lastTimeString, const char *exportDir, char *cdfFileName, char *magDataset);
 
-CDFstatus exportCdf(const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, const char satellite, const char *dataset, const char *exportVersion, double *times, double *latitudes, double *longitudes, double *radii, double *bCore, double *bCrust, double *dbMeas, size_t nVectors);
+// Model outputs hold nVersions blocks of 3 * nVectors values, one per version in coeffs.
+// The first version's variables are unsuffixed; others get versionVariableName names.
+CDFstatus exportCdf(const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, int nVersions, const ModelWorkspace *workspace, const char satellite, const char *dataset, const char *exportVersion, double *times, double *latitudes, double *longitudes, double *radii, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas, size_t nVectors);
+
+// exportCdf in steps, for outputs produced a part at a time: createExportCdf makes the variables,
+// appendExportRecords writes nRecords records from firstRecord on with version v of the model
+// outputs starting at v * stride, and finishExportCdf adds the attributes and closes the file.
+CDFstatus createExportCdf(const char *cdfFilename, const ChaosCoefficients *coeffs, int nVersions, bool secularVariation, CDFid *id);
+CDFstatus appendExportRecords(CDFid id, const ChaosCoefficients *coeffs, int nVersions, long firstRecord, size_t nRecords, double *times, double *latitudes, double *longitudes, double *radii, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas, size_t stride);
+CDFstatus finishExportCdf(CDFid id, const char *cdfFilename, const char *magFilename, ChaosCoefficients *coeffs, int nVersions, const ModelWorkspace *workspace, const char satellite, const char *dataset, double firstTime, double lastTime, size_t nVectors);
+
+// Newest earlier product in path, a directory, for the satellite, dataset and time range of
+// outputFilename (highest version below its own), or path itself if it is a file
+int getPreviousOutputFilename(const char *outputFilename, const char *path, char *previousFilename);
+
+// For reprocessing: copies the first model version's core field (with dBdtCore unless NULL)
+// and crustal field from a previous product whose Model_component_keys match the current ones
+// and whose samples are those in inputs. reuseCore and reuseCrust tell what was copied.
+CDFstatus loadPreviousModelFields(const char *cdfFile, const ChaosCoefficients *coeffs, const ModelWorkspace *workspace, const MagColumns *inputs, double *bCore, double *bCrust, double *dBdtCore, bool *reuseCore, bool *reuseCrust);
 
 void exportMetaInfo(const char *outputFilename, const char *magFilename, const char *chaosCoreFilename, const char *chaosStaticFilename, long nVectors, time_t startTime, time_t stopTime);
 
@@ -26,48 +26,127 @@
 #include "chaos_settings.h"
 
 #include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
 
 #include <ctype.h>
 
+// GZIP level 6 as suggested compromise between speed and size by CDF C reference; blocking factor 43200 as requested by DTU
+static CdfCompression cdfCompression = {GZIP_COMPRESSION, CDF_GZIP_COMPRESSION_LEVEL, CDF_BLOCKING_FACTOR};
 
-CDFstatus createVarFrom1DVar(CDFid id, char *name, long dataType, long startIndex, long stopIndex, void *buffer)
+bool parseCdfCompression(const char *name, CdfCompression *compression)
+{
+    if (strncmp(name, "gzip", 4) == 0 && strlen(name) == 5 && name[4] >= '1' && name[4] <= '9')
+    {
+        compression->type = GZIP_COMPRESSION;
+        compression->level = name[4] - '0';
+    }
+    else if (strcmp(name, "rle") == 0)
+        compression->type = RLE_COMPRESSION;
+    else if (strcmp(name, "huffman") == 0)
+        compression->type = HUFF_COMPRESSION;
+    else if (strcmp(name, "ahuffman") == 0)
+        compression->type = AHUFF_COMPRESSION;
+    else if (strcmp(name, "none") == 0)
+        compression->type = NO_COMPRESSION;
+    else
+        return false;
+
+    return true;
+}
+
+void cdfCompressionName(const CdfCompression *compression, char *name)
+{
+    switch (compression->type)
+    {
+        case GZIP_COMPRESSION:
+            sprintf(name, "gzip%ld", compression->level);
+            break;
+        case RLE_COMPRESSION:
+            sprintf(name, "rle");
+            break;
+        case HUFF_COMPRESSION:
+            sprintf(name, "huffman");
+            break;
+        case AHUFF_COMPRESSION:
+            sprintf(name, "ahuffman");
+            break;
+        default:
+            sprintf(name, "none");
+            break;
+    }
+
+    return;
+}
+
+void setCdfCompression(const CdfCompression *compression)
+{
+    cdfCompression = *compression;
+
+    return;
+}
+
+void getCdfCompression(CdfCompression *compression)
+{
+    *compression = cdfCompression;
+
+    return;
+}
+
+
+CDFstatus createVar(CDFid id, char *name, long dataType, uint8_t dimSize, long *varNumber)
 {
     CDFstatus status;
-    long exportDimSizes[1] = {0};
+    long dimSizes[1] = {dimSize};
     long recVary = {VARY};
-    long dimNoVary = {NOVARY};
-    long varNumber;
+    long dimVary[1] = {dimSize > 0 ? VARY : NOVARY};
     long cType;
     long cParams[CDF_MAX_PARMS];
 
-    status = CDFcreatezVar(id, name, dataType, 1, 0L, exportDimSizes, recVary, dimNoVary, &varNumber);
+    status = CDFcreatezVar(id, name, dataType, 1, dimSize > 0 ? 1L : 0L, dimSizes, recVary, dimVary, varNumber);
     if (status != CDF_OK)
     {
         printErrorMessage(status);
         return status;
     }
-    status = CDFsetzVarSparseRecords(id, varNumber, NO_SPARSERECORDS);
+    status = CDFsetzVarSparseRecords(id, *varNumber, NO_SPARSERECORDS);
     if (status != CDF_OK)
     {
         printErrorMessage(status);
         return status;
     }
-    cType = GZIP_COMPRESSION;
-    cParams[0] = CDF_GZIP_COMPRESSION_LEVEL; // GZIP compression level 6 as suggested compromised between speed and size by CDF C reference 
-    status = CDFsetzVarCompression(id, varNumber, cType, cParams);
-    if (status != CDF_OK)
+    cType = cdfCompression.type;
+    if (cType == GZIP_COMPRESSION)
+        cParams[0] = cdfCompression.level;
+    else if (cType == RLE_COMPRESSION)
+        cParams[0] = RLE_OF_ZEROs;
+    else
+        cParams[0] = OPTIMAL_ENCODING_TREES;
+    if (cType != NO_COMPRESSION)
     {
-        printErrorMessage(status);
-        return status;
+        status = CDFsetzVarCompression(id, *varNumber, cType, cParams);
+        if (status != CDF_OK)
+        {
+            printErrorMessage(status);
+            return status;
+        }
     }
-    // Blocking factor 43200 as requested by DTU
-    status = CDFsetzVarBlockingFactor(id, varNumber, CDF_BLOCKING_FACTOR);
+    status = CDFsetzVarBlockingFactor(id, *varNumber, cdfCompression.blockingFactor);
     if (status != CDF_OK)
     {
         printErrorMessage(status);
-        return status;
     }
 
+    return status;
+}
+
+CDFstatus createVarFrom1DVar(CDFid id, char *name, long dataType, long startIndex, long stopIndex, void *buffer)
+{
+    long varNumber;
+    CDFstatus status = createVar(id, name, dataType, 0, &varNumber);
+    if (status != CDF_OK)
+        return status;
+
     long dataTypeSize;
     status = CDFgetDataTypeSize(dataType, &dataTypeSize);
     if (status != CDF_OK)
@@ -85,51 +164,11 @@ CDFstatus createVarFrom1DVar(CDFid id, char *name, long dataType, long startInde
 
 CDFstatus createVarFrom2DVar(CDFid id, char *name, long dataType, long startIndex, long stopIndex, void *buffer1D, uint8_t dimSize)
 {
-    CDFstatus status = CDF_OK;
-    long long nRecs = stopIndex - startIndex + 1;
-    long dimSizes[1] = {0};
-    long recVary = {VARY};
-    long dimVary[1] = {VARY};
     long varNumber;
-    long cType;
-    long cParams[CDF_MAX_PARMS];
-
-    dimSizes[0] = dimSize;
-
-    status = CDFcreatezVar(id, name, dataType, 1, 1L, dimSizes, recVary, dimVary, &varNumber);
-    if (status != CDF_OK)
-    {
-        printErrorMessage(status);
-        return status;
-    }
-    cType = GZIP_COMPRESSION;
-    cParams[0] = CDF_GZIP_COMPRESSION_LEVEL; // GZIP compression level 6 as suggested compromised between speed and size by CDF C reference 
-    status = CDFsetzVarCompression(id, varNumber, cType, cParams);
-    if (status != CDF_OK)
-    {
-        printErrorMessage(status);
-        return status;
-    }
-    // Blocking factor 43200 as requested by DTU
-    status = CDFsetzVarBlockingFactor(id, varNumber, CDF_BLOCKING_FACTOR);
-    if (status != CDF_OK)
-    {
-        printErrorMessage(status);
-        return status;
-    }
-    status = CDFsetzVarSparseRecords(id, varNumber, NO_SPARSERECORDS);
-    if (status != CDF_OK)
-    {
-        printErrorMessage(status);
-        return status;
-    }
-    long dataSize;
-    status = CDFgetDataTypeSize(dataType, &dataSize);
+    CDFstatus status = createVar(id, name, dataType, dimSize, &varNumber);
     if (status != CDF_OK)
-    {
-        printErrorMessage(status);
         return status;
-    }
+
     status = CDFputVarRangeRecordsByVarName(id, name, 0, stopIndex-startIndex, (void *)buffer1D);
     if (status != CDF_OK)
     {
@@ -138,4 +177,3 @@ CDFstatus createVarFrom2DVar(CDFid id, char *name, long dataType, long startInde
 
     return status;
 }
-
@@ -24,9 +24,31 @@
 #define CDF_VARS_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 #include <cdf.h>
 
+// Codec and blocking factor of the variables createVar makes
+typedef struct CdfCompression
+{
+    // GZIP_COMPRESSION, RLE_COMPRESSION, HUFF_COMPRESSION, AHUFF_COMPRESSION or NO_COMPRESSION
+    long type;
+    // 1 to 9, for GZIP_COMPRESSION
+    long level;
+    long blockingFactor;
+} CdfCompression;
+
+// Sets compression from gzip1 to gzip9, rle, huffman, ahuffman or none; false if name is none of these
+bool parseCdfCompression(const char *name, CdfCompression *compression);
+// Name of compression as parseCdfCompression takes it, into name with room for 16 characters
+void cdfCompressionName(const CdfCompression *compression, char *name);
+// Compression of variables created from now on, initially GZIP level CDF_GZIP_COMPRESSION_LEVEL
+// with blocking factor CDF_BLOCKING_FACTOR
+void setCdfCompression(const CdfCompression *compression);
+void getCdfCompression(CdfCompression *compression);
+
+// Compressed variable without records; dimSize values per record, or a scalar for 0
+CDFstatus createVar(CDFid id, char *name, long dataType, uint8_t dimSize, long *varNumber);
 CDFstatus createVarFrom1DVar(CDFid id, char *name, long dataType, long startIndex, long stopIndex, void *buffer);
 CDFstatus createVarFrom2DVar(CDFid id, char *name, long dataType, long startIndex, long stopIndex, void *buffer1D, uint8_t dimSize);
 
@@ -21,24 +21,29 @@
 // Adapted from SLIDEM Processor
 
 #include "cdf_utils.h"
+#include "cdf_vars.h"
 #include "shc.h"
 #include "model.h"
 #include "chaos_settings.h"
+#include "campaign.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <ctype.h>
 #include <math.h>
 #include <time.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdio_ext.h>
+#include <errno.h>
+#include <sys/wait.h>
 
 // #include <gsl/gsl_errno.h>
 // #include <gsl/gsl_sf_legendre.h>
 // #include <gsl/gsl_math.h>
 
-#define NMAGVARS 5
-
 // declare functions
 
 // Handle Ctrl-C
@@ -57,7 +62,10 @@ char infoHeader[50];
 enum CHAOS_STATUS
 {
     CHAOS_STATUS_OK = 0,
-    CHAOS_TIME_STRING = 1
+    CHAOS_TIME_STRING = 1,
+    // Past the CHAOS_MODEL_STATUS values, which processInChunks also returns
+    CHAOS_INPUT_FILE = CHAOS_MODEL_MEMORY + 1,
+    CHAOS_OUTPUT_FILE
 };
 
 int secondsFromTimeString(char *timeString, double *timeInSeconds)
@@ -110,10 +118,631 @@ int secondsFromTimeString(char *timeString, double *timeInSeconds)
     return CHAOS_STATUS_OK;
 }
 
+// Residuals for the records of the time range about chunkRecords at a time, appended to the
+// output as each chunk is done. Chunks are whole batches of control points, and each starts
+// at the last control point of the one before, so the output is that of a single pass.
+// Returns a CHAOS_MODEL_STATUS, or CHAOS_INPUT_FILE or CHAOS_OUTPUT_FILE if a CDF could not be read or written.
+static int processInChunks(const char *magFilename, const char *outputFilename, double firstCdfTime, double lastCdfTime, long chunkRecords, ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, int interpolationSkip, bool secularVariation, char satellite, const char *magDataset)
+{
+    CDFid magId;
+    CDFid exportId;
+    long firstRecord = 0;
+    long lastRecord = 0;
+    MagColumns inputs = {0};
+    double *bCore = NULL;
+    double *bCrust = NULL;
+    double *dBdtCore = NULL;
+    double *dbMeas = NULL;
+    int status = CHAOS_MODEL_OK;
+
+    if (openMagCdf(magFilename, &magId) != CDF_OK)
+        return CHAOS_INPUT_FILE;
+    if (getCdfRecordRange(magId, firstCdfTime, lastCdfTime, &firstRecord, &lastRecord) != CDF_OK)
+    {
+        fprintf(stderr, "%sFound no measurements in MAG file.\n", infoHeader);
+        closeCdf(magId);
+        return CHAOS_MODEL_OK;
+    }
+
+    size_t nSeries = (size_t)(lastRecord - firstRecord + 1);
+    size_t nPoints = numberOfControlPoints(nSeries, interpolationSkip);
+    size_t pointsPerChunk = (size_t)chunkRecords / ((size_t)interpolationSkip * CHAOS_BATCH_POINTS) * CHAOS_BATCH_POINTS;
+    if (pointsPerChunk == 0)
+        pointsPerChunk = CHAOS_BATCH_POINTS;
+    // Room for a chunk's samples and the control point carried from the one before
+    size_t capacity = pointsPerChunk * interpolationSkip + 1;
+    if (capacity > nSeries)
+        capacity = nSeries;
+    fprintf(stdout, "%sProcessing %zu records in chunks of %zu\n", infoHeader, nSeries, pointsPerChunk * interpolationSkip);
+
+    status = initMagColumns(&inputs, capacity);
+    bCore = (double*)malloc(nVersions * capacity * 3 * sizeof(double));
+    bCrust = (double*)malloc(nVersions * capacity * 3 * sizeof(double));
+    dbMeas = (double*)malloc(nVersions * capacity * 3 * sizeof(double));
+    if (secularVariation)
+        dBdtCore = (double*)malloc(nVersions * capacity * 3 * sizeof(double));
+    if (status != CHAOS_MODEL_OK || bCore == NULL || bCrust == NULL || dbMeas == NULL || (secularVariation && dBdtCore == NULL))
+    {
+        fprintf(stderr, "%sMemory issue.\n", infoHeader);
+        status = CHAOS_MODEL_MEMORY;
+        goto cleanup;
+    }
+
+    if (createExportCdf(outputFilename, coeffs, nVersions, secularVariation, &exportId) != CDF_OK)
+    {
+        fprintf(stderr, "%sCould not create %s.cdf\n", infoHeader, outputFilename);
+        status = CHAOS_OUTPUT_FILE;
+        goto cleanup;
+    }
+
+    double firstTime = 0.0;
+    double lastTime = 0.0;
+    double carried[SHC_MAX_MODEL_VERSIONS][9] = {{0}};
+    size_t windowStart = 0;
+    size_t windowEnd = 0;
+    size_t nCarried = 0;
+    size_t stride = 0;
+    double *fields[3] = {NULL};
+    for (size_t firstPoint = 0; firstPoint < nPoints && status == CHAOS_MODEL_OK && keep_running == 1; firstPoint += pointsPerChunk)
+    {
+        size_t lastPoint = firstPoint + pointsPerChunk < nPoints ? firstPoint + pointsPerChunk : nPoints;
+        windowEnd = lastPoint == nPoints ? nSeries : controlPointSample(lastPoint - 1, nSeries, interpolationSkip) + 1;
+
+        // The previous chunk's last sample, a control point, starts this one
+        if (nCarried > 0)
+        {
+            stride = 3 * inputs.nRecords;
+            for (int v = 0; v < nVersions; v++)
+            {
+                fields[0] = bCore;
+                fields[1] = bCrust;
+                fields[2] = dBdtCore;
+                for (int f = 0; f < 3; f++)
+                    if (fields[f] != NULL)
+                        memcpy(carried[v] + 3 * f, fields[f] + v * stride + stride - 3, 3 * sizeof(double));
+            }
+            inputs.times[0] = inputs.times[inputs.nRecords - 1];
+            inputs.latitudes[0] = inputs.latitudes[inputs.nRecords - 1];
+            inputs.longitudes[0] = inputs.longitudes[inputs.nRecords - 1];
+            inputs.radii[0] = inputs.radii[inputs.nRecords - 1];
+            memcpy(inputs.bNEC, inputs.bNEC + 3 * (inputs.nRecords - 1), 3 * sizeof(double));
+        }
+        inputs.nRecords = nCarried;
+        if (loadMagColumns(magId, firstRecord + (long)(windowStart + nCarried), firstRecord + (long)windowEnd - 1, &inputs) != CDF_OK)
+        {
+            fprintf(stderr, "%sCould not read %s.\n", infoHeader, magFilename);
+            status = CHAOS_INPUT_FILE;
+            break;
+        }
+        stride = 3 * inputs.nRecords;
+        for (int v = 0; v < nVersions && nCarried > 0; v++)
+        {
+            fields[0] = bCore;
+            fields[1] = bCrust;
+            fields[2] = dBdtCore;
+            for (int f = 0; f < 3; f++)
+                if (fields[f] != NULL)
+                    memcpy(fields[f] + v * stride, carried[v] + 3 * f, 3 * sizeof(double));
+        }
+
+        status = calculateResidualsWindow(coeffs, nVersions, workspace, interpolationSkip, nSeries, windowStart, firstPoint, &inputs, bCore, bCrust, dBdtCore, dbMeas);
+        if (status != CHAOS_MODEL_OK)
+        {
+            fprintf(stderr, "%sCould not calculate all residuals: return code = %d\n", infoHeader, status);
+            break;
+        }
+        if (keep_running == 0)
+            break;
+
+        if (appendExportRecords(exportId, coeffs, nVersions, (long)(windowStart + nCarried), inputs.nRecords - nCarried, inputs.times + nCarried, inputs.latitudes + nCarried, inputs.longitudes + nCarried, inputs.radii + nCarried, bCore + 3 * nCarried, bCrust + 3 * nCarried, dBdtCore != NULL ? dBdtCore + 3 * nCarried : NULL, dbMeas + 3 * nCarried, stride) != CDF_OK)
+        {
+            fprintf(stderr, "%sCould not export fields.\n", infoHeader);
+            status = CHAOS_OUTPUT_FILE;
+            break;
+        }
+        if (windowStart == 0)
+            firstTime = inputs.times[0];
+        lastTime = inputs.times[inputs.nRecords - 1];
+
+        windowStart = windowEnd - 1;
+        nCarried = 1;
+    }
+
+    if (status == CHAOS_MODEL_OK && keep_running == 1)
+        finishExportCdf(exportId, outputFilename, magFilename, coeffs, nVersions, workspace, satellite, magDataset, firstTime, lastTime, nSeries);
+    else
+    {
+        // No partial products
+        closeCdf(exportId);
+        char filename[FILENAME_MAX] = {0};
+        int length = snprintf(filename, FILENAME_MAX, "%s.cdf", outputFilename);
+        if (length >= 0 && length < FILENAME_MAX)
+            remove(filename);
+        if (keep_running == 0)
+            fprintf(stderr, "%sInterrupted (SIGINT).\n", infoHeader);
+    }
+
+cleanup:
+    closeCdf(magId);
+    freeMagColumns(&inputs);
+    free(bCore);
+    free(bCrust);
+    free(dBdtCore);
+    free(dbMeas);
+
+    return status;
+}
+
+// A satellite and date to process
+typedef struct ChaosDate
+{
+    char satellite;
+    long year;
+    long month;
+    long day;
+    // XYYYYMMDD
+    char label[16];
+} ChaosDate;
+
+// One satellite-day of a batch, from its MAG file through its output
+typedef struct ChaosDay
+{
+    char satellite;
+    long year;
+    long month;
+    long day;
+    char label[16];
+    char magFilename[FILENAME_MAX];
+    char outputFilename[FILENAME_MAX];
+    MagColumns inputs;
+    double *bCore;
+    double *bCrust;
+    double *dBdtCore;
+    double *dbMeas;
+    bool reuseCore;
+    bool reuseCrust;
+    // The workspace as the day was evaluated, for the attributes of its output
+    ModelWorkspace settings;
+    // Loaded and ready to evaluate
+    bool loaded;
+    // Evaluated and ready to export
+    bool evaluated;
+    // Could not be loaded or evaluated
+    bool failed;
+} ChaosDay;
+
+// What every day of a batch shares. The input and output thread reads it while the
+// main thread evaluates, so only the coefficient files and settings in it are used there.
+typedef struct ChaosBatch
+{
+    const char *magDataset;
+    const char *outputDir;
+    const char *previousProduct;
+    const char *firstTimeString;
+    const char *lastTimeString;
+    double firstTime;
+    double lastTime;
+    bool secularVariation;
+    ChaosCoefficients *coeffs;
+    int nVersions;
+    ModelWorkspace settings;
+    InputFileIndex inputFiles;
+    // Day the input and output thread exports, then day it loads; either may be NULL
+    ChaosDay *exportDay;
+    ChaosDay *loadDay;
+    // Days are exported in up to maxExports child processes at a time, each with its own
+    // copy of the CDF library, so that they are compressed concurrently. With 0 they are
+    // exported on the input and output thread.
+    int maxExports;
+    int nExports;
+    pid_t exportPids[CHAOS_MAX_EXPORT_PROCESSES];
+    char exportLabels[CHAOS_MAX_EXPORT_PROCESSES][16];
+    // Satellite-days that failed, counted on the input and output thread
+    int nFailures;
+} ChaosBatch;
+
+static void freeChaosDay(ChaosDay *day)
+{
+    freeMagColumns(&day->inputs);
+    free(day->bCore);
+    free(day->bCrust);
+    free(day->dBdtCore);
+    free(day->dbMeas);
+    day->bCore = NULL;
+    day->bCrust = NULL;
+    day->dBdtCore = NULL;
+    day->dbMeas = NULL;
+    day->loaded = false;
+    day->evaluated = false;
+
+    return;
+}
+
+static ChaosDay *setChaosDay(ChaosDay *day, const ChaosDate *date)
+{
+    day->satellite = date->satellite;
+    day->year = date->year;
+    day->month = date->month;
+    day->day = date->day;
+    snprintf(day->label, sizeof(day->label), "%s", date->label);
+    day->failed = false;
+
+    return day;
+}
+
+// Reads the day's MAG file and allocates its outputs, unless its output exists
+static void loadChaosDay(const ChaosBatch *batch, ChaosDay *day)
+{
+    day->loaded = false;
+    day->evaluated = false;
+
+    char firstTimeString[7] = {0};
+    char lastTimeString[7] = {0};
+    snprintf(firstTimeString, 7, "%s", batch->firstTimeString);
+    snprintf(lastTimeString, 7, "%s", batch->lastTimeString);
+    char fullOutputFilename[FILENAME_MAX] = {0};
+    if (getOutputFilename(day->satellite, day->year, day->month, day->day, firstTimeString, lastTimeString, batch->outputDir, day->outputFilename, (char *)batch->magDataset) != 0)
+    {
+        fprintf(stderr, "%s%s: could not get output filename.\n", infoHeader, day->label);
+        day->failed = true;
+        return;
+    }
+    int length = snprintf(fullOutputFilename, FILENAME_MAX, "%s.cdf", day->outputFilename);
+    if (length < 0 || length >= FILENAME_MAX)
+    {
+        fprintf(stderr, "%s%s: output filename is too long.\n", infoHeader, day->label);
+        day->failed = true;
+        return;
+    }
+    if (access(fullOutputFilename, F_OK) == 0)
+    {
+        fprintf(stdout, "%s%s: output CDF file exists. Skipping.\n", infoHeader, day->label);
+        return;
+    }
+    if (findInputFilename(&batch->inputFiles, day->satellite, day->year, day->month, day->day, day->magFilename) != CDF_ALL_GOOD)
+    {
+        fprintf(stdout, "%s%s: MAG input file is not available. Skipping.\n", infoHeader, day->label);
+        return;
+    }
+
+    double firstCdfTime = dayTimeToCdfEpoch(day->year, day->month, day->day, batch->firstTime);
+    double lastCdfTime = dayTimeToCdfEpoch(day->year, day->month, day->day, batch->lastTime);
+    fprintf(stdout, "%s%s: reading inputs from %s\n", infoHeader, day->label, day->magFilename);
+    loadCdf(day->magFilename, firstCdfTime, lastCdfTime, &day->inputs);
+    size_t nInputs = day->inputs.nRecords;
+    if (nInputs == 0)
+    {
+        fprintf(stderr, "%s%s: found no measurements in MAG file.\n", infoHeader, day->label);
+        freeChaosDay(day);
+        return;
+    }
+
+    size_t size = batch->nVersions * nInputs * 3 * sizeof(double);
+    day->bCore = (double*)malloc(size);
+    day->bCrust = (double*)malloc(size);
+    day->dbMeas = (double*)malloc(size);
+    if (batch->secularVariation)
+        day->dBdtCore = (double*)malloc(size);
+    if (day->bCore == NULL || day->bCrust == NULL || day->dbMeas == NULL || (batch->secularVariation && day->dBdtCore == NULL))
+    {
+        fprintf(stderr, "%s%s: memory issue.\n", infoHeader, day->label);
+        freeChaosDay(day);
+        day->failed = true;
+        return;
+    }
+
+    day->reuseCore = false;
+    day->reuseCrust = false;
+    char previousFilename[FILENAME_MAX] = {0};
+    if (batch->previousProduct != NULL && getPreviousOutputFilename(day->outputFilename, batch->previousProduct, previousFilename) == CDF_ALL_GOOD)
+    {
+        CDFstatus previousStatus = loadPreviousModelFields(previousFilename, &batch->coeffs[0], &batch->settings, &day->inputs, day->bCore, day->bCrust, day->dBdtCore, &day->reuseCore, &day->reuseCrust);
+        if (previousStatus != CDF_OK)
+            fprintf(stderr, "%s%s: could not read %s (CDF status %ld); evaluating all model components.\n", infoHeader, day->label, previousFilename, (long)previousStatus);
+        else
+            fprintf(stdout, "%s%s: reusing from %s: core %s, crust %s\n", infoHeader, day->label, previousFilename, day->reuseCore ? "yes" : "no", day->reuseCrust ? "yes" : "no");
+    }
+
+    day->loaded = true;
+
+    return;
+}
+
+static CDFstatus exportChaosDay(const ChaosBatch *batch, const ChaosDay *day)
+{
+    CDFstatus status = exportCdf(day->outputFilename, day->magFilename, batch->coeffs, batch->nVersions, &day->settings, day->satellite, batch->magDataset, EXPORT_VERSION_STRING, day->inputs.times, day->inputs.latitudes, day->inputs.longitudes, day->inputs.radii, day->bCore, day->bCrust, day->dBdtCore, day->dbMeas, day->inputs.nRecords);
+    if (status != CDF_OK)
+        fprintf(stderr, "%s%s: could not export fields: return code = %ld\n", infoHeader, day->label, (long)status);
+
+    return status;
+}
+
+// Waits for the oldest export process to finish. Failed exports report themselves.
+static void waitForExport(ChaosBatch *batch)
+{
+    if (batch->nExports == 0)
+        return;
+
+    int waitStatus = 0;
+    pid_t pid = 0;
+    do
+        pid = waitpid(batch->exportPids[0], &waitStatus, 0);
+    while (pid < 0 && errno == EINTR);
+    if (pid < 0 || !WIFEXITED(waitStatus))
+        fprintf(stderr, "%s%s: export process did not finish\n", infoHeader, batch->exportLabels[0]);
+    if (pid < 0 || !WIFEXITED(waitStatus) || WEXITSTATUS(waitStatus) != EXIT_SUCCESS)
+        batch->nFailures++;
+
+    batch->nExports--;
+    memmove(batch->exportPids, batch->exportPids + 1, batch->nExports * sizeof(pid_t));
+    memmove(batch->exportLabels, batch->exportLabels + 1, batch->nExports * sizeof(batch->exportLabels[0]));
+
+    return;
+}
+
+// Exports the day in a child process, which has a copy of the day as it is now, so the
+// day's memory can be reused as soon as this returns
+static void startExport(ChaosBatch *batch, const ChaosDay *day)
+{
+    if (batch->nExports == batch->maxExports)
+        waitForExport(batch);
+
+    fflush(stdout);
+    fflush(stderr);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        // Only this thread runs in the child. Drop output other threads had not flushed.
+        __fpurge(stdout);
+        __fpurge(stderr);
+        CDFstatus status = exportChaosDay(batch, day);
+        fflush(stdout);
+        fflush(stderr);
+        _exit(status == CDF_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    else if (pid < 0)
+    {
+        if (exportChaosDay(batch, day) != CDF_OK)
+            batch->nFailures++;
+        return;
+    }
+
+    batch->exportPids[batch->nExports] = pid;
+    snprintf(batch->exportLabels[batch->nExports], sizeof(batch->exportLabels[0]), "%s", day->label);
+    batch->nExports++;
+
+    return;
+}
+
+// Exports one day and loads another. All CDF file access of a batch is on this thread or in
+// export processes, as the CDF library is not safe to call from several threads at once.
+static void *batchInputOutput(void *arg)
+{
+    ChaosBatch *batch = (ChaosBatch *)arg;
+
+    ChaosDay *day = batch->exportDay;
+    if (day != NULL && day->evaluated)
+    {
+        if (batch->maxExports > 0)
+            startExport(batch, day);
+        else if (exportChaosDay(batch, day) != CDF_OK)
+            batch->nFailures++;
+    }
+    else if (day != NULL && day->failed)
+        batch->nFailures++;
+    if (day != NULL)
+        freeChaosDay(day);
+
+    if (batch->loadDay != NULL && keep_running == 1)
+        loadChaosDay(batch, batch->loadDay);
+
+    return NULL;
+}
+
+// Evaluates a loaded day on the calling thread
+static void evaluateChaosDay(ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, int interpolationSkip, ChaosDay *day)
+{
+    int status = CHAOS_MODEL_OK;
+    for (int v = 0; v < nVersions && status == SHC_OK; v++)
+        status = interpolateSHCCoefficients(&coeffs[v], day->year, day->month, day->day);
+    if (status != SHC_OK)
+    {
+        fprintf(stderr, "%s%s: could not interpolate model coefficients: return code = %d.\n", infoHeader, day->label, status);
+        day->failed = true;
+        return;
+    }
+
+    // Each day reports the degrees it used, as when processed on its own
+    workspace->minimumRadiusKm = HUGE_VAL;
+    workspace->reuseCore = day->reuseCore;
+    workspace->reuseCrust = day->reuseCrust;
+    status = calculateResiduals(coeffs, nVersions, workspace, interpolationSkip, &day->inputs, day->bCore, day->bCrust, day->dBdtCore, day->dbMeas);
+    day->settings = *workspace;
+    workspace->reuseCore = false;
+    workspace->reuseCrust = false;
+    if (status != CHAOS_MODEL_OK)
+    {
+        fprintf(stderr, "%s%s: could not calculate all residuals: return code = %d\n", infoHeader, day->label, status);
+        day->failed = true;
+        return;
+    }
+
+    day->evaluated = keep_running == 1;
+
+    return;
+}
+
+// Each satellite in satellites for each day from the first date through the last, date by date
+static ChaosDate *batchDays(const char *satellites, long firstYear, long firstMonth, long firstDay, long lastYear, long lastMonth, long lastDay, size_t *nDays)
+{
+    struct tm date = {0};
+    date.tm_year = (int)firstYear - 1900;
+    date.tm_mon = (int)firstMonth - 1;
+    date.tm_mday = (int)firstDay;
+    time_t first = timegm(&date);
+    date.tm_year = (int)lastYear - 1900;
+    date.tm_mon = (int)lastMonth - 1;
+    date.tm_mday = (int)lastDay;
+    time_t last = timegm(&date);
+    size_t nSatellites = strlen(satellites);
+    *nDays = last >= first ? (size_t)((last - first) / 86400 + 1) * nSatellites : 0;
+    if (*nDays == 0)
+        return NULL;
+
+    ChaosDate *days = calloc(*nDays, sizeof(ChaosDate));
+    if (days == NULL)
+    {
+        fprintf(stderr, "%sMemory issue.\n", infoHeader);
+        return NULL;
+    }
+    time_t t = first;
+    for (size_t d = 0; d < *nDays; d++)
+    {
+        if (d > 0 && d % nSatellites == 0)
+            t += 86400;
+        gmtime_r(&t, &date);
+        days[d].satellite = satellites[d % nSatellites];
+        days[d].year = date.tm_year + 1900;
+        days[d].month = date.tm_mon + 1;
+        days[d].day = date.tm_mday;
+        int length = snprintf(days[d].label, sizeof(days[d].label), "%c%04ld%02ld%02ld", days[d].satellite, days[d].year, days[d].month, days[d].day);
+        if (length < 0 || (size_t)length >= sizeof(days[d].label))
+        {
+            fprintf(stderr, "%sDate out of range.\n", infoHeader);
+            free(days);
+            return NULL;
+        }
+    }
+
+    return days;
+}
+
+// Processes each satellite in satellites for each day from the first date through the last.
+// A day is evaluated while the next is read and the one before is exported on another thread,
+// keeping three days in memory, plus one for each export process still running. The coefficients are loaded once and the MAG directory is scanned once.
+// Returns the number of satellite-days that failed, all of them if the batch could not start.
+static int processBatch(ChaosBatch *batch, const char *satellites, long firstYear, long firstMonth, long firstDay, long lastYear, long lastMonth, long lastDay, const char *magDir, ModelWorkspace *workspace, int interpolationSkip)
+{
+    size_t nDays = 0;
+    ChaosDate *days = batchDays(satellites, firstYear, firstMonth, firstDay, lastYear, lastMonth, lastDay, &nDays);
+    if (days == NULL)
+        return (int)nDays;
+
+    if (indexInputFiles(satellites, magDir, batch->magDataset, &batch->inputFiles) != CDF_ALL_GOOD)
+    {
+        fprintf(stderr, "%sCould not read MAG directory %s.\n", infoHeader, magDir);
+        free(days);
+        return (int)nDays;
+    }
+    fprintf(stdout, "%sProcessing %zu satellite-days; %zu MAG files indexed\n", infoHeader, nDays, batch->inputFiles.nFiles);
+
+    // Day d is evaluated in slot d % 3, day d - 1 exported from the slot before and
+    // day d + 1 read into the one after
+    ChaosDay *slots = calloc(3, sizeof(ChaosDay));
+    if (slots == NULL)
+    {
+        fprintf(stderr, "%sMemory issue.\n", infoHeader);
+        free(days);
+        freeInputFileIndex(&batch->inputFiles);
+        return (int)nDays;
+    }
+    batch->nFailures = 0;
+    ChaosDay *day = NULL;
+    pthread_t thread;
+    batch->exportDay = NULL;
+    batch->loadDay = setChaosDay(&slots[0], &days[0]);
+    batchInputOutput(batch);
+    for (size_t d = 0; d < nDays && keep_running == 1; d++)
+    {
+        day = &slots[d % 3];
+        batch->exportDay = d > 0 ? &slots[(d - 1) % 3] : NULL;
+        batch->loadDay = d + 1 < nDays ? setChaosDay(&slots[(d + 1) % 3], &days[d + 1]) : NULL;
+        bool started = pthread_create(&thread, NULL, batchInputOutput, batch) == 0;
+        if (day->loaded)
+            evaluateChaosDay(batch->coeffs, batch->nVersions, workspace, interpolationSkip, day);
+        if (started)
+            pthread_join(thread, NULL);
+        else
+            batchInputOutput(batch);
+    }
+    if (keep_running == 0)
+        fprintf(stderr, "%sInterrupted (SIGINT).\n", infoHeader);
+    else
+    {
+        batch->exportDay = &slots[(nDays - 1) % 3];
+        batch->loadDay = NULL;
+        batchInputOutput(batch);
+    }
+    while (batch->nExports > 0)
+        waitForExport(batch);
+
+    for (int s = 0; s < 3; s++)
+        freeChaosDay(&slots[s]);
+    free(slots);
+    free(days);
+    freeInputFileIndex(&batch->inputFiles);
+
+    return batch->nFailures;
+}
+
+// Adds a campaign job for each satellite-day whose output does not exist. Each job runs chaos for
+// its day with the arguments of this call other than the date and the campaign and batch options.
+// HR_1B jobs sort ahead of LR_1B jobs, so that the long days are not left to the end.
+static int createCampaign(const char *jobDir, int argc, char **argv, const char *satellites, long firstYear, long firstMonth, long firstDay, long lastYear, long lastMonth, long lastDay, char *magDataset, const char *outputDir, char *firstTimeString, char *lastTimeString)
+{
+    int status = initCampaign(jobDir);
+    if (status != CAMPAIGN_OK)
+        return status;
+
+    size_t nDays = 0;
+    ChaosDate *days = batchDays(satellites, firstYear, firstMonth, firstDay, lastYear, lastMonth, lastDay, &nDays);
+    char **args = calloc(argc, sizeof(char *));
+    if (days == NULL || args == NULL)
+    {
+        free(days);
+        free(args);
+        return CAMPAIGN_JOB_FILE;
+    }
+    int nArgs = 1;
+    for (int i = 2; i < argc; i++)
+        if (strncmp(argv[i], "--campaign-create=", 18) != 0 && strncmp(argv[i], "--last-date=", 12) != 0 && strncmp(argv[i], "--satellites=", 13) != 0)
+            args[nArgs++] = argv[i];
+
+    char name[CAMPAIGN_JOB_NAME_SIZE] = {0};
+    char outputFilename[FILENAME_MAX] = {0};
+    char fullOutputFilename[FILENAME_MAX] = {0};
+    size_t nAdded = 0;
+    size_t nFinished = 0;
+    for (size_t d = 0; d < nDays && status == CAMPAIGN_OK; d++)
+    {
+        getOutputFilename(days[d].satellite, days[d].year, days[d].month, days[d].day, firstTimeString, lastTimeString, outputDir, outputFilename, magDataset);
+        snprintf(fullOutputFilename, FILENAME_MAX, "%s.cdf", outputFilename);
+        if (access(fullOutputFilename, F_OK) == 0)
+        {
+            nFinished++;
+            continue;
+        }
+        snprintf(name, CAMPAIGN_JOB_NAME_SIZE, "%d_%s_%s", strcmp(magDataset, "HR_1B") == 0 ? 0 : 1, magDataset, days[d].label);
+        args[0] = days[d].label;
+        status = addCampaignJob(jobDir, name, fullOutputFilename, nArgs, args);
+        if (status == CAMPAIGN_OK)
+            nAdded++;
+        else if (status == CAMPAIGN_JOB_EXISTS)
+            status = CAMPAIGN_OK;
+    }
+    fprintf(stdout, "%sAdded %zu %s jobs to %s for %zu satellite-days; %zu already have outputs\n", infoHeader, nAdded, magDataset, jobDir, nDays, nFinished);
+
+    free(days);
+    free(args);
+
+    return status;
+}
+
 int main (int argc, char **argv)
 {
 
 	int status = 0;
+	int exitStatus = EXIT_SUCCESS;
 
 	// Handle Ctrl-C
 	signal(SIGINT, sig_handler);
@@ -123,20 +752,18 @@ int main (int argc, char **argv)
 	char magFilename[FILENAME_MAX];
 	char outputFilename[FILENAME_MAX];
 
-	ChaosCoefficients coeffs = {0};
+	// The model in chaosModelCoefficientsDir, then any --additional-model versions
+	ChaosCoefficients coeffs[SHC_MAX_MODEL_VERSIONS] = {{0}};
+	const char *coeffDirs[SHC_MAX_MODEL_VERSIONS] = {NULL};
+	int nVersions = 1;
+	ModelWorkspace workspace = {0};
 
 	double *bCore = NULL;
 	double *bCrust = NULL;
+	double *dBdtCore = NULL;
 	double *dbMeas = NULL;
 
-	size_t nInputs = 0;
-	uint8_t *magVariables[NMAGVARS];
-
-	// Timestamp, Latitude, Longitude, Radius, B_NEC
-	for (int i = 0; i < NMAGVARS; i++)
-	{
-		magVariables[i] = NULL;
-	}
+	MagColumns inputs = {0};
 
     int optionsCount = 0;
 
@@ -146,6 +773,23 @@ int main (int argc, char **argv)
     char firstTimeString[] = "000000";
     char lastTimeString[] = "235959";
 
+    double truncationToleranceNT = 0.0;
+    bool singlePrecisionCrust = false;
+    double coreUpdateIntervalSeconds = CHAOS_CORE_UPDATE_INTERVAL_S;
+    bool secularVariation = false;
+    const char *previousProduct = NULL;
+    int threads = 1;
+    long chunkRecords = 0;
+    CdfCompression compression;
+    getCdfCompression(&compression);
+    int exportProcesses = CHAOS_DEFAULT_EXPORT_PROCESSES;
+    const char *satellites = NULL;
+    const char *lastDate = NULL;
+    const char *campaignCreate = NULL;
+    const char *campaignWork = NULL;
+    const char *campaignStatus = NULL;
+    double leaseSeconds = CAMPAIGN_DEFAULT_LEASE_S;
+
 	for (int i = 0; i < argc; i++)
 	{
 		if (strcmp(argv[i], "--about") == 0)
@@ -183,6 +827,152 @@ int main (int argc, char **argv)
             snprintf(lastTimeString, 7, "%s", argv[i] + 12);
             optionsCount++;
         }
+        else if (strcmp(argv[i], "--reference-kernel") == 0)
+        {
+            setFieldKernel(CHAOS_FIELD_KERNEL_REFERENCE);
+            optionsCount++;
+        }
+        else if (strcmp(argv[i], "--single-precision-crust") == 0)
+        {
+            optionsCount++;
+            singlePrecisionCrust = true;
+        }
+        else if (strcmp(argv[i], "--secular-variation") == 0)
+        {
+            optionsCount++;
+            secularVariation = true;
+        }
+        else if (strncmp(argv[i], "--additional-model=", 19) == 0)
+        {
+            if (nVersions == SHC_MAX_MODEL_VERSIONS)
+            {
+                fprintf(stderr, "At most %d model versions can be evaluated together.\n", SHC_MAX_MODEL_VERSIONS);
+                exit(EXIT_FAILURE);
+            }
+            coeffDirs[nVersions++] = argv[i] + 19;
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--previous-product=", 19) == 0)
+        {
+            previousProduct = argv[i] + 19;
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--core-update-interval=", 23) == 0)
+        {
+            char *lastParsedChar = argv[i] + 23;
+            coreUpdateIntervalSeconds = strtod(argv[i] + 23, &lastParsedChar);
+            if (lastParsedChar == argv[i] + 23 || coreUpdateIntervalSeconds < 0.0)
+            {
+                fprintf(stderr, "Expected a non-negative number of seconds for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            char *lastParsedChar = argv[i] + 10;
+            threads = (int)strtol(argv[i] + 10, &lastParsedChar, 10);
+            if (lastParsedChar == argv[i] + 10 || *lastParsedChar != '\0' || threads < 1)
+            {
+                fprintf(stderr, "Expected a positive number of threads for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--chunk-records=", 16) == 0)
+        {
+            char *lastParsedChar = argv[i] + 16;
+            chunkRecords = strtol(argv[i] + 16, &lastParsedChar, 10);
+            if (lastParsedChar == argv[i] + 16 || *lastParsedChar != '\0' || chunkRecords < 1)
+            {
+                fprintf(stderr, "Expected a positive number of records for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--compression=", 14) == 0)
+        {
+            if (!parseCdfCompression(argv[i] + 14, &compression))
+            {
+                fprintf(stderr, "Expected gzip1 to gzip9, rle, huffman, ahuffman or none for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--blocking-factor=", 18) == 0)
+        {
+            char *lastParsedChar = argv[i] + 18;
+            compression.blockingFactor = strtol(argv[i] + 18, &lastParsedChar, 10);
+            if (lastParsedChar == argv[i] + 18 || *lastParsedChar != '\0' || compression.blockingFactor < 1)
+            {
+                fprintf(stderr, "Expected a positive number of records for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--export-processes=", 19) == 0)
+        {
+            char *lastParsedChar = argv[i] + 19;
+            exportProcesses = (int)strtol(argv[i] + 19, &lastParsedChar, 10);
+            if (lastParsedChar == argv[i] + 19 || *lastParsedChar != '\0' || exportProcesses < 0 || exportProcesses > CHAOS_MAX_EXPORT_PROCESSES)
+            {
+                fprintf(stderr, "Expected 0 to %d export processes for %s.\n", CHAOS_MAX_EXPORT_PROCESSES, argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--last-date=", 12) == 0)
+        {
+            lastDate = argv[i] + 12;
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--satellites=", 13) == 0)
+        {
+            satellites = argv[i] + 13;
+            if (strlen(satellites) == 0 || strspn(satellites, "ABC") != strlen(satellites))
+            {
+                fprintf(stderr, "Expected satellite letters A, B or C for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--campaign-create=", 18) == 0)
+        {
+            campaignCreate = argv[i] + 18;
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--campaign-work=", 16) == 0)
+        {
+            campaignWork = argv[i] + 16;
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--campaign-status=", 18) == 0)
+        {
+            campaignStatus = argv[i] + 18;
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--lease=", 8) == 0)
+        {
+            char *lastParsedChar = argv[i] + 8;
+            leaseSeconds = strtod(argv[i] + 8, &lastParsedChar);
+            if (lastParsedChar == argv[i] + 8 || leaseSeconds <= 0.0)
+            {
+                fprintf(stderr, "Expected a positive number of seconds for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
+        else if (strncmp(argv[i], "--truncation-tolerance-nT=", 26) == 0)
+        {
+            char *lastParsedChar = argv[i] + 26;
+            truncationToleranceNT = strtod(argv[i] + 26, &lastParsedChar);
+            if (lastParsedChar == argv[i] + 26 || truncationToleranceNT < 0.0)
+            {
+                fprintf(stderr, "Expected a non-negative tolerance for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+        }
         else if (strncmp(argv[i], "--", 2) == 0)
         {
             fprintf(stderr, "Unknown option %s\n", argv[i]);
@@ -190,6 +980,17 @@ int main (int argc, char **argv)
         }
 	}
 
+    setCdfCompression(&compression);
+
+    // Campaign workers take everything else from the jobs
+    if (campaignWork != NULL || campaignStatus != NULL)
+    {
+        sprintf(infoHeader, "CHAOS campaign: ");
+        if (campaignStatus != NULL)
+            exit(printCampaignStatus(campaignStatus) == CAMPAIGN_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+        exit(runCampaignWorker(campaignWork, "/proc/self/exe", leaseSeconds) == CAMPAIGN_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     if (lastTime < firstTime)
     {
         fprintf(stderr, "Time travel is not permitted. Try --last-time >= --first-time.\n");
@@ -215,7 +1016,7 @@ int main (int argc, char **argv)
 
 	char *satDate = argv[1];
 	char *magDataset = argv[2];
-	char *coeffDir = argv[3];
+	coeffDirs[0] = argv[3];
 	char *magDir = argv[4];
 	char *outputDir = argv[5];
 
@@ -236,7 +1037,41 @@ int main (int argc, char **argv)
     }
 	sprintf(infoHeader, "CHAOS %s: ", satDate);
 
-	status = getOutputFilename(satellite, year, month, day, firstTimeString, lastTimeString, outputDir, outputFilename, magDataset);
+	// Batch mode: several days or satellites from one process
+	bool batch = lastDate != NULL || satellites != NULL;
+	long lastYear = year, lastMonth = month, lastDay = day;
+	bool lastDateDigits = lastDate == NULL || strlen(lastDate) == 8;
+	for (int c = 0; lastDate != NULL && c < 8 && lastDateDigits; c++)
+		lastDateDigits = isdigit(lastDate[c]);
+	if (!lastDateDigits || (lastDate != NULL && sscanf(lastDate, "%4ld%2ld%2ld", &lastYear, &lastMonth, &lastDay) != 3))
+	{
+		fprintf(stderr, "Expected YYYYMMDD for --last-date.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (lastYear * 10000 + lastMonth * 100 + lastDay < year * 10000 + month * 100 + day)
+	{
+		fprintf(stderr, "--last-date is before the date of %s.\n", satDate);
+		exit(EXIT_FAILURE);
+	}
+	if (batch && chunkRecords > 0 && campaignCreate == NULL)
+	{
+		fprintf(stderr, "--chunk-records cannot be combined with --last-date or --satellites.\n");
+		exit(EXIT_FAILURE);
+	}
+	if (batch)
+		sprintf(infoHeader, "CHAOS batch: ");
+	char satelliteString[2] = {satellite, '\0'};
+	if (satellites == NULL)
+		satellites = satelliteString;
+
+	if (campaignCreate != NULL)
+	{
+		sprintf(infoHeader, "CHAOS campaign: ");
+		status = createCampaign(campaignCreate, argc, argv, satellites, year, month, day, lastYear, lastMonth, lastDay, magDataset, outputDir, firstTimeString, lastTimeString);
+		exit(status == CAMPAIGN_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+
+	status = batch ? 0 : getOutputFilename(satellite, year, month, day, firstTimeString, lastTimeString, outputDir, outputFilename, magDataset);
 	if (status != 0)
 	{
 		fprintf(stderr, "Could not get output filename.\n");
@@ -250,7 +1085,7 @@ int main (int argc, char **argv)
 		fprintf(stderr, "Could not construct full output filename.\n");
 		exit(EXIT_FAILURE);
 	}
-	if (access(fullOutputFilename, F_OK) == 0)
+	if (!batch && access(fullOutputFilename, F_OK) == 0)
 	{
 		printf("%sOutput CDF file exists. Exiting.\n", infoHeader);
 		exit(EXIT_FAILURE);
@@ -262,20 +1097,96 @@ int main (int argc, char **argv)
 	if (strcmp(magDataset, "HR_1B") == 0)
 		interpolationSkip = 200;
 
+	if (chunkRecords > 0 && previousProduct != NULL)
+	{
+		fprintf(stderr, "--previous-product cannot be combined with --chunk-records.\n");
+		exit(EXIT_FAILURE);
+	}
+
 
-	status = loadModelCoefficients(coeffDir, &coeffs);
-	if (status != SHC_OK || !coeffs.initialized)
+	status = loadModelVersions(coeffDirs, nVersions, coeffs);
+	if (status != SHC_OK)
 	{
 		fprintf(stderr, "%sError reading CHAOS 7 coefficients files: return code = %d.\n", infoHeader, status);
 		goto cleanup;
 	}
+	// Versions name the output variables, so each may be loaded once only
+	for (int v = 1; v < nVersions; v++)
+	{
+		for (int w = 0; w < v; w++)
+		{
+			if (coeffs[v].initialized && coeffs[w].initialized && strcmp(coeffs[v].version, coeffs[w].version) == 0)
+			{
+				fprintf(stderr, "%sCHAOS-%s is in both %s and %s; model versions must be distinct.\n", infoHeader, coeffs[v].version, coeffDirs[w], coeffDirs[v]);
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	for (int v = 0; v < nVersions; v++)
+	{
+		if (!coeffs[v].initialized)
+		{
+			fprintf(stderr, "%sIncomplete set of CHAOS 7 coefficients files in %s.\n", infoHeader, coeffDirs[v]);
+			goto cleanup;
+		}
+		// Start of day; calculateResiduals moves the core to each update interval
+		status = interpolateSHCCoefficients(&coeffs[v], year, month, day);
+		if (status != SHC_OK)
+		{
+			fprintf(stderr, "%sCould not interpolate model coefficients: return code = %d.\n", infoHeader, status);
+			goto cleanup;
+		}
+	}
+	if (nVersions > 1)
+	{
+		fprintf(stdout, "%sModel versions:", infoHeader);
+		for (int v = 0; v < nVersions; v++)
+			fprintf(stdout, " %s", coeffs[v].version);
+		fprintf(stdout, "\n");
+	}
 
-	// Because MAG inputs are from daily CDF files, we only interpolate once.
-	// This is sufficient accuracy for space physics
-	status = interpolateSHCCoefficients(&coeffs, year, month, day);
-	if (status != SHC_OK)
+	status = initModelWorkspaceForVersions(&workspace, coeffs, nVersions);
+	if (status != CHAOS_MODEL_OK)
 	{
-		fprintf(stderr, "%sCould not interpolate model coefficients: return code = %d.\n", infoHeader, status);
+		fprintf(stderr, "%sCould not allocate model workspace: return code = %d.\n", infoHeader, status);
+		goto cleanup;
+	}
+	workspace.truncationToleranceNT = truncationToleranceNT;
+	workspace.singlePrecisionCrust = singlePrecisionCrust;
+	workspace.coreUpdateIntervalSeconds = coreUpdateIntervalSeconds;
+	workspace.threads = threads;
+	if (singlePrecisionCrust)
+	{
+		double maxDeviation[3] = {0.0};
+		double maxCrust[3] = {0.0};
+		status = singlePrecisionCrustDeviation(&coeffs[0], &workspace, CHAOS_REFERENCE_ORBIT_ALTITUDE_KM, maxDeviation, maxCrust);
+		if (status != CHAOS_MODEL_OK)
+		{
+			fprintf(stderr, "%sCould not validate single-precision crust: return code = %d.\n", infoHeader, status);
+			goto cleanup;
+		}
+		fprintf(stdout, "%sSingle-precision crust: max deviation from double on a %.0f km reference orbit N %.2g E %.2g C %.2g nT\n", infoHeader, CHAOS_REFERENCE_ORBIT_ALTITUDE_KM, maxDeviation[0], maxDeviation[1], maxDeviation[2]);
+	}
+
+	if (batch)
+	{
+		ChaosBatch chaosBatch = {0};
+		chaosBatch.magDataset = magDataset;
+		chaosBatch.outputDir = outputDir;
+		chaosBatch.previousProduct = previousProduct;
+		chaosBatch.firstTimeString = firstTimeString;
+		chaosBatch.lastTimeString = lastTimeString;
+		chaosBatch.firstTime = firstTime;
+		chaosBatch.lastTime = lastTime;
+		chaosBatch.secularVariation = secularVariation;
+		chaosBatch.coeffs = coeffs;
+		chaosBatch.nVersions = nVersions;
+		chaosBatch.settings = workspace;
+		chaosBatch.maxExports = exportProcesses;
+		int nFailures = processBatch(&chaosBatch, satellites, year, month, day, lastYear, lastMonth, lastDay, magDir, &workspace, interpolationSkip);
+		if (nFailures > 0)
+			fprintf(stderr, "%s%d satellite-days failed.\n", infoHeader, nFailures);
+		exitStatus = nFailures == 0 && keep_running == 1 ? EXIT_SUCCESS : EXIT_FAILURE;
 		goto cleanup;
 	}
 
@@ -288,39 +1199,56 @@ int main (int argc, char **argv)
         exit(1);
     }
 
-	char *magVariableNames[NMAGVARS] = {
-		"Timestamp",
-		"Latitude",
-		"Longitude",
-		"Radius",
-		"B_NEC"
-	};
-
     // time range as CDF Epochs.
 	double firstCdfTime = dayTimeToCdfEpoch(year, month, day, firstTime);
 	double lastCdfTime = dayTimeToCdfEpoch(year, month, day, lastTime);
 
 	printf("%sReading inputs from %s\n", infoHeader, magFilename);
-	loadCdf(magFilename, firstCdfTime, lastCdfTime, magVariableNames, NMAGVARS, magVariables, &nInputs);
+	if (chunkRecords > 0)
+	{
+		status = processInChunks(magFilename, outputFilename, firstCdfTime, lastCdfTime, chunkRecords, coeffs, nVersions, &workspace, interpolationSkip, secularVariation, satellite, magDataset);
+		goto cleanup;
+	}
+
+	loadCdf(magFilename, firstCdfTime, lastCdfTime, &inputs);
+	size_t nInputs = inputs.nRecords;
 	if (nInputs == 0)
 	{
 		fprintf(stderr, "%sFound no measurements in MAG file.\n", infoHeader);
 		goto cleanup;
 	}
 
-	// Measured fields
-	dbMeas = (double*)malloc(nInputs * 3 * sizeof(double));
+	// Measured fields, less each model version
+	dbMeas = (double*)malloc(nVersions * nInputs * 3 * sizeof(double));
 
-	// Model fields
-	bCore = (double*)malloc(nInputs * 3 * sizeof(double));
-	bCrust = (double*)malloc(nInputs * 3 * sizeof(double));
-	if (dbMeas == NULL || bCore == NULL || bCrust == NULL)
+	// Model fields, one block per version
+	bCore = (double*)malloc(nVersions * nInputs * 3 * sizeof(double));
+	bCrust = (double*)malloc(nVersions * nInputs * 3 * sizeof(double));
+	if (secularVariation)
+		dBdtCore = (double*)malloc(nVersions * nInputs * 3 * sizeof(double));
+	if (dbMeas == NULL || bCore == NULL || bCrust == NULL || (secularVariation && dBdtCore == NULL))
 	{
 		fprintf(stderr, "%sMemory issue.\n", infoHeader);
 		goto cleanup;
 	}
 
-	status = calculateResiduals(&coeffs, interpolationSkip, magVariables, nInputs, bCore, bCrust, dbMeas);
+	// Components whose SHC files and settings are unchanged since a previous product are copied
+	if (previousProduct != NULL)
+	{
+		char previousFilename[FILENAME_MAX] = {0};
+		if (getPreviousOutputFilename(outputFilename, previousProduct, previousFilename) != CDF_ALL_GOOD)
+			fprintf(stdout, "%sNo previous product in %s; evaluating all model components.\n", infoHeader, previousProduct);
+		else
+		{
+			CDFstatus previousStatus = loadPreviousModelFields(previousFilename, &coeffs[0], &workspace, &inputs, bCore, bCrust, dBdtCore, &workspace.reuseCore, &workspace.reuseCrust);
+			if (previousStatus != CDF_OK)
+				fprintf(stderr, "%sCould not read %s (CDF status %ld); evaluating all model components.\n", infoHeader, previousFilename, (long)previousStatus);
+			else
+				fprintf(stdout, "%sReusing from %s: core %s, crust %s\n", infoHeader, previousFilename, workspace.reuseCore ? "yes" : "no", workspace.reuseCrust ? "yes" : "no");
+		}
+	}
+
+	status = calculateResiduals(coeffs, nVersions, &workspace, interpolationSkip, &inputs, bCore, bCrust, dBdtCore, dbMeas);
 	if (status != CHAOS_MODEL_OK)
 	{
 		fprintf(stderr, "%sCould not calculate all residuals: return code = %d\n", infoHeader, status);
@@ -333,7 +1261,7 @@ int main (int argc, char **argv)
 		goto cleanup;
 	}
 
-	status = exportCdf(outputFilename, magFilename, &coeffs, satellite, magDataset, EXPORT_VERSION_STRING, (double*)magVariables[0], (double*)magVariables[1], (double*)magVariables[2], (double*)magVariables[3], bCore, bCrust, dbMeas, nInputs);
+	status = exportCdf(outputFilename, magFilename, coeffs, nVersions, &workspace, satellite, magDataset, EXPORT_VERSION_STRING, inputs.times, inputs.latitudes, inputs.longitudes, inputs.radii, bCore, bCrust, dBdtCore, dbMeas, nInputs);
 	if (status != 0)
 	{
 		fprintf(stderr, "%sCould not export fields: return code = %d\n", infoHeader, status);
@@ -343,22 +1271,24 @@ int main (int argc, char **argv)
 	// exportMetaInfo(outputFilename, magFilename, coreFile, crustalFile, nInputs, processingStartTime, processingStopTime);
 
 cleanup:
-	freeChaosCoefficients(&coeffs);
+	freeModelWorkspace(&workspace);
+	for (int v = 0; v < nVersions; v++)
+		freeChaosCoefficients(&coeffs[v]);
 
-	for (int i = 0; i < NMAGVARS; i++)
-	{
-		if (magVariables[i] != NULL) free(magVariables[i]);
-	}
+	freeMagColumns(&inputs);
 	if (dbMeas != NULL) free(dbMeas);
 	if (bCore != NULL) free(bCore);
 	if (bCrust != NULL) free(bCrust);
+	if (dBdtCore != NULL) free(dBdtCore);
 
-	return 0;
+	return exitStatus;
 }
 
 void usage(const char* name)
 {
-	printf("Usage: %s XYYYYMMDD magDataset chaosModelCoefficientsDir magCdfDir outputDir [--first-time=hhmmss[.fractionalSecond]] [--last-time=hhmmss[.fractionalSecond]] [--about] [--help]\n", name);
+	printf("Usage: %s XYYYYMMDD magDataset chaosModelCoefficientsDir magCdfDir outputDir [--first-time=hhmmss[.fractionalSecond]] [--last-time=hhmmss[.fractionalSecond]] [--reference-kernel] [--single-precision-crust] [--truncation-tolerance-nT=value] [--core-update-interval=seconds] [--secular-variation] [--additional-model=chaosModelCoefficientsDir]... [--previous-product=cdfFileOrDir] [--threads=n] [--chunk-records=n] [--last-date=YYYYMMDD] [--satellites=ABC] [--export-processes=n] [--compression=codec] [--blocking-factor=n] [--campaign-create=jobDir] [--about] [--help]\n", name);
+	printf("       %s --campaign-work=jobDir [--lease=seconds]\n", name);
+	printf("       %s --campaign-status=jobDir\n", name);
 	printf(" X: satellite letter A, B, or C\n");
 	printf(" YYYYMMDD: year, month, day\n");
 	printf(" magDataset:\n");
@@ -369,6 +1299,24 @@ void usage(const char* name)
 	printf(" outputDir: directory to store magnetic field vectors\n");
     printf(" --first-time=hhmmss[.fractionalSecond]: process from this time on the specified date.\n");
     printf(" --last-time=hhmmss[.fractionalSecond]: process through to this time on the specified date.\n");
+    printf(" --reference-kernel: evaluate the model with the original per-term kernel, for validation.\n");
+    printf(" --single-precision-crust: sum the crustal field in single precision, after reporting its deviation from double precision on a reference orbit.\n");
+    printf(" --truncation-tolerance-nT=value: omit the highest degrees at each radius while their combined field bound is below value nT.\n");
+    printf(" --secular-variation: also export the core field's rate of change as dBdt_core_nec (nT/year).\n");
+    printf(" --core-update-interval=seconds: evaluate the core model at the centre of each interval of this length, or at every sample for 0 (default %.0f).\n", CHAOS_CORE_UPDATE_INTERVAL_S);
+    printf(" --additional-model=chaosModelCoefficientsDir: also export core, crustal and residual fields for the CHAOS version in this directory, named with a suffix for the version (e.g. B_core_nec_7_11). Each directory must hold a different version from the others and from chaosModelCoefficientsDir. Up to %d versions in all.\n", SHC_MAX_MODEL_VERSIONS);
+    printf(" --previous-product=cdfFileOrDir: copy B_core_nec (and dBdt_core_nec) or B_crust_nec from this product, or the newest earlier version of this product in this directory, when the content of the SHC files, the model settings and the samples are unchanged. dB_nec is recomputed.\n");
+    printf(" --threads=n: calculate model fields on n threads. The output does not depend on n (default 1).\n");
+    printf(" --chunk-records=n: read, evaluate and export about n records at a time, bounding memory use independently of the length of the day. n is rounded down to a multiple of %d (LR_1B) or %d (HR_1B) records, at which the output does not depend on n. Not with --previous-product.\n", 4 * CHAOS_BATCH_POINTS, 200 * CHAOS_BATCH_POINTS);
+    printf(" --last-date=YYYYMMDD: process each day from the date of XYYYYMMDD through this date. The model is loaded once, and each day is evaluated while the next is read and the previous one is exported. Days with an existing output are skipped. Exits with a failure status if any day fails or the batch is interrupted. Not with --chunk-records.\n");
+    printf(" --satellites=ABC: process these satellites instead of X, in batch mode as for --last-date.\n");
+    printf(" --export-processes=n: with --last-date or --satellites, export up to n days at once in child processes, compressing them concurrently; 0 exports on the input thread. Each adds a day to memory use (default %d).\n", CHAOS_DEFAULT_EXPORT_PROCESSES);
+    printf(" --compression=codec: compress output variables with gzip1 to gzip9, rle, huffman, ahuffman or none (default gzip%d).\n", CDF_GZIP_COMPRESSION_LEVEL);
+    printf(" --blocking-factor=n: allocate and compress output variables n records at a time (default %d).\n", CDF_BLOCKING_FACTOR);
+    printf(" --campaign-create=jobDir: add a job to the campaign in jobDir for each satellite-day selected as for --last-date and --satellites, unless its output exists. Jobs run chaos with the remaining arguments, so paths must be valid on every host. HR_1B jobs are taken before LR_1B jobs.\n");
+    printf(" --campaign-work=jobDir: run jobs of the campaign in jobDir until none are left. Workers on any hosts sharing jobDir may run at once. Run times are recorded in jobDir/done and output in jobDir/logs.\n");
+    printf(" --lease=seconds: reclaim jobs whose worker has not renewed its claim for this long (default %.0f).\n", CAMPAIGN_DEFAULT_LEASE_S);
+    printf(" --campaign-status=jobDir: print the numbers of waiting, claimed, done and failed jobs.\n");
     printf(" --about: print version and license information.\n");
     printf(" --help: print this message.\n");
 
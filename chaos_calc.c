@@ -66,6 +66,10 @@ typedef struct Data
     double bCrustN;
     double bCrustE;
     double bCrustC;
+    // dB_i / dx_j for B_i = N, E, C and x_j = r, theta, phi, with --gradient
+    double gradient[9];
+    // Core secular variation (NEC, nT/year), with --secular-variation
+    double dBdtCore[3];
 } Data;
 
 int loadInputsFromFile(char *inFile, Data **data, size_t *nInputs, bool verbose);
@@ -80,7 +84,11 @@ int main (int argc, char **argv)
 
 	time_t processingStartTime = time(NULL);
 
-	ChaosCoefficients coeffs = {0};
+	// The model in chaosModelCoefficientsDir, then any --additional-model versions
+	ChaosCoefficients coeffs[SHC_MAX_MODEL_VERSIONS] = {{0}};
+	const char *coeffDirs[SHC_MAX_MODEL_VERSIONS] = {NULL};
+	int nVersions = 1;
+	ModelWorkspace workspace = {0};
 
 	size_t nInputs = 0;
     Data *data = NULL;
@@ -88,6 +96,13 @@ int main (int argc, char **argv)
     int optionsCount = 0;
     bool overwrite = false;
     bool verbose = false;
+    bool gradient = false;
+    bool secularVariation = false;
+    bool fixedSite = false;
+    SiteField site = {0};
+    bool singlePrecisionCrust = false;
+    double truncationToleranceNT = 0.0;
+    double coreUpdateIntervalSeconds = CHAOS_CORE_UPDATE_INTERVAL_S;
 
 	for (int i = 0; i < argc; i++)
 	{
@@ -109,6 +124,63 @@ int main (int argc, char **argv)
 		{
             optionsCount++;
             verbose = true;
+		}
+		else if (strcmp(argv[i], "--gradient") == 0)
+		{
+            optionsCount++;
+            gradient = true;
+		}
+		else if (strcmp(argv[i], "--fixed-site") == 0)
+		{
+            optionsCount++;
+            fixedSite = true;
+		}
+		else if (strcmp(argv[i], "--secular-variation") == 0)
+		{
+            optionsCount++;
+            secularVariation = true;
+		}
+		else if (strcmp(argv[i], "--single-precision-crust") == 0)
+		{
+            optionsCount++;
+            singlePrecisionCrust = true;
+		}
+		else if (strncmp(argv[i], "--additional-model=", 19) == 0)
+		{
+            if (nVersions == SHC_MAX_MODEL_VERSIONS)
+            {
+                fprintf(stderr, "At most %d model versions can be evaluated together.\n", SHC_MAX_MODEL_VERSIONS);
+                exit(EXIT_FAILURE);
+            }
+            coeffDirs[nVersions++] = argv[i] + 19;
+            optionsCount++;
+		}
+		else if (strncmp(argv[i], "--core-update-interval=", 23) == 0)
+		{
+            char *lastParsedChar = argv[i] + 23;
+            coreUpdateIntervalSeconds = strtod(argv[i] + 23, &lastParsedChar);
+            if (lastParsedChar == argv[i] + 23 || coreUpdateIntervalSeconds < 0.0)
+            {
+                fprintf(stderr, "Expected a non-negative number of seconds for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
+		}
+		else if (strcmp(argv[i], "--reference-kernel") == 0)
+		{
+            optionsCount++;
+            setFieldKernel(CHAOS_FIELD_KERNEL_REFERENCE);
+		}
+		else if (strncmp(argv[i], "--truncation-tolerance-nT=", 26) == 0)
+		{
+            char *lastParsedChar = argv[i] + 26;
+            truncationToleranceNT = strtod(argv[i] + 26, &lastParsedChar);
+            if (lastParsedChar == argv[i] + 26 || truncationToleranceNT < 0.0)
+            {
+                fprintf(stderr, "Expected a non-negative tolerance for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            optionsCount++;
 		}
 		else if (strcmp(argv[i], "--help") == 0)
 		{
@@ -127,9 +199,19 @@ int main (int argc, char **argv)
 		usage(argv[0]);
 		exit(EXIT_FAILURE);
 	}
+    if (fixedSite && gradient)
+    {
+        fprintf(stderr, "--gradient is not available with --fixed-site.\n");
+        exit(EXIT_FAILURE);
+    }
+    if (nVersions > 1 && (fixedSite || gradient))
+    {
+        fprintf(stderr, "--additional-model is not available with --fixed-site or --gradient.\n");
+        exit(EXIT_FAILURE);
+    }
 
 	char *inFile = (char*)argv[1];
-	char *coeffDir = argv[2];
+	coeffDirs[0] = argv[2];
 
 	char fullOutputFilename[FILENAME_MAX] = {0};
 	status = snprintf(fullOutputFilename, FILENAME_MAX-4, "%s.out", inFile);
@@ -144,12 +226,25 @@ int main (int argc, char **argv)
 		exit(EXIT_FAILURE);
 	}
 
-	status = loadModelCoefficients(coeffDir, &coeffs);
-	if (status != SHC_OK || !coeffs.initialized)
+	status = loadModelVersions(coeffDirs, nVersions, coeffs);
+	if (status != SHC_OK)
 	{
 		fprintf(stderr, "Error reading CHAOS 7 coefficients files: return code = %d.\n", status);
 		goto cleanup;
 	}
+    for (int v = 0; v < nVersions; v++)
+    {
+        if (!coeffs[v].initialized)
+        {
+            fprintf(stderr, "Incomplete set of CHAOS 7 coefficients files in %s.\n", coeffDirs[v]);
+            goto cleanup;
+        }
+        if (verbose)
+            printf("Model version %s from %s\n", coeffs[v].version, coeffDirs[v]);
+    }
+
+    if (verbose)
+        printf("Batched field kernel: %s\n", batchKernelDescription());
 
     status = loadInputsFromFile(inFile, &data, &nInputs, verbose);
     if (status != CHAOS_STATUS_OK)
@@ -163,58 +258,160 @@ int main (int argc, char **argv)
         goto cleanup;
     }
 
-    // Date from first entry
-    time_t t = (time_t)data[0].unixTime;
-    struct tm *date = gmtime(&t);
-    if (date == NULL)
+    // Crust, and core at the first entry; each batch then moves the core to its own update interval
+    double fractionalYear = 0.0;
+    status = yearFractionFromUnixTime(data[0].unixTime, &fractionalYear);
+    if (status != SHC_OK)
     {
         fprintf(stderr, "Error interpreting first input's time.\n");
         goto cleanup;
     }
-    int year = date->tm_year + 1900;
-    int month = date->tm_mon + 1;
-    int day = date->tm_mday;
-
-	// Because MAG inputs are from daily CDF files, we only interpolate once.
-	// This is sufficient accuracy for space physics
-    status = interpolateSHCCoefficients(&coeffs, year, month, day);
+    for (int v = 0; v < nVersions && status == SHC_OK; v++)
+        status = interpolateSHCCoefficientsAtYear(&coeffs[v], fractionalYear);
 	if (status != SHC_OK)
 	{
 		fprintf(stderr, "Could not interpolate model coefficients: return code = %d.\n", status);
 		goto cleanup;
 	}
 
-    // Calculate and print output to file
-    Data *p = NULL;
-	double degrees = M_PI / 180.0;
-	double a = EARTH_RADIUS_KM;
-	double inputTime = 0.;
-	double r = 0.;
-	double theta = 0.0 * degrees;
-	double phi = 0.0 * degrees;
-    for (int i = 0; i < nInputs && keep_running; i++)
+    status = initModelWorkspaceForVersions(&workspace, coeffs, nVersions);
+    if (status != CHAOS_MODEL_OK)
     {
-        p = &data[i];
-        r = p->altitude + EARTH_RADIUS_KM;
-        theta = (90.0 - p->latitude) * degrees;
-        phi = p->longitude * degrees;
-        status = calculateField(r, theta, phi, &coeffs.core, &p->bCoreN, &p->bCoreE, &p->bCoreC);
+        fprintf(stderr, "Could not allocate model workspace: return code = %d.\n", status);
+        goto cleanup;
+    }
+    workspace.truncationToleranceNT = truncationToleranceNT;
+    workspace.singlePrecisionCrust = singlePrecisionCrust;
+    workspace.coreUpdateIntervalSeconds = coreUpdateIntervalSeconds;
+    if (verbose && singlePrecisionCrust)
+    {
+        double maxDeviation[3] = {0.0};
+        double maxCrust[3] = {0.0};
+        status = singlePrecisionCrustDeviation(&coeffs[0], &workspace, CHAOS_REFERENCE_ORBIT_ALTITUDE_KM, maxDeviation, maxCrust);
         if (status != CHAOS_MODEL_OK)
         {
-            fprintf(stderr, "Could not calculate core field: return code = %d\n", status);
+            fprintf(stderr, "Could not validate single-precision crust: return code = %d.\n", status);
             goto cleanup;
         }
-        status = calculateField(r, theta, phi, &coeffs.crust, &p->bCrustN, &p->bCrustE, &p->bCrustC);
+        printf("Single-precision crust on a %.0f km reference orbit: max deviation from double N %.2g E %.2g C %.2g nT, max crustal field N %.1f E %.1f C %.1f nT\n", CHAOS_REFERENCE_ORBIT_ALTITUDE_KM, maxDeviation[0], maxDeviation[1], maxDeviation[2], maxCrust[0], maxCrust[1], maxCrust[2]);
+    }
+
+    // Calculate and print output to file, CHAOS_BATCH_POINTS positions at a time
+    Data *p = NULL;
+	double degrees = M_PI / 180.0;
+	double r[CHAOS_BATCH_POINTS];
+	double theta[CHAOS_BATCH_POINTS];
+	double phi[CHAOS_BATCH_POINTS];
+	double unixTimes[CHAOS_BATCH_POINTS];
+    // One block of fields per model version
+    double bCore[SHC_MAX_MODEL_VERSIONS][3 * CHAOS_BATCH_POINTS];
+    double bCrust[SHC_MAX_MODEL_VERSIONS][3 * CHAOS_BATCH_POINTS];
+    double dBdtCore[SHC_MAX_MODEL_VERSIONS][3 * CHAOS_BATCH_POINTS];
+    double *bCoreOut[SHC_MAX_MODEL_VERSIONS];
+    double *bCrustOut[SHC_MAX_MODEL_VERSIONS];
+    double *dBdtOut[SHC_MAX_MODEL_VERSIONS];
+    for (int v = 0; v < nVersions; v++)
+    {
+        bCoreOut[v] = bCore[v];
+        bCrustOut[v] = bCrust[v];
+        dBdtOut[v] = dBdtCore[v];
+    }
+    double gradCore[9];
+    double gradCrust[9];
+    size_t nPoints = 0;
+    for (size_t first = 0; first < nInputs && keep_running; first += nPoints)
+    {
+        nPoints = nInputs - first < CHAOS_BATCH_POINTS ? nInputs - first : CHAOS_BATCH_POINTS;
+        for (size_t i = 0; i < nPoints; i++)
+        {
+            p = &data[first + i];
+            r[i] = p->altitude + EARTH_RADIUS_KM;
+            theta[i] = (90.0 - p->latitude) * degrees;
+            phi[i] = p->longitude * degrees;
+            unixTimes[i] = p->unixTime;
+        }
+        if (fixedSite)
+        {
+            // Site tables are rebuilt only when the position changes
+            for (size_t i = 0; i < nPoints && status == CHAOS_MODEL_OK; i++)
+            {
+                p = &data[first + i];
+                if (site.coreSplineFields == NULL || r[i] != site.radiusKm || theta[i] != site.theta || phi[i] != site.phi)
+                {
+                    freeSiteField(&site);
+                    status = initSiteField(&site, r[i], theta[i], phi[i], &coeffs[0], &workspace);
+                    if (status != CHAOS_MODEL_OK)
+                        break;
+                }
+                if (yearFractionFromUnixTime(p->unixTime, &fractionalYear) != SHC_OK)
+                {
+                    status = CHAOS_MODEL_COEFFICIENTS;
+                    break;
+                }
+                status = calculateSiteField(&site, &coeffs[0], fractionalYear, bCore[0] + 3*i, bCrust[0] + 3*i, dBdtCore[0] + 3*i);
+            }
+        }
+        else if (gradient)
+        {
+            for (size_t i = 0; i < nPoints && status == CHAOS_MODEL_OK; i++)
+            {
+                p = &data[first + i];
+                status = updateCoreForTime(&coeffs[0], &workspace, p->unixTime);
+                if (status != CHAOS_MODEL_OK)
+                    break;
+                status = calculateChaosFieldGradient(r[i], theta[i], phi[i], &coeffs[0], &workspace, bCore[0] + 3*i, bCrust[0] + 3*i, gradCore, gradCrust, secularVariation ? dBdtCore[0] + 3*i : NULL);
+                for (int j = 0; j < 9; j++)
+                    p->gradient[j] = gradCore[j] + gradCrust[j];
+            }
+        }
+        else
+            status = calculateFieldBatchVersions(r, theta, phi, unixTimes, nPoints, coeffs, nVersions, &workspace, bCoreOut, bCrustOut, secularVariation ? dBdtOut : NULL);
         if (status != CHAOS_MODEL_OK)
         {
-            fprintf(stderr, "Could not calculate crustal field: return code = %d\n", status);
+            fprintf(stderr, "Could not calculate core and crustal fields: return code = %d\n", status);
             goto cleanup;
         }
-        fprintf(stdout, "%lf %lf %lf %lf %lf %lf %lf\n", p->unixTime, p->latitude, p->longitude, p->altitude, p->bCoreN + p->bCrustN, p->bCoreE + p->bCrustE, p->bCoreC + p->bCrustC);
+        for (size_t i = 0; i < nPoints; i++)
+        {
+            p = &data[first + i];
+            p->bCoreN = bCore[0][3*i];
+            p->bCoreE = bCore[0][3*i+1];
+            p->bCoreC = bCore[0][3*i+2];
+            p->bCrustN = bCrust[0][3*i];
+            p->bCrustE = bCrust[0][3*i+1];
+            p->bCrustC = bCrust[0][3*i+2];
+            fprintf(stdout, "%lf %lf %lf %lf %lf %lf %lf", p->unixTime, p->latitude, p->longitude, p->altitude, p->bCoreN + p->bCrustN, p->bCoreE + p->bCrustE, p->bCoreC + p->bCrustC);
+            if (gradient)
+                for (int j = 0; j < 9; j++)
+                    fprintf(stdout, " %lf", p->gradient[j]);
+            if (secularVariation)
+            {
+                for (int j = 0; j < 3; j++)
+                {
+                    p->dBdtCore[j] = dBdtCore[0][3*i+j];
+                    fprintf(stdout, " %lf", p->dBdtCore[j]);
+                }
+            }
+            for (int v = 1; v < nVersions; v++)
+            {
+                for (int j = 0; j < 3; j++)
+                    fprintf(stdout, " %lf", bCore[v][3*i+j] + bCrust[v][3*i+j]);
+                if (secularVariation)
+                    for (int j = 0; j < 3; j++)
+                        fprintf(stdout, " %lf", dBdtCore[v][3*i+j]);
+            }
+            fprintf(stdout, "\n");
+        }
     }
 
+    if (verbose && workspace.truncationToleranceNT > 0.0)
+        printf("Truncation tolerance %g nT: core to degree %d, crust to degree %d\n", workspace.truncationToleranceNT, maximumDegreeUsed(&coeffs[0].core, &workspace), maximumDegreeUsed(&coeffs[0].crust, &workspace));
+
 cleanup:
-	freeChaosCoefficients(&coeffs);
+    freeSiteField(&site);
+	freeModelWorkspace(&workspace);
+    for (int v = 0; v < nVersions; v++)
+        freeChaosCoefficients(&coeffs[v]);
     free(data);
 
 	return 0;
@@ -227,6 +424,14 @@ void usage(const char* name)
     printf("Options:\n");
     printf(" --overwrite (-f): force overwriting existing .out file if it exists.\n");
     printf(" --verbse (-v): write a little more.\n");
+    printf(" --gradient: append dBN/dr, dBN/dtheta, dBN/dphi, dBE/dr, ..., dBC/dphi of the total field (nT/km and nT/radian).\n");
+    printf(" --fixed-site: for many epochs at few positions, as at observatories. Tables for a position are computed once for consecutive rows sharing it, and each row evaluates the core at its own time. Not with --gradient.\n");
+    printf(" --secular-variation: append dBN/dt, dBE/dt, dBC/dt of the core field (nT/year), after any gradient columns.\n");
+    printf(" --additional-model=chaosModelCoefficientsDir: append the total field (and with --secular-variation dBN/dt, dBE/dt, dBC/dt) of the CHAOS version in this directory, evaluated from the same tables. Repeat for up to %d versions in all. Not with --gradient or --fixed-site.\n", SHC_MAX_MODEL_VERSIONS);
+    printf(" --single-precision-crust: sum the crustal field in single precision (-v reports its deviation from double precision on a reference orbit).\n");
+    printf(" --reference-kernel: evaluate the model with the original per-term kernel, for validation.\n");
+    printf(" --truncation-tolerance-nT=value: omit the highest degrees at each radius while their combined field bound is below value nT.\n");
+    printf(" --core-update-interval=seconds: evaluate the core model at the centre of each interval of this length, or at every input time for 0 (default %.0f).\n", CHAOS_CORE_UPDATE_INTERVAL_S);
 	printf(" --about: print version and license information.\n");
     printf(" --help: print this message.\n");
 
@@ -0,0 +1,316 @@
+/*
+
+    CHAOS: chaos_export_bench.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Size and time of writing the variables of a chaos output file with each CDF codec,
+// and the rate at which several export processes write at once
+
+#include "cdf_utils.h"
+#include "cdf_vars.h"
+#include "chaos_settings.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <cdf.h>
+
+char infoHeader[50] = "";
+volatile sig_atomic_t keep_running = 1;
+
+void usage(const char *name);
+
+// The variables of a CDF as read
+typedef struct ExportVariables
+{
+    long nVariables;
+    char (*names)[CDF_VAR_NAME_LEN256 + 1];
+    long *dataTypes;
+    long *dimSizes;
+    long *nRecords;
+    CDFdata *data;
+    size_t bytes;
+} ExportVariables;
+
+static double secondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void freeExportVariables(ExportVariables *variables)
+{
+    for (long i = 0; variables->data != NULL && i < variables->nVariables; i++)
+        if (variables->data[i] != NULL)
+            CDFdataFree(variables->data[i]);
+    free(variables->names);
+    free(variables->dataTypes);
+    free(variables->dimSizes);
+    free(variables->nRecords);
+    free(variables->data);
+    memset(variables, 0, sizeof(ExportVariables));
+
+    return;
+}
+
+// Scalar and vector variables of cdfFile
+static CDFstatus readExportVariables(const char *cdfFile, ExportVariables *variables)
+{
+    CDFid id;
+    CDFsetValidate(VALIDATEFILEoff);
+    CDFstatus status = CDFopenCDF(cdfFile, &id);
+    if (status != CDF_OK)
+    {
+        printErrorMessage(status);
+        return status;
+    }
+    long nVariables = 0;
+    status = CDFgetNumzVars(id, &nVariables);
+    if (status != CDF_OK || nVariables < 1)
+    {
+        closeCdf(id);
+        return status != CDF_OK ? status : NO_SUCH_VAR;
+    }
+    variables->names = calloc(nVariables, sizeof(variables->names[0]));
+    variables->dataTypes = calloc(nVariables, sizeof(long));
+    variables->dimSizes = calloc(nVariables, sizeof(long));
+    variables->nRecords = calloc(nVariables, sizeof(long));
+    variables->data = calloc(nVariables, sizeof(CDFdata));
+    if (variables->names == NULL || variables->dataTypes == NULL || variables->dimSizes == NULL || variables->nRecords == NULL || variables->data == NULL)
+    {
+        freeExportVariables(variables);
+        closeCdf(id);
+        return BAD_MALLOC;
+    }
+
+    long numElems = 0, numDims = 0, recVary = 0, dataTypeSize = 0;
+    long dimSizes[CDF_MAX_DIMS] = {0};
+    long dimVarys[CDF_MAX_DIMS] = {0};
+    for (long v = 0; v < nVariables && status == CDF_OK; v++)
+    {
+        long i = variables->nVariables;
+        status = CDFgetzVarName(id, v, variables->names[i]);
+        if (status == CDF_OK)
+            status = CDFreadzVarAllByVarID(id, v, &variables->nRecords[i], &variables->dataTypes[i], &numElems, &numDims, dimSizes, &recVary, dimVarys, &variables->data[i]);
+        if (status == CDF_OK)
+            status = CDFgetDataTypeSize(variables->dataTypes[i], &dataTypeSize);
+        if (status != CDF_OK)
+            break;
+        if (numDims > 1 || variables->nRecords[i] < 1)
+        {
+            CDFdataFree(variables->data[i]);
+            variables->data[i] = NULL;
+            continue;
+        }
+        variables->dimSizes[i] = numDims == 0 ? 0 : dimSizes[0];
+        variables->bytes += (size_t)variables->nRecords[i] * (numDims == 0 ? 1 : dimSizes[0]) * dataTypeSize;
+        variables->nVariables++;
+    }
+    closeCdf(id);
+    if (status != CDF_OK)
+    {
+        printErrorMessage(status);
+        freeExportVariables(variables);
+    }
+
+    return status;
+}
+
+// The variables into a new file with the current compression
+static CDFstatus writeExportVariables(const char *cdfFile, const ExportVariables *variables)
+{
+    CDFid id;
+    CDFstatus status = CDFcreateCDF((char *)cdfFile, &id);
+    if (status != CDF_OK)
+    {
+        printErrorMessage(status);
+        return status;
+    }
+    for (long i = 0; i < variables->nVariables && status == CDF_OK; i++)
+    {
+        if (variables->dimSizes[i] == 0)
+            status = createVarFrom1DVar(id, variables->names[i], variables->dataTypes[i], 0, variables->nRecords[i] - 1, variables->data[i]);
+        else
+            status = createVarFrom2DVar(id, variables->names[i], variables->dataTypes[i], 0, variables->nRecords[i] - 1, variables->data[i], (uint8_t)variables->dimSizes[i]);
+    }
+    CDFstatus closeStatus = CDFcloseCDF(id);
+
+    return status != CDF_OK ? status : closeStatus;
+}
+
+// Seconds for nProcesses processes to write the variables each to its own file, and the size of one
+static double timeExports(const char *outputDir, const ExportVariables *variables, int nProcesses, off_t *size)
+{
+    char filename[FILENAME_MAX] = {0};
+    struct timespec start;
+    struct stat info;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int failures = 0;
+    if (nProcesses == 1)
+    {
+        snprintf(filename, FILENAME_MAX, "%s/chaos_export_bench_%d_0", outputDir, (int)getpid());
+        failures = writeExportVariables(filename, variables) != CDF_OK;
+    }
+    else
+    {
+        fflush(stdout);
+        for (int p = 0; p < nProcesses; p++)
+        {
+            pid_t pid = fork();
+            if (pid == 0)
+            {
+                snprintf(filename, FILENAME_MAX, "%s/chaos_export_bench_%d_%d", outputDir, (int)getppid(), p);
+                _exit(writeExportVariables(filename, variables) == CDF_OK ? EXIT_SUCCESS : EXIT_FAILURE);
+            }
+            else if (pid < 0)
+                failures++;
+        }
+        int waitStatus = 0;
+        while (wait(&waitStatus) > 0)
+            failures += !WIFEXITED(waitStatus) || WEXITSTATUS(waitStatus) != EXIT_SUCCESS;
+    }
+    double seconds = secondsSince(&start);
+
+    *size = 0;
+    for (int p = 0; p < nProcesses; p++)
+    {
+        snprintf(filename, FILENAME_MAX, "%s/chaos_export_bench_%d_%d.cdf", outputDir, (int)getpid(), p);
+        if (p == 0 && stat(filename, &info) == 0)
+            *size = info.st_size;
+        remove(filename);
+    }
+
+    return failures == 0 ? seconds : -1.0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *outputDir = ".";
+    char *cdfFile = NULL;
+    int nProcesses = 1;
+    long blockingFactors[8] = {CDF_BLOCKING_FACTOR};
+    int nBlockingFactors = 1;
+    const char *codecs[13] = {"none", "rle", "huffman", "ahuffman", "gzip1", "gzip2", "gzip3", "gzip4", "gzip5", "gzip6", "gzip7", "gzip8", "gzip9"};
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--output-dir=", 13) == 0)
+            outputDir = argv[i] + 13;
+        else if (strncmp(argv[i], "--processes=", 12) == 0)
+        {
+            nProcesses = atoi(argv[i] + 12);
+            if (nProcesses < 1)
+            {
+                fprintf(stderr, "Expected a positive number for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strncmp(argv[i], "--blocking-factors=", 19) == 0)
+        {
+            nBlockingFactors = 0;
+            char *next = argv[i] + 19;
+            while (*next != '\0' && nBlockingFactors < 8)
+            {
+                blockingFactors[nBlockingFactors] = strtol(next, &next, 10);
+                if (blockingFactors[nBlockingFactors] < 1 || (*next != ',' && *next != '\0'))
+                {
+                    fprintf(stderr, "Expected positive numbers separated by commas for %s.\n", argv[i]);
+                    exit(EXIT_FAILURE);
+                }
+                nBlockingFactors++;
+                if (*next == ',')
+                    next++;
+            }
+        }
+        else if (strcmp(argv[i], "--help") == 0)
+        {
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else if (strncmp(argv[i], "--", 2) == 0 || cdfFile != NULL)
+        {
+            fprintf(stderr, "Unexpected argument %s.\n", argv[i]);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        else
+            cdfFile = argv[i];
+    }
+    if (cdfFile == NULL || nBlockingFactors == 0)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    ExportVariables variables = {0};
+    if (readExportVariables(cdfFile, &variables) != CDF_OK)
+    {
+        fprintf(stderr, "Could not read the variables of %s.\n", cdfFile);
+        exit(EXIT_FAILURE);
+    }
+    double megabytes = (double)variables.bytes / 1e6;
+    printf("%ld variables (%.1f MB) from %s\n", variables.nVariables, megabytes, cdfFile);
+    printf("%-9s %8s %10s %8s %10s", "codec", "blocking", "size (MB)", "ratio", "time (s)");
+    if (nProcesses > 1)
+        printf(" %14s", "MB/s per proc");
+    printf(" %8s\n", "MB/s");
+
+    CdfCompression compression = {0};
+    off_t size = 0;
+    int status = EXIT_SUCCESS;
+    for (int b = 0; b < nBlockingFactors; b++)
+    {
+        for (int c = 0; c < 13; c++)
+        {
+            parseCdfCompression(codecs[c], &compression);
+            compression.blockingFactor = blockingFactors[b];
+            setCdfCompression(&compression);
+            double seconds = timeExports(outputDir, &variables, nProcesses, &size);
+            if (seconds < 0.0)
+            {
+                fprintf(stderr, "Could not write %s with %s.\n", cdfFile, codecs[c]);
+                status = EXIT_FAILURE;
+                continue;
+            }
+            printf("%-9s %8ld %10.2f %8.2f %10.3f", codecs[c], blockingFactors[b], (double)size / 1e6, (double)size / (double)variables.bytes, seconds);
+            if (nProcesses > 1)
+                printf(" %14.1f", megabytes / seconds);
+            printf(" %8.1f\n", megabytes * nProcesses / seconds);
+            fflush(stdout);
+        }
+    }
+
+    freeExportVariables(&variables);
+
+    return status;
+}
+
+void usage(const char *name)
+{
+    printf("Usage: %s chaosCdfFile [--output-dir=dir] [--blocking-factors=n[,n]...] [--processes=n] [--help]\n", name);
+    printf(" Writes the variables of a chaos output file with each codec --compression takes, reporting the size and time of each.\n");
+    printf(" --output-dir=dir: directory for the files written, which are removed (default .).\n");
+    printf(" --blocking-factors=n[,n]...: up to 8 blocking factors to try each codec with (default %d).\n", CDF_BLOCKING_FACTOR);
+    printf(" --processes=n: write n copies at once in separate processes, as --export-processes does (default 1).\n");
+}
@@ -0,0 +1,233 @@
+/*
+
+    CHAOS: chaos_input_bench.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Throughput of loadCdf on a MAG file, against the way it used to read one: all of
+// Timestamp read and scanned for the time range, then each variable copied out of
+// a buffer allocated by the CDF library
+
+#include "cdf_utils.h"
+#include "model.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <cdf.h>
+
+char infoHeader[50] = "";
+volatile sig_atomic_t keep_running = 1;
+
+void usage(const char *name);
+
+static double secondsSince(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) + (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// Seconds into the day of hhmmss[.fractionalSecond]
+static int parseTime(const char *string, double *seconds)
+{
+    int hours = 0;
+    int minutes = 0;
+    double secs = 0.0;
+    if (strlen(string) < 6 || sscanf(string, "%2d%2d%lf", &hours, &minutes, &secs) != 3)
+        return -1;
+    *seconds = hours * 3600.0 + minutes * 60.0 + secs;
+
+    return 0;
+}
+
+// loadCdf before records were looked up by binary search and read in place
+static void loadCdfByScan(const char *cdfFile, double firstTime, double lastTime, MagColumns *columns)
+{
+    char *variables[5] = {"Timestamp", "Latitude", "Longitude", "Radius", "B_NEC"};
+    size_t widths[5] = {1, 1, 1, 1, 3};
+    long numRecs = 0, dataType = 0, numElems = 0, numDims = 0, recVary = 0;
+    long dimSizes[CDF_MAX_DIMS] = {0};
+    long dimVarys[CDF_MAX_DIMS] = {0};
+    CDFdata data = NULL;
+    CDFid cdfId;
+
+    if (openMagCdf(cdfFile, &cdfId) != CDF_OK)
+        return;
+
+    CDFstatus status = CDFreadzVarAllByVarID(cdfId, CDFgetVarNum(cdfId, variables[0]), &numRecs, &dataType, &numElems, &numDims, dimSizes, &recVary, dimVarys, &data);
+    if (status != CDF_OK || numRecs == 0)
+    {
+        printErrorMessage(status);
+        if (data != NULL)
+            CDFdataFree(data);
+        closeCdf(cdfId);
+        return;
+    }
+    long firstRec = 0;
+    while (firstRec < numRecs && ((double *)data)[firstRec++] < firstTime);
+    long lastRec = firstRec;
+    while (lastRec < numRecs && ((double *)data)[lastRec++] <= lastTime);
+    if (lastRec == numRecs)
+        lastRec = numRecs - 1;
+    CDFdataFree(data);
+    if (firstRec == numRecs || initMagColumns(columns, (size_t)(lastRec - firstRec + 1)) != CHAOS_MODEL_OK)
+    {
+        closeCdf(cdfId);
+        return;
+    }
+
+    size_t nRecords = (size_t)(lastRec - firstRec + 1);
+    double *destinations[5] = {columns->times, columns->latitudes, columns->longitudes, columns->radii, columns->bNEC};
+    for (int i = 0; i < 5; i++)
+    {
+        status = CDFreadzVarRangeDataByVarID(cdfId, CDFgetVarNum(cdfId, variables[i]), firstRec, lastRec, &data);
+        if (status != CDF_OK)
+        {
+            printErrorMessage(status);
+            closeCdf(cdfId);
+            return;
+        }
+        memcpy(destinations[i], data, widths[i] * nRecords * sizeof(double));
+        CDFdataFree(data);
+    }
+    columns->nRecords = nRecords;
+
+    closeCdf(cdfId);
+}
+
+static bool sameColumns(const MagColumns *a, const MagColumns *b)
+{
+    size_t n = a->nRecords;
+    return n == b->nRecords && memcmp(a->times, b->times, n * sizeof(double)) == 0 && memcmp(a->latitudes, b->latitudes, n * sizeof(double)) == 0 && memcmp(a->longitudes, b->longitudes, n * sizeof(double)) == 0 && memcmp(a->radii, b->radii, n * sizeof(double)) == 0 && memcmp(a->bNEC, b->bNEC, 3 * n * sizeof(double)) == 0;
+}
+
+int main(int argc, char **argv)
+{
+    double firstSecond = 0.0;
+    double lastSecond = 86400.0;
+    long repeats = 5;
+    char *cdfFile = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--first-time=", 13) == 0)
+        {
+            if (parseTime(argv[i] + 13, &firstSecond) != 0)
+            {
+                fprintf(stderr, "Expected a valid time format for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strncmp(argv[i], "--last-time=", 12) == 0)
+        {
+            if (parseTime(argv[i] + 12, &lastSecond) != 0)
+            {
+                fprintf(stderr, "Expected a valid time format for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strncmp(argv[i], "--repeats=", 10) == 0)
+        {
+            repeats = atol(argv[i] + 10);
+            if (repeats < 1)
+            {
+                fprintf(stderr, "Expected a positive number for %s.\n", argv[i]);
+                exit(EXIT_FAILURE);
+            }
+        }
+        else if (strcmp(argv[i], "--help") == 0)
+        {
+            usage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else if (strncmp(argv[i], "--", 2) == 0 || cdfFile != NULL)
+        {
+            fprintf(stderr, "Unexpected argument %s.\n", argv[i]);
+            usage(argv[0]);
+            exit(EXIT_FAILURE);
+        }
+        else
+            cdfFile = argv[i];
+    }
+    if (cdfFile == NULL)
+    {
+        usage(argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    // Times are relative to the start of the day of the first record
+    CDFid cdfId;
+    double t0 = 0.0;
+    if (openMagCdf(cdfFile, &cdfId) != CDF_OK)
+        exit(EXIT_FAILURE);
+    CDFstatus status = CDFgetzVarRecordData(cdfId, CDFgetVarNum(cdfId, "Timestamp"), 0, &t0);
+    closeCdf(cdfId);
+    if (status != CDF_OK)
+    {
+        printErrorMessage(status);
+        exit(EXIT_FAILURE);
+    }
+    double dayStart = floor(t0 / 86400000.0) * 86400000.0;
+    double firstTime = dayStart + firstSecond * 1000.0;
+    double lastTime = dayStart + lastSecond * 1000.0;
+
+    // Alternate the two so that both see the same state of the page cache, after a read of each
+    MagColumns scanned = {0};
+    MagColumns sought = {0};
+    double scanSeconds = 0.0;
+    double seekSeconds = 0.0;
+    struct timespec start;
+    bool same = true;
+    for (long r = -1; r < repeats; r++)
+    {
+        freeMagColumns(&scanned);
+        freeMagColumns(&sought);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        loadCdfByScan(cdfFile, firstTime, lastTime, &scanned);
+        if (r >= 0)
+            scanSeconds += secondsSince(&start);
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        loadCdf(cdfFile, firstTime, lastTime, &sought);
+        if (r >= 0)
+            seekSeconds += secondsSince(&start);
+        same = same && sameColumns(&scanned, &sought);
+    }
+
+    double megabytes = (double)sought.nRecords * 7.0 * sizeof(double) / 1e6;
+    printf("%zu records (%.1f MB) from %s, %ld repeats\n", sought.nRecords, megabytes, cdfFile, repeats);
+    printf("  scan and copy: %8.2f ms per load, %8.1f MB/s\n", 1000.0 * scanSeconds / repeats, megabytes * repeats / scanSeconds);
+    printf("  seek in place: %8.2f ms per load, %8.1f MB/s\n", 1000.0 * seekSeconds / repeats, megabytes * repeats / seekSeconds);
+    printf("  records %s\n", same ? "identical" : "DIFFER");
+
+    freeMagColumns(&scanned);
+    freeMagColumns(&sought);
+
+    return same ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+void usage(const char *name)
+{
+    printf("Usage: %s magCdfFile [--first-time=hhmmss[.fractionalSecond]] [--last-time=hhmmss[.fractionalSecond]] [--repeats=n] [--help]\n", name);
+    printf(" Times loading the time range of a MAG CDF as loadCdf does, and by reading and scanning all timestamps then copying each variable, as it used to.\n");
+    printf(" --first-time=hhmmss[.fractionalSecond]: load from this time on the day of the file's first record.\n");
+    printf(" --last-time=hhmmss[.fractionalSecond]: load through to this time.\n");
+    printf(" --repeats=n: loads timed by each method, after one untimed (default 5).\n");
+}
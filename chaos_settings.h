@@ -34,4 +34,11 @@
 
 #define CDF_BLOCKING_FACTOR 43200
 
+// Days a batch exports at once in child processes for --export-processes
+#define CHAOS_DEFAULT_EXPORT_PROCESSES 2
+#define CHAOS_MAX_EXPORT_PROCESSES 16
+
+// Default seconds between core coefficient epochs for --core-update-interval
+#define CHAOS_CORE_UPDATE_INTERVAL_S 60.0
+
 #endif //CHAOS_SETTINGS_H
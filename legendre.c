@@ -0,0 +1,218 @@
+/*
+
+    CHAOS: legendre.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "legendre.h"
+
+#include <stdlib.h>
+#include <math.h>
+
+int initLegendreTables(LegendreTables *tables, int maxN)
+{
+    size_t nTerms = LEGENDRE_TERMS(maxN);
+
+    tables->maximumN = maxN;
+    tables->recurrenceA = (double *)calloc(nTerms, sizeof(double));
+    tables->recurrenceB = (double *)calloc(nTerms, sizeof(double));
+    tables->diagonal = (double *)calloc(maxN + 1, sizeof(double));
+    tables->recurrenceASingle = (float *)calloc(nTerms, sizeof(float));
+    tables->recurrenceBSingle = (float *)calloc(nTerms, sizeof(float));
+    tables->diagonalSingle = (float *)calloc(maxN + 1, sizeof(float));
+    if (tables->recurrenceA == NULL || tables->recurrenceB == NULL || tables->diagonal == NULL || tables->recurrenceASingle == NULL || tables->recurrenceBSingle == NULL || tables->diagonalSingle == NULL)
+    {
+        freeLegendreTables(tables);
+        return LEGENDRE_MEMORY;
+    }
+
+    double nd = 0.0;
+    double md = 0.0;
+    for (int n = 1; n <= maxN; n++)
+    {
+        nd = (double)n;
+        for (int m = 0; m < n; m++)
+        {
+            md = (double)m;
+            tables->recurrenceA[LEGENDRE_INDEX(n, m)] = (2.0 * nd - 1.0) / sqrt((nd - md) * (nd + md));
+            tables->recurrenceB[LEGENDRE_INDEX(n, m)] = sqrt((nd + md - 1.0) * (nd - md - 1.0) / ((nd - md) * (nd + md)));
+        }
+        // Schmidt normalization makes P_1^1 = sin(theta)
+        tables->diagonal[n] = n == 1 ? 1.0 : sqrt((2.0 * nd - 1.0) / (2.0 * nd));
+    }
+
+    for (size_t k = 0; k < nTerms; k++)
+    {
+        tables->recurrenceASingle[k] = (float)tables->recurrenceA[k];
+        tables->recurrenceBSingle[k] = (float)tables->recurrenceB[k];
+    }
+    for (int n = 0; n <= maxN; n++)
+        tables->diagonalSingle[n] = (float)tables->diagonal[n];
+
+    return LEGENDRE_OK;
+}
+
+void freeLegendreTables(LegendreTables *tables)
+{
+    if (tables->recurrenceA != NULL)
+        free(tables->recurrenceA);
+    if (tables->recurrenceB != NULL)
+        free(tables->recurrenceB);
+    if (tables->diagonal != NULL)
+        free(tables->diagonal);
+    if (tables->recurrenceASingle != NULL)
+        free(tables->recurrenceASingle);
+    if (tables->recurrenceBSingle != NULL)
+        free(tables->recurrenceBSingle);
+    if (tables->diagonalSingle != NULL)
+        free(tables->diagonalSingle);
+
+    tables->recurrenceA = NULL;
+    tables->recurrenceB = NULL;
+    tables->diagonal = NULL;
+    tables->recurrenceASingle = NULL;
+    tables->recurrenceBSingle = NULL;
+    tables->diagonalSingle = NULL;
+
+    return;
+}
+
+void schmidtLegendre(const LegendreTables *tables, int maxN, double cosTheta, double sinTheta, double *polynomials, double *derivatives)
+{
+    const double *recurrenceA = tables->recurrenceA;
+    const double *recurrenceB = tables->recurrenceB;
+    double u = cosTheta;
+    double s = sinTheta;
+    double s2 = s * s;
+
+    double *p = polynomials;
+    double *dp = derivatives;
+    const double *p1 = NULL;
+    const double *dp1 = NULL;
+    const double *p2 = NULL;
+    const double *dp2 = NULL;
+    size_t k = 0;
+
+    p[0] = 1.0;
+    dp[0] = 0.0;
+
+    for (int n = 1; n <= maxN; n++)
+    {
+        k = LEGENDRE_INDEX(n, 0);
+        p1 = polynomials + LEGENDRE_INDEX(n - 1, 0);
+        dp1 = derivatives + LEGENDRE_INDEX(n - 1, 0);
+        p2 = n >= 2 ? polynomials + LEGENDRE_INDEX(n - 2, 0) : NULL;
+        dp2 = n >= 2 ? derivatives + LEGENDRE_INDEX(n - 2, 0) : NULL;
+
+        // Zonal term: unscaled
+        if (n == 1)
+        {
+            p[k] = u;
+            dp[k] = -s;
+        }
+        else
+        {
+            p[k] = recurrenceA[k] * u * p1[0] - recurrenceB[k] * p2[0];
+            dp[k] = recurrenceA[k] * (u * dp1[0] - s * p1[0]) - recurrenceB[k] * dp2[0];
+        }
+
+        // Tesseral terms are stored divided by sin(theta); d(P)/dtheta needs
+        // the unscaled P_n-1^m, which is s times the stored value
+        for (int m = 1; m <= n - 2; m++)
+        {
+            p[k + m] = recurrenceA[k + m] * u * p1[m] - recurrenceB[k + m] * p2[m];
+            dp[k + m] = recurrenceA[k + m] * (u * dp1[m] - s2 * p1[m]) - recurrenceB[k + m] * dp2[m];
+        }
+        if (n >= 2)
+        {
+            p[k + n - 1] = recurrenceA[k + n - 1] * u * p1[n - 1];
+            dp[k + n - 1] = recurrenceA[k + n - 1] * (u * dp1[n - 1] - s2 * p1[n - 1]);
+        }
+
+        // Sectoral term P_n^n / sin(theta) = diagonal * P_n-1^n-1
+        if (n == 1)
+        {
+            p[k + 1] = 1.0;
+            dp[k + 1] = u;
+        }
+        else
+        {
+            p[k + n] = tables->diagonal[n] * s * p1[n - 1];
+            dp[k + n] = tables->diagonal[n] * s * (u * p1[n - 1] + dp1[n - 1]);
+        }
+    }
+
+    return;
+}
+
+void schmidtLegendreSecondDerivatives(const LegendreTables *tables, int maxN, double cosTheta, double sinTheta, const double *polynomials, const double *derivatives, double *secondDerivatives, double *scaledDerivatives)
+{
+    const double *recurrenceA = tables->recurrenceA;
+    const double *recurrenceB = tables->recurrenceB;
+    double u = cosTheta;
+    double s = sinTheta;
+    double s2 = s * s;
+
+    const double *p1 = NULL;
+    const double *dp1 = NULL;
+    double *d2p = secondDerivatives;
+    double *ep = scaledDerivatives;
+    const double *d2p1 = NULL;
+    const double *d2p2 = NULL;
+    const double *ep1 = NULL;
+    const double *ep2 = NULL;
+    size_t k = 0;
+
+    d2p[0] = 0.0;
+    ep[0] = 0.0;
+    if (maxN < 1)
+        return;
+    d2p[1] = -u;
+    ep[1] = -s;
+    d2p[2] = -s;
+    ep[2] = 0.0;
+
+    for (int n = 2; n <= maxN; n++)
+    {
+        k = LEGENDRE_INDEX(n, 0);
+        p1 = polynomials + LEGENDRE_INDEX(n - 1, 0);
+        dp1 = derivatives + LEGENDRE_INDEX(n - 1, 0);
+        d2p1 = secondDerivatives + LEGENDRE_INDEX(n - 1, 0);
+        d2p2 = secondDerivatives + LEGENDRE_INDEX(n - 2, 0);
+        ep1 = scaledDerivatives + LEGENDRE_INDEX(n - 1, 0);
+        ep2 = scaledDerivatives + LEGENDRE_INDEX(n - 2, 0);
+
+        // Zonal term: unscaled, so its stored derivative is the ordinary one
+        d2p[k] = recurrenceA[k] * (u * d2p1[0] - 2.0 * s * dp1[0] - u * p1[0]) - recurrenceB[k] * d2p2[0];
+        ep[k] = derivatives[k];
+
+        // Tesseral terms: the unscaled P_n-1^m is s times the stored value
+        for (int m = 1; m <= n - 2; m++)
+        {
+            d2p[k + m] = recurrenceA[k + m] * (u * d2p1[m] - 2.0 * s * dp1[m] - u * s * p1[m]) - recurrenceB[k + m] * d2p2[m];
+            ep[k + m] = recurrenceA[k + m] * (u * ep1[m] - s * p1[m]) - recurrenceB[k + m] * ep2[m];
+        }
+        d2p[k + n - 1] = recurrenceA[k + n - 1] * (u * d2p1[n - 1] - 2.0 * s * dp1[n - 1] - u * s * p1[n - 1]);
+        ep[k + n - 1] = recurrenceA[k + n - 1] * (u * ep1[n - 1] - s * p1[n - 1]);
+
+        // Sectoral term from P_n^n = diagonal * sin(theta) * P_n-1^n-1
+        d2p[k + n] = tables->diagonal[n] * (2.0 * u * dp1[n - 1] + s * d2p1[n - 1] - s2 * p1[n - 1]);
+        ep[k + n] = tables->diagonal[n] * (u * p1[n - 1] + s * ep1[n - 1]);
+    }
+
+    return;
+}
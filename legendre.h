@@ -0,0 +1,66 @@
+/*
+
+    CHAOS: legendre.h
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CHAOS_LEGENDRE_H
+#define _CHAOS_LEGENDRE_H
+
+#include <stddef.h>
+
+// Position of (n, m) in Legendre arrays: degree-major, same as GSL
+#define LEGENDRE_INDEX(n, m) ((size_t)(n) * ((size_t)(n) + 1) / 2 + (size_t)(m))
+// Number of (n, m) terms from (0, 0) through (maxN, maxN)
+#define LEGENDRE_TERMS(maxN) (((size_t)(maxN) + 1) * ((size_t)(maxN) + 2) / 2)
+
+enum LEGENDRE_STATUS
+{
+    LEGENDRE_OK = 0,
+    LEGENDRE_MEMORY
+};
+
+// Recurrence factors for Schmidt semi-normalized associated Legendre functions
+// without the Condon-Shortley phase. Depend only on the maximum degree.
+typedef struct LegendreTables
+{
+    int maximumN;
+    // P_n^m = recurrenceA * cos(theta) * P_n-1^m - recurrenceB * P_n-2^m, indexed by LEGENDRE_INDEX(n, m)
+    double *recurrenceA;
+    double *recurrenceB;
+    // P_m^m = diagonal[m] * sin(theta) * P_m-1^m-1, indexed by m
+    double *diagonal;
+    // The same factors rounded to float, for the single-precision batched kernels
+    float *recurrenceASingle;
+    float *recurrenceBSingle;
+    float *diagonalSingle;
+} LegendreTables;
+
+int initLegendreTables(LegendreTables *tables, int maxN);
+void freeLegendreTables(LegendreTables *tables);
+
+// Fills polynomials and derivatives (d/dtheta) for all degrees up to maxN, which
+// may not exceed tables->maximumN, at LEGENDRE_INDEX(n, m). For m > 0 the polynomials are divided by sin(theta),
+// which the recurrence produces directly, so no term is singular at the poles.
+// Derivatives are not scaled.
+void schmidtLegendre(const LegendreTables *tables, int maxN, double cosTheta, double sinTheta, double *polynomials, double *derivatives);
+
+// From the output of schmidtLegendre, fills d^2 P_n^m / d theta^2 and the theta derivative
+// of the stored polynomials (of P_n^m / sin(theta) for m > 0). Both are finite at the poles.
+void schmidtLegendreSecondDerivatives(const LegendreTables *tables, int maxN, double cosTheta, double sinTheta, const double *polynomials, const double *derivatives, double *secondDerivatives, double *scaledDerivatives);
+
+#endif // _CHAOS_LEGENDRE_H
@@ -20,12 +20,16 @@
 
 #include "model.h"
 #include "shc.h"
+#include "legendre.h"
 #include "util.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <signal.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 
 #include <gsl/gsl_errno.h>
 #include <gsl/gsl_sf_legendre.h>
@@ -34,8 +38,615 @@
 extern sig_atomic_t keep_running;
 extern char infoHeader[50];
 
-int calculateField(double r, double theta, double phi, SHCCoefficients *coeffs, double *bn, double *be, double *bc)
+static int fieldKernel = CHAOS_FIELD_KERNEL_RECURRENCE;
+
+void setFieldKernel(int kernel)
+{
+    fieldKernel = kernel;
+}
+
+int getFieldKernel(void)
+{
+    return fieldKernel;
+}
+
+int initModelWorkspace(ModelWorkspace *workspace, const ChaosCoefficients *coeffs)
+{
+    return initModelWorkspaceForVersions(workspace, coeffs, 1);
+}
+
+int initModelWorkspaceForVersions(ModelWorkspace *workspace, const ChaosCoefficients *coeffs, int nVersions)
+{
+    int maxN = 0;
+    for (int v = 0; v < nVersions; v++)
+    {
+        if (coeffs[v].core.maximumN > maxN)
+            maxN = coeffs[v].core.maximumN;
+        if (coeffs[v].coreExtrapolation.maximumN > maxN)
+            maxN = coeffs[v].coreExtrapolation.maximumN;
+        if (coeffs[v].crust.maximumN > maxN)
+            maxN = coeffs[v].crust.maximumN;
+    }
+
+    return initModelWorkspaceForDegree(workspace, maxN);
+}
+
+int initModelWorkspaceForDegree(ModelWorkspace *workspace, int maximumN)
+{
+    if (workspace == NULL || maximumN < 1)
+        return CHAOS_MODEL_COEFFICIENTS;
+
+    size_t nTerms = LEGENDRE_TERMS(maximumN);
+
+    bzero(workspace, sizeof(ModelWorkspace));
+    workspace->maximumN = maximumN;
+    workspace->minimumRadiusKm = HUGE_VAL;
+    workspace->aoverrpowers = malloc(sizeof(double) * (size_t)maximumN);
+    workspace->polynomials = malloc(sizeof(double) * nTerms);
+    workspace->derivatives = malloc(sizeof(double) * nTerms);
+    workspace->secondDerivatives = malloc(sizeof(double) * nTerms);
+    workspace->scaledDerivatives = malloc(sizeof(double) * nTerms);
+    workspace->cosmphi = malloc(sizeof(double) * (size_t)(maximumN + 1));
+    workspace->sinmphi = malloc(sizeof(double) * (size_t)(maximumN + 1));
+    // Room for (a/r)^(n+2) at the widest vector size, 64-byte aligned
+    void *scratch = NULL;
+    if (posix_memalign(&scratch, 64, (size_t)(maximumN + 1) * 8 * sizeof(double)) == 0)
+        workspace->batchScratch = scratch;
+
+    if (workspace->aoverrpowers == NULL || workspace->polynomials == NULL || workspace->derivatives == NULL || workspace->secondDerivatives == NULL || workspace->scaledDerivatives == NULL || workspace->cosmphi == NULL || workspace->sinmphi == NULL || workspace->batchScratch == NULL)
+    {
+        freeModelWorkspace(workspace);
+        return CHAOS_MODEL_MEMORY;
+    }
+    workspace->coreUpdateIntervalSeconds = CHAOS_CORE_UPDATE_NEVER;
+
+    // Resolve the batched kernel now rather than on first use from several threads
+    (void)batchKernelDescription();
+
+    return CHAOS_MODEL_OK;
+}
+
+void freeModelWorkspace(ModelWorkspace *workspace)
+{
+    if (workspace == NULL)
+        return;
+
+    free(workspace->aoverrpowers);
+    free(workspace->polynomials);
+    free(workspace->derivatives);
+    free(workspace->secondDerivatives);
+    free(workspace->scaledDerivatives);
+    free(workspace->cosmphi);
+    free(workspace->sinmphi);
+    free(workspace->batchScratch);
+    bzero(workspace, sizeof(ModelWorkspace));
+
+    return;
+}
+
+int truncationDegree(const SHCCoefficients *coeffs, double r, double toleranceNT)
+{
+    if (toleranceNT <= 0.0 || coeffs->degreeFieldBound == NULL)
+        return coeffs->maximumN;
+
+    double aoverr = EARTH_RADIUS_KM / r;
+    double roverA = r / EARTH_RADIUS_KM;
+    double aoverrpower = pow(aoverr, coeffs->maximumN + 2);
+    double tail = 0.0;
+    int n = coeffs->maximumN;
+
+    // Whole set negligible, as when tracing far from the Earth
+    if (aoverr <= 1.0 && pow(aoverr, coeffs->minimumN + 2) * coeffs->totalFieldBound <= toleranceNT)
+        return coeffs->minimumN - 1;
+
+    // Drop degrees from the top while their summed bounds stay within tolerance
+    for (; n >= coeffs->minimumN; n--)
+    {
+        tail += aoverrpower * coeffs->degreeFieldBound[n];
+        if (tail > toleranceNT)
+            break;
+        aoverrpower *= roverA;
+    }
+
+    return n;
+}
+
+int maximumDegreeUsed(const SHCCoefficients *coeffs, const ModelWorkspace *workspace)
+{
+    return truncationDegree(coeffs, workspace->minimumRadiusKm, workspace->truncationToleranceNT);
+}
+
+// Fills the azimuthal and Legendre tables shared by all coefficient sets up to degree maxN
+static void calculateAngularBasis(double theta, double phi, const LegendreTables *legendre, int maxN, ModelWorkspace *workspace)
+{
+    double *cosmphi = workspace->cosmphi;
+    double *sinmphi = workspace->sinmphi;
+
+    // cos(m phi) and sin(m phi) by angle addition, two libm calls per point
+    double cosphi = cos(phi);
+    double sinphi = sin(phi);
+    cosmphi[0] = 1.0;
+    sinmphi[0] = 0.0;
+    for (int m = 1; m <= maxN; m++)
+    {
+        cosmphi[m] = cosmphi[m-1] * cosphi - sinmphi[m-1] * sinphi;
+        sinmphi[m] = sinmphi[m-1] * cosphi + cosmphi[m-1] * sinphi;
+    }
+
+    // Derivatives are d P_l^m(cos(theta)) / d theta 
+    // Polynomials with m > 0 are divided by sin(theta)
+    schmidtLegendre(legendre, maxN, cos(theta), sin(theta), workspace->polynomials, workspace->derivatives);
+
+    return;
+}
+
+// Fills the radial, azimuthal and Legendre tables shared by all coefficient sets
+// up to degree maxN
+static void calculateBasis(double r, double theta, double phi, const LegendreTables *legendre, int maxN, ModelWorkspace *workspace)
+{
+	double a = EARTH_RADIUS_KM;
+	double aoverr = a/r;
+    double *aoverrpowers = workspace->aoverrpowers;
+
+	aoverrpowers[0] = aoverr * aoverr * aoverr; // For potential derivatives, (a/r)^n+2, n starting at 1
+	for (int n = 1; n < maxN; n++)
+	{
+		aoverrpowers[n] = aoverrpowers[n-1] * aoverr;
+	}
+
+    calculateAngularBasis(theta, phi, legendre, maxN, workspace);
+
+    return;
+}
+
+// Sums the packed g,h pairs of degrees minN through maxN against tables from calculateBasis
+static void sumField(const double *gh, int minN, int maxN, double sinTheta, const double *aoverrpowers, const ModelWorkspace *workspace, double *bn, double *be, double *bc)
+{
+    const double *polynomials = workspace->polynomials;
+    const double *derivatives = workspace->derivatives;
+    const double *cosmphi = workspace->cosmphi;
+    const double *sinmphi = workspace->sinmphi;
+
+	double magneticDerivRN = 0.0;
+	double magneticDerivRNm = 0.0;
+	double magneticDerivThetaN = 0.0;
+	double magneticDerivPhiN = 0.0;
+	double br = 0.0;
+	double btheta = 0.0;
+	double bphi = 0.0;
+
+    double gTerm = 0.0;
+    double hTerm = 0.0;
+
+    // Legendre arrays store (n, m) contiguously in the same order as ghNow
+    size_t lInd = LEGENDRE_INDEX(minN, 0);
+
+	for (int n = minN; n <= maxN; n++)
+	{
+		magneticDerivRN = gh[0] * polynomials[lInd];
+		magneticDerivThetaN = gh[0] * derivatives[lInd];
+		magneticDerivRNm = 0.0;
+		magneticDerivPhiN = 0.0;
+        gh += 2;
+        lInd++;
+        // polynomials[] holds P_n^m / sin(theta) for m > 0, which is what the
+        // phi derivative needs; the radial sum is rescaled once per degree
+		for (int m = 1; m <= n; m++)
+		{
+            gTerm = gh[0] * cosmphi[m] + gh[1] * sinmphi[m];
+            hTerm = (double)m * (gh[1] * cosmphi[m] - gh[0] * sinmphi[m]);
+			magneticDerivRNm += gTerm * polynomials[lInd];
+			magneticDerivThetaN += gTerm * derivatives[lInd];
+			magneticDerivPhiN += hTerm * polynomials[lInd];
+            gh += 2;
+            lInd++;
+		}
+		magneticDerivRN += sinTheta * magneticDerivRNm;
+		magneticDerivRN *= aoverrpowers[n-1] * (-((double)n+1.0));
+		magneticDerivThetaN *= aoverrpowers[n-1];
+		magneticDerivPhiN *= aoverrpowers[n-1];
+
+		br += -magneticDerivRN;
+		btheta += -magneticDerivThetaN;
+		bphi += -magneticDerivPhiN;
+	}
+
+	*bn = -btheta;
+	*be = bphi;
+	*bc = -br;
+
+    return;
+}
+
+// Degree ranges of the CHAOS-7 core and static field releases, which get kernels
+// with compile-time bounds. Other ranges use the runtime-sized kernels.
+#define CHAOS_CORE_MINIMUM_N 1
+#define CHAOS_CORE_MAXIMUM_N 20
+#define CHAOS_CRUST_MINIMUM_N 21
+#define CHAOS_CRUST_MAXIMUM_N 185
+
+#define FIXED_KERNEL_MIN_N CHAOS_CORE_MINIMUM_N
+#define FIXED_KERNEL_MAX_N CHAOS_CORE_MAXIMUM_N
+#define FIXED_KERNEL_SUM_NAME sumFieldCore
+#define FIXED_KERNEL_FIELD_NAME calculateFieldCore
+#define FIXED_KERNEL_UNROLL _Pragma("GCC unroll 24")
+#include "model_fixed_kernel.h"
+#undef FIXED_KERNEL_MIN_N
+#undef FIXED_KERNEL_MAX_N
+#undef FIXED_KERNEL_SUM_NAME
+#undef FIXED_KERNEL_FIELD_NAME
+#undef FIXED_KERNEL_UNROLL
+
+#define FIXED_KERNEL_MIN_N CHAOS_CRUST_MINIMUM_N
+#define FIXED_KERNEL_MAX_N CHAOS_CRUST_MAXIMUM_N
+#define FIXED_KERNEL_SUM_NAME sumFieldCrust
+#define FIXED_KERNEL_UNROLL
+#include "model_fixed_kernel.h"
+#undef FIXED_KERNEL_MIN_N
+#undef FIXED_KERNEL_MAX_N
+#undef FIXED_KERNEL_SUM_NAME
+#undef FIXED_KERNEL_UNROLL
+
+static bool isFixedCore(const SHCCoefficients *coeffs, int maxN)
+{
+    return coeffs->minimumN == CHAOS_CORE_MINIMUM_N && coeffs->maximumN == CHAOS_CORE_MAXIMUM_N && maxN == CHAOS_CORE_MAXIMUM_N;
+}
+
+static bool isFixedCrust(const SHCCoefficients *coeffs, int maxN)
+{
+    return coeffs->minimumN == CHAOS_CRUST_MINIMUM_N && coeffs->maximumN == CHAOS_CRUST_MAXIMUM_N && maxN == CHAOS_CRUST_MAXIMUM_N;
+}
+
+int calculateField(double r, double theta, double phi, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bn, double *be, double *bc)
+{
+    if (workspace == NULL || workspace->maximumN < coeffs->maximumN)
+        return CHAOS_MODEL_MEMORY;
+
+    if (fieldKernel == CHAOS_FIELD_KERNEL_REFERENCE)
+        return calculateFieldReference(r, theta, phi, coeffs, workspace, bn, be, bc);
+
+    if (r < workspace->minimumRadiusKm)
+        workspace->minimumRadiusKm = r;
+    int maxN = truncationDegree(coeffs, r, workspace->truncationToleranceNT);
+
+    if (isFixedCore(coeffs, maxN))
+    {
+        calculateFieldCore(r, theta, phi, coeffs, bn, be, bc);
+        return CHAOS_MODEL_OK;
+    }
+
+    calculateBasis(r, theta, phi, &coeffs->legendre, maxN, workspace);
+
+    if (isFixedCrust(coeffs, maxN))
+        sumFieldCrust(coeffs->ghNow, sin(theta), workspace->aoverrpowers, workspace->polynomials, workspace->derivatives, workspace->cosmphi, workspace->sinmphi, bn, be, bc);
+    else
+        sumField(coeffs->ghNow, coeffs->minimumN, maxN, sin(theta), workspace->aoverrpowers, workspace, bn, be, bc);
+
+	return CHAOS_MODEL_OK;
+
+}
+
+int calculateChaosField(double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust)
+{
+    int status = CHAOS_MODEL_OK;
+
+    if (workspace == NULL || workspace->maximumN < coeffs->core.maximumN || workspace->maximumN < coeffs->crust.maximumN)
+        return CHAOS_MODEL_MEMORY;
+
+    if (fieldKernel == CHAOS_FIELD_KERNEL_REFERENCE)
+    {
+        status = calculateFieldReference(r, theta, phi, &coeffs->core, workspace, bCore, bCore+1, bCore+2);
+        if (status != CHAOS_MODEL_OK)
+            return status;
+        return calculateFieldReference(r, theta, phi, &coeffs->crust, workspace, bCrust, bCrust+1, bCrust+2);
+    }
+
+    if (r < workspace->minimumRadiusKm)
+        workspace->minimumRadiusKm = r;
+    int coreN = truncationDegree(&coeffs->core, r, workspace->truncationToleranceNT);
+    int crustN = truncationDegree(&coeffs->crust, r, workspace->truncationToleranceNT);
+
+    // Crust truncated away entirely, as when tracing well above the surface
+    if (crustN < coeffs->crust.minimumN && isFixedCore(&coeffs->core, coreN))
+    {
+        calculateFieldCore(r, theta, phi, &coeffs->core, bCore, bCore+1, bCore+2);
+        bCrust[0] = bCrust[1] = bCrust[2] = 0.0;
+        return CHAOS_MODEL_OK;
+    }
+
+    // One set of tables to the highest degree needed, from whichever set goes deepest
+    const LegendreTables *legendre = coeffs->crust.maximumN >= coeffs->core.maximumN ? &coeffs->crust.legendre : &coeffs->core.legendre;
+    calculateBasis(r, theta, phi, legendre, crustN > coreN ? crustN : coreN, workspace);
+
+    double sinTheta = sin(theta);
+    if (isFixedCore(&coeffs->core, coreN))
+        sumFieldCore(coeffs->core.ghNow, sinTheta, workspace->aoverrpowers, workspace->polynomials, workspace->derivatives, workspace->cosmphi, workspace->sinmphi, bCore, bCore+1, bCore+2);
+    else
+        sumField(coeffs->core.ghNow, coeffs->core.minimumN, coreN, sinTheta, workspace->aoverrpowers, workspace, bCore, bCore+1, bCore+2);
+    if (isFixedCrust(&coeffs->crust, crustN))
+        sumFieldCrust(coeffs->crust.ghNow, sinTheta, workspace->aoverrpowers, workspace->polynomials, workspace->derivatives, workspace->cosmphi, workspace->sinmphi, bCrust, bCrust+1, bCrust+2);
+    else
+        sumField(coeffs->crust.ghNow, coeffs->crust.minimumN, crustN, sinTheta, workspace->aoverrpowers, workspace, bCrust, bCrust+1, bCrust+2);
+
+    return CHAOS_MODEL_OK;
+}
+
+// Sums one coefficient set and its partial derivatives through degree maxN against
+// tables from calculateBasis and schmidtLegendreSecondDerivatives. With p = (a/r)^(n+2),
+// w = g cos(m phi) + h sin(m phi) and v = dw/dphi, degree n contributes
+//   B_N = p sum w dP,   B_E = -p sum v P/sin,   B_C = -(n+1) p sum w P
+// and each r derivative brings a factor -(n+2)/r.
+static void sumFieldGradient(const SHCCoefficients *coeffs, int maxN, double r, double sinTheta, const ModelWorkspace *workspace, double *b, double *gradient)
+{
+    const double *aoverrpowers = workspace->aoverrpowers;
+    const double *polynomials = workspace->polynomials;
+    const double *derivatives = workspace->derivatives;
+    const double *secondDerivatives = workspace->secondDerivatives;
+    const double *scaledDerivatives = workspace->scaledDerivatives;
+    const double *cosmphi = workspace->cosmphi;
+    const double *sinmphi = workspace->sinmphi;
+
+    int minN = coeffs->minimumN;
+    const double *gh = coeffs->ghNow;
+    size_t lInd = LEGENDRE_INDEX(minN, 0);
+
+    double w = 0.0;
+    double v = 0.0;
+    // Per-degree sums of w P (zonal and scaled tesseral parts), w dP, w d2P,
+    // v P/sin, v d(P/sin), v dP and m^2 w P/sin
+    double wp0 = 0.0;
+    double wp = 0.0;
+    double wdp = 0.0;
+    double wd2p = 0.0;
+    double vp = 0.0;
+    double vep = 0.0;
+    double vdp = 0.0;
+    double mwp = 0.0;
+    double p = 0.0;
+    double np1 = 0.0;
+    double rFactor = 0.0;
+
+    for (int i = 0; i < 3; i++)
+        b[i] = 0.0;
+    for (int i = 0; i < 9; i++)
+        gradient[i] = 0.0;
+
+    for (int n = minN; n <= maxN; n++)
+    {
+        w = gh[0];
+        wp = 0.0;
+        wdp = w * derivatives[lInd];
+        wd2p = w * secondDerivatives[lInd];
+        vp = 0.0;
+        vep = 0.0;
+        vdp = 0.0;
+        mwp = 0.0;
+        wp0 = w * polynomials[lInd];
+        gh += 2;
+        lInd++;
+        for (int m = 1; m <= n; m++)
+        {
+            w = gh[0] * cosmphi[m] + gh[1] * sinmphi[m];
+            v = (double)m * (gh[1] * cosmphi[m] - gh[0] * sinmphi[m]);
+            wp += w * polynomials[lInd];
+            wdp += w * derivatives[lInd];
+            wd2p += w * secondDerivatives[lInd];
+            vp += v * polynomials[lInd];
+            vep += v * scaledDerivatives[lInd];
+            vdp += v * derivatives[lInd];
+            mwp += (double)(m * m) * w * polynomials[lInd];
+            gh += 2;
+            lInd++;
+        }
+        // Unscaled sum of w P
+        wp = wp0 + sinTheta * wp;
+
+        p = aoverrpowers[n-1];
+        np1 = (double)n + 1.0;
+        rFactor = -((double)n + 2.0) / r;
+
+        b[0] += p * wdp;
+        b[1] += -p * vp;
+        b[2] += -np1 * p * wp;
+
+        gradient[0] += rFactor * p * wdp;
+        gradient[1] += p * wd2p;
+        gradient[2] += p * vdp;
+
+        gradient[3] += -rFactor * p * vp;
+        gradient[4] += -p * vep;
+        gradient[5] += p * mwp;
+
+        gradient[6] += -rFactor * np1 * p * wp;
+        gradient[7] += -np1 * p * wdp;
+        gradient[8] += -np1 * p * sinTheta * vp;
+    }
+
+    return;
+}
+
+int calculateFieldGradient(double r, double theta, double phi, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bNEC, double *gradient)
+{
+    if (workspace == NULL || workspace->maximumN < coeffs->maximumN)
+        return CHAOS_MODEL_MEMORY;
+
+    if (r < workspace->minimumRadiusKm)
+        workspace->minimumRadiusKm = r;
+    int maxN = truncationDegree(coeffs, r, workspace->truncationToleranceNT);
+
+    calculateBasis(r, theta, phi, &coeffs->legendre, maxN, workspace);
+    schmidtLegendreSecondDerivatives(&coeffs->legendre, maxN, cos(theta), sin(theta), workspace->polynomials, workspace->derivatives, workspace->secondDerivatives, workspace->scaledDerivatives);
+    sumFieldGradient(coeffs, maxN, r, sin(theta), workspace, bNEC, gradient);
+
+    return CHAOS_MODEL_OK;
+}
+
+int calculateChaosFieldGradient(double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust, double *gradCore, double *gradCrust, double *dBdtCore)
+{
+    if (workspace == NULL || workspace->maximumN < coeffs->core.maximumN || workspace->maximumN < coeffs->crust.maximumN)
+        return CHAOS_MODEL_MEMORY;
+
+    if (r < workspace->minimumRadiusKm)
+        workspace->minimumRadiusKm = r;
+    int coreN = truncationDegree(&coeffs->core, r, workspace->truncationToleranceNT);
+    int crustN = truncationDegree(&coeffs->crust, r, workspace->truncationToleranceNT);
+    int maxN = crustN > coreN ? crustN : coreN;
+    const SHCCoefficients *secularVariation = &coeffs->coreSecularVariation;
+    int secularVariationN = dBdtCore != NULL ? truncationDegree(secularVariation, r, workspace->truncationToleranceNT) : 0;
+    if (secularVariationN > maxN)
+        maxN = secularVariationN;
+
+    // One set of tables to the highest degree needed, as in calculateChaosField
+    const LegendreTables *legendre = coeffs->crust.maximumN >= coeffs->core.maximumN ? &coeffs->crust.legendre : &coeffs->core.legendre;
+    double sinTheta = sin(theta);
+    calculateBasis(r, theta, phi, legendre, maxN, workspace);
+    schmidtLegendreSecondDerivatives(legendre, maxN, cos(theta), sinTheta, workspace->polynomials, workspace->derivatives, workspace->secondDerivatives, workspace->scaledDerivatives);
+    sumFieldGradient(&coeffs->core, coreN, r, sinTheta, workspace, bCore, gradCore);
+    sumFieldGradient(&coeffs->crust, crustN, r, sinTheta, workspace, bCrust, gradCrust);
+    if (dBdtCore != NULL)
+        sumField(secularVariation->ghNow, secularVariation->minimumN, secularVariationN, sinTheta, workspace->aoverrpowers, workspace, dBdtCore, dBdtCore+1, dBdtCore+2);
+
+    return CHAOS_MODEL_OK;
+}
+
+// Packs one column of coefficient series stored n-major with the given stride, as
+// read from the SHC file, into ghNow order
+static void packSeriesColumn(const SHCCoefficients *coeffs, const double *g, const double *h, size_t stride, double *gh)
+{
+    size_t gRead = 0;
+    size_t hRead = 0;
+
+    for (int n = coeffs->minimumN; n <= coeffs->maximumN; n++)
+    {
+        *gh++ = g[stride * gRead++];
+        *gh++ = 0.0;
+        for (int m = 1; m <= n; m++)
+        {
+            *gh++ = g[stride * gRead++];
+            *gh++ = h[stride * hRead++];
+        }
+    }
+
+    return;
+}
+
+int initSiteField(SiteField *site, double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace)
+{
+    const SHCCoefficients *core = &coeffs->core;
+    const SHCCoefficients *crust = &coeffs->crust;
+    const SHCCoefficients *extrapolation = &coeffs->coreExtrapolation;
+
+    bzero(site, sizeof(SiteField));
+    if (core->gSplines == NULL || crust->numberOfTimes != 1 || extrapolation->numberOfTimes != 2 || extrapolation->maximumN != core->maximumN || extrapolation->minimumN != core->minimumN)
+        return CHAOS_MODEL_COEFFICIENTS;
+    if (workspace == NULL || workspace->maximumN < core->maximumN || workspace->maximumN < crust->maximumN)
+        return CHAOS_MODEL_MEMORY;
+
+    site->radiusKm = r;
+    site->theta = theta;
+    site->phi = phi;
+    site->numberOfSplines = core->numberOfSplines;
+    site->coreSplineFields = malloc(3 * sizeof(double) * (size_t)core->numberOfSplines);
+    size_t nPacked = core->numberOfPackedTerms > crust->numberOfPackedTerms ? core->numberOfPackedTerms : crust->numberOfPackedTerms;
+    double *gh = malloc(2 * sizeof(double) * nPacked);
+    if (site->coreSplineFields == NULL || gh == NULL)
+    {
+        free(gh);
+        freeSiteField(site);
+        return CHAOS_MODEL_MEMORY;
+    }
+
+    if (r < workspace->minimumRadiusKm)
+        workspace->minimumRadiusKm = r;
+    int coreN = truncationDegree(core, r, workspace->truncationToleranceNT);
+    int crustN = truncationDegree(crust, r, workspace->truncationToleranceNT);
+    const LegendreTables *legendre = crust->maximumN >= core->maximumN ? &crust->legendre : &core->legendre;
+    double sinTheta = sin(theta);
+    calculateBasis(r, theta, phi, legendre, crustN > coreN ? crustN : coreN, workspace);
+
+    // The field is linear in the coefficients, so each spline coefficient set has a field of its own
+    int nSplines = core->numberOfSplines;
+    for (int s = 0; s < nSplines; s++)
+    {
+        packSeriesColumn(core, core->gSplines + s, core->hSplines + s, (size_t)nSplines, gh);
+        sumField(gh, core->minimumN, coreN, sinTheta, workspace->aoverrpowers, workspace, site->coreSplineFields + 3*s, site->coreSplineFields + 3*s + 1, site->coreSplineFields + 3*s + 2);
+    }
+    for (int t = 0; t < 2; t++)
+    {
+        packSeriesColumn(extrapolation, extrapolation->gTimeSeries + t, extrapolation->hTimeSeries + t, 2, gh);
+        sumField(gh, extrapolation->minimumN, coreN, sinTheta, workspace->aoverrpowers, workspace, site->coreExtrapolationFields + 3*t, site->coreExtrapolationFields + 3*t + 1, site->coreExtrapolationFields + 3*t + 2);
+    }
+    packSeriesColumn(crust, crust->gTimeSeries, crust->hTimeSeries, 1, gh);
+    sumField(gh, crust->minimumN, crustN, sinTheta, workspace->aoverrpowers, workspace, site->crust, site->crust + 1, site->crust + 2);
+
+    free(gh);
+
+    return CHAOS_MODEL_OK;
+}
+
+void freeSiteField(SiteField *site)
+{
+    if (site == NULL)
+        return;
+    free(site->coreSplineFields);
+    site->coreSplineFields = NULL;
+
+    return;
+}
+
+int calculateSiteField(const SiteField *site, const ChaosCoefficients *coeffs, double fractionalYear, double *bCore, double *bCrust, double *dBdtCore)
+{
+    if (site->coreSplineFields == NULL)
+        return CHAOS_MODEL_COEFFICIENTS;
+
+    const SHCCoefficients *core = &coeffs->core;
+    double values[SHC_MAX_SPLINE_ORDER] = {0.0};
+    double derivatives[SHC_MAX_SPLINE_ORDER] = {0.0};
+    double dBdt[3] = {0.0};
+
+    for (int k = 0; k < 3; k++)
+        bCrust[k] = site->crust[k];
+
+    // Linear extrapolation past the core series, as in interpolateSHCCoefficientsAtYear
+    if (fractionalYear > core->times[core->numberOfTimes - 1])
+    {
+        const double *times = coeffs->coreExtrapolation.times;
+        const double *e = site->coreExtrapolationFields;
+        for (int k = 0; k < 3; k++)
+        {
+            dBdt[k] = (e[3 + k] - e[k]) / (times[1] - times[0]);
+            bCore[k] = e[k] + (fractionalYear - times[0]) * dBdt[k];
+        }
+    }
+    else
+    {
+        int first = splineWeights(core, fractionalYear, values, derivatives);
+        const double *f = site->coreSplineFields + 3 * first;
+        for (int k = 0; k < 3; k++)
+            bCore[k] = 0.0;
+        for (int j = 0; j < core->bSplineOrder; j++)
+        {
+            for (int k = 0; k < 3; k++)
+            {
+                bCore[k] += values[j] * f[3*j + k];
+                dBdt[k] += derivatives[j] * f[3*j + k];
+            }
+        }
+    }
+    if (dBdtCore != NULL)
+        for (int k = 0; k < 3; k++)
+            dBdtCore[k] = dBdt[k];
+
+    return CHAOS_MODEL_OK;
+}
+
+// Original per-term evaluation, kept for validating the faster kernels.
+// Always sums every degree; the workspace truncation tolerance does not apply.
+int calculateFieldReference(double r, double theta, double phi, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bn, double *be, double *bc)
 {
+    if (workspace == NULL || workspace->maximumN < coeffs->maximumN)
+        return CHAOS_MODEL_MEMORY;
+
 	double a = EARTH_RADIUS_KM;
 	double aoverr = a/r;
 	double magneticDerivRN = 0.0;
@@ -49,9 +660,9 @@ int calculateField(double r, double theta, double phi, SHCCoefficients *coeffs,
 
 	int status = 0;
 
-    double *aoverrpowers = coeffs->aoverrpowers;
-    double *derivatives = coeffs->derivatives;
-    double *polynomials = coeffs->polynomials;
+    double *aoverrpowers = workspace->aoverrpowers;
+    double *derivatives = workspace->derivatives;
+    double *polynomials = workspace->polynomials;
     int minN = coeffs->minimumN;
     int maxN = coeffs->maximumN;
     double *gnm = coeffs->gNow;
@@ -116,107 +727,458 @@ int calculateField(double r, double theta, double phi, SHCCoefficients *coeffs,
 
 }
 
-int calculateResiduals(ChaosCoefficients *coeffs, int interpolationSkip, uint8_t *magVariables[], size_t nInputs, double *bCore, double *bCrust, double *dbMeas)
+double coreUpdateTime(double unixTime, double intervalSeconds)
+{
+    if (intervalSeconds <= 0.0)
+        return unixTime;
+
+    return (floor(unixTime / intervalSeconds) + 0.5) * intervalSeconds;
+}
+
+int updateCoreForTime(ChaosCoefficients *coeffs, const ModelWorkspace *workspace, double unixTime)
 {
+    if (workspace->coreUpdateIntervalSeconds < 0.0)
+        return CHAOS_MODEL_OK;
+
+    double fractionalYear = 0.0;
+    if (yearFractionFromUnixTime(coreUpdateTime(unixTime, workspace->coreUpdateIntervalSeconds), &fractionalYear) != SHC_OK)
+        return CHAOS_MODEL_COEFFICIENTS;
+    if (updateCoreCoefficients(coeffs, fractionalYear) != SHC_OK)
+        return CHAOS_MODEL_COEFFICIENTS;
+
+    return CHAOS_MODEL_OK;
+}
+
+int calculateFieldBatchAtTimes(const double *r, const double *theta, const double *phi, const double *unixTimes, size_t nPoints, ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust, double *dBdtCore)
+{
+    return calculateFieldBatchVersions(r, theta, phi, unixTimes, nPoints, coeffs, 1, workspace, &bCore, &bCrust, dBdtCore != NULL ? &dBdtCore : NULL);
+}
+
+int calculateFieldBatchVersions(const double *r, const double *theta, const double *phi, const double *unixTimes, size_t nPoints, ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, double **bCore, double **bCrust, double **dBdtCore)
+{
+    if (nVersions < 1 || nVersions > SHC_MAX_MODEL_VERSIONS)
+        return CHAOS_MODEL_COEFFICIENTS;
+
+    bool updateCore = workspace != NULL && workspace->coreUpdateIntervalSeconds >= 0.0;
+    bool reuseCore = workspace != NULL && workspace->reuseCore;
+    bool reuseCrust = workspace != NULL && workspace->reuseCrust;
+    if (nVersions == 1 && !updateCore && dBdtCore == NULL && !reuseCore && !reuseCrust)
+        return calculateFieldBatch(r, theta, phi, nPoints, coeffs, workspace, bCore[0], bCrust[0]);
+
+    // The crust for all points, then the core for each run of points sharing an update
+    // interval. Splitting the batch instead would leave one-point batches for the crust.
+    // dB/dt is summed as a further set against the core's tables.
     int status = CHAOS_MODEL_OK;
+    int firstCrust = reuseCrust ? 1 : 0;
+    if (firstCrust < nVersions)
+        status = calculateCrustBatchVersions(r, theta, phi, nPoints, coeffs + firstCrust, nVersions - firstCrust, workspace, bCrust + firstCrust);
+    const SHCCoefficients *sets[CHAOS_BATCH_MAX_SETS] = {NULL};
+    double *b[CHAOS_BATCH_MAX_SETS] = {NULL};
+    int nSets = 0;
+    for (int v = reuseCore ? 1 : 0; v < nVersions; v++)
+    {
+        sets[nSets] = &coeffs[v].core;
+        b[nSets++] = bCore[v];
+        if (dBdtCore != NULL)
+        {
+            sets[nSets] = &coeffs[v].coreSecularVariation;
+            b[nSets++] = dBdtCore[v];
+        }
+    }
+    double coreTime = 0.0;
+    size_t last = 0;
+    for (size_t first = 0; first < nPoints && status == CHAOS_MODEL_OK; first = last)
+    {
+        last = nPoints;
+        if (updateCore)
+        {
+            coreTime = coreUpdateTime(unixTimes[first], workspace->coreUpdateIntervalSeconds);
+            for (last = first + 1; last < nPoints && coreUpdateTime(unixTimes[last], workspace->coreUpdateIntervalSeconds) == coreTime; last++)
+                ;
+            for (int v = reuseCore ? 1 : 0; v < nVersions && status == CHAOS_MODEL_OK; v++)
+                status = updateCoreForTime(&coeffs[v], workspace, unixTimes[first]);
+        }
+        if (status == CHAOS_MODEL_OK && nSets > 0)
+            status = calculateFieldBatchSets(r + first, theta + first, phi + first, last - first, sets, nSets, workspace, b);
+        for (int c = 0; c < nSets; c++)
+            b[c] += 3 * (last - first);
+    }
 
-	double degrees = M_PI / 180.0;
-	double a = EARTH_RADIUS_KM;
-	double inputTime = 0.;
-	double r = 0.;
-	double theta = 0.0 * degrees;
-	double phi = 0.0 * degrees;
+    return status;
+}
 
-	double deltaT = 0.0;
-	double interpolationFraction = 1.0;
-	size_t lastIndex = 0;
+int initMagColumns(MagColumns *columns, size_t capacity)
+{
+    bzero(columns, sizeof(MagColumns));
+    if (capacity == 0)
+        return CHAOS_MODEL_OK;
+
+    double **column[5] = {&columns->times, &columns->latitudes, &columns->longitudes, &columns->radii, &columns->bNEC};
+    size_t width[5] = {1, 1, 1, 1, 3};
+    void *memory = NULL;
+    for (int i = 0; i < 5; i++)
+    {
+        if (posix_memalign(&memory, 64, capacity * width[i] * sizeof(double)) != 0)
+        {
+            freeMagColumns(columns);
+            return CHAOS_MODEL_MEMORY;
+        }
+        *column[i] = memory;
+    }
+    columns->capacity = capacity;
+
+    return CHAOS_MODEL_OK;
+}
+
+void freeMagColumns(MagColumns *columns)
+{
+    free(columns->times);
+    free(columns->latitudes);
+    free(columns->longitudes);
+    free(columns->radii);
+    free(columns->bNEC);
+    bzero(columns, sizeof(MagColumns));
+
+    return;
+}
+
+size_t controlPointSample(size_t c, size_t nSeries, int interpolationSkip)
+{
+    size_t lastIndex = ((nSeries - 1) / interpolationSkip) * interpolationSkip;
+    size_t t = c * interpolationSkip;
+    if (t > lastIndex)
+        t = lastIndex + c - lastIndex / interpolationSkip;
+    if (t > nSeries)
+        t = nSeries;
+
+    return t;
+}
 
-    fprintf(stdout, "%sCalculating fields...\n", infoHeader);
+size_t numberOfControlPoints(size_t nSeries, int interpolationSkip)
+{
+    if (nSeries == 0)
+        return 0;
+    size_t lastIndex = ((nSeries - 1) / interpolationSkip) * interpolationSkip;
 
-    // Get fields for first time
-    inputTime = ((double*)magVariables[0])[0];
-    theta = (90.0 - ((double*)magVariables[1])[0]) * degrees;
-    phi = ((double*)magVariables[2])[0] * degrees;
-    r = ((double*)magVariables[3])[0]/1000.;
+    return lastIndex / interpolationSkip + nSeries - lastIndex;
+}
+
+// One thread's share of calculateResidualsWindow: the control points from firstPoint up to
+// lastPoint, then the samples from firstSample up to lastSample. Sample and control point
+// numbers count from the start of the series; the arrays start at sample windowStart.
+typedef struct ResidualsJob
+{
+    ChaosCoefficients *coeffs;
+    int nVersions;
+    ModelWorkspace *workspace;
+    int interpolationSkip;
+    size_t nSeries;
+    size_t windowStart;
+    const MagColumns *inputs;
+    double *bCore;
+    double *bCrust;
+    double *dBdtCore;
+    double *dbMeas;
+    size_t firstPoint;
+    size_t lastPoint;
+    size_t firstSample;
+    size_t lastSample;
+    int status;
+} ResidualsJob;
 
-    status = calculateField(r, theta, phi, &coeffs->core, bCore, bCore+1, bCore+2);
-    if (status != CHAOS_MODEL_OK)
-        return status;
+// Model fields at the job's control points, in batches of CHAOS_BATCH_POINTS
+static void *residualsControlPoints(void *arg)
+{
+    ResidualsJob *job = (ResidualsJob *)arg;
+    ChaosCoefficients *coeffs = job->coeffs;
+    ModelWorkspace *workspace = job->workspace;
+    int nVersions = job->nVersions;
 
-    status = calculateField(r, theta, phi, &coeffs->crust, bCrust, bCrust+1, bCrust+2);
-    if (status != CHAOS_MODEL_OK)
-        return status;
+	double degrees = M_PI / 180.0;
 
-    dbMeas[0] = ((double*)magVariables[4])[0] - bCore[0] - bCrust[0];
-    dbMeas[1] = ((double*)magVariables[4])[1] - bCore[1] - bCrust[1];
-    dbMeas[2] = ((double*)magVariables[4])[2] - bCore[2] - bCrust[2];
+    const double *times = job->inputs->times;
+    const double *latitudes = job->inputs->latitudes;
+    const double *longitudes = job->inputs->longitudes;
+    const double *radii = job->inputs->radii;
 
-    lastIndex = 0;
-    for (size_t t = interpolationSkip; t < nInputs && keep_running == 1; t += interpolationSkip)
+    double r[CHAOS_BATCH_POINTS];
+    double theta[CHAOS_BATCH_POINTS];
+    double phi[CHAOS_BATCH_POINTS];
+    double bCoreBatch[SHC_MAX_MODEL_VERSIONS][3 * CHAOS_BATCH_POINTS];
+    double bCrustBatch[SHC_MAX_MODEL_VERSIONS][3 * CHAOS_BATCH_POINTS];
+    double dBdtBatch[SHC_MAX_MODEL_VERSIONS][3 * CHAOS_BATCH_POINTS];
+    double *bCoreOut[SHC_MAX_MODEL_VERSIONS];
+    double *bCrustOut[SHC_MAX_MODEL_VERSIONS];
+    double *dBdtOut[SHC_MAX_MODEL_VERSIONS];
+    double unixTimes[CHAOS_BATCH_POINTS];
+    size_t index[CHAOS_BATCH_POINTS];
+    for (int v = 0; v < nVersions; v++)
     {
-        inputTime = ((double*)magVariables[0])[t];
-        theta = (90.0 - ((double*)magVariables[1])[t]) * degrees;
-        phi = ((double*)magVariables[2])[t] * degrees;
-        r = ((double*)magVariables[3])[t]/1000.;
+        bCoreOut[v] = bCoreBatch[v];
+        bCrustOut[v] = bCrustBatch[v];
+        dBdtOut[v] = dBdtBatch[v];
+    }
 
-        status = calculateField(r, theta, phi, &coeffs->core, bCore+t*3, bCore+t*3+1, bCore+t*3+2);
-        if (status != CHAOS_MODEL_OK)
-            return status;
+    // Version v occupies values v * stride onwards of each output
+    size_t stride = 3 * job->inputs->nRecords;
+    double *core = NULL;
+    double *crust = NULL;
+    double *dBdt = NULL;
+    bool reuseCore = workspace != NULL && workspace->reuseCore;
+    bool reuseCrust = workspace != NULL && workspace->reuseCrust;
 
-        status = calculateField(r, theta, phi, &coeffs->crust, bCrust+t*3, bCrust+t*3+1, bCrust+t*3+2);
-        if (status != CHAOS_MODEL_OK)
-            return status;
+    size_t nPoints = 0;
+    size_t t = 0;
+    for (size_t c = job->firstPoint; c < job->lastPoint && keep_running == 1; c += nPoints)
+    {
+        nPoints = job->lastPoint - c < CHAOS_BATCH_POINTS ? job->lastPoint - c : CHAOS_BATCH_POINTS;
+        for (size_t i = 0; i < nPoints; i++)
+        {
+            t = controlPointSample(c + i, job->nSeries, job->interpolationSkip) - job->windowStart;
+            index[i] = t;
+            unixTimes[i] = times[t] / 1000.0 - CHAOS_CDF_EPOCH_UNIX_OFFSET_S;
+            theta[i] = (90.0 - latitudes[t]) * degrees;
+            phi[i] = longitudes[t] * degrees;
+            r[i] = radii[t] / 1000.;
+        }
+        job->status = calculateFieldBatchVersions(r, theta, phi, unixTimes, nPoints, coeffs, nVersions, workspace, bCoreOut, bCrustOut, job->dBdtCore != NULL ? dBdtOut : NULL);
+        if (job->status != CHAOS_MODEL_OK)
+            return NULL;
+
+        for (int v = 0; v < nVersions; v++)
+        {
+            // Reused components keep the caller's values
+            core = v == 0 && reuseCore ? NULL : job->bCore + v * stride;
+            crust = v == 0 && reuseCrust ? NULL : job->bCrust + v * stride;
+            dBdt = job->dBdtCore != NULL && core != NULL ? job->dBdtCore + v * stride : NULL;
+            for (size_t i = 0; i < nPoints; i++)
+            {
+                t = index[i];
+                for (int k = 0; k < 3; k++)
+                {
+                    if (core != NULL)
+                        core[t*3 + k] = bCoreBatch[v][i*3 + k];
+                    if (crust != NULL)
+                        crust[t*3 + k] = bCrustBatch[v][i*3 + k];
+                    if (dBdt != NULL)
+                        dBdt[t*3 + k] = dBdtBatch[v][i*3 + k];
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+// Interpolated fields and residuals at the job's samples, once every control point is done
+static void *residualsSamples(void *arg)
+{
+    ResidualsJob *job = (ResidualsJob *)arg;
+    int interpolationSkip = job->interpolationSkip;
+    double *bCore = job->bCore;
+    double *bCrust = job->bCrust;
+    double *dBdtCore = job->dBdtCore;
+    double *dbMeas = job->dbMeas;
+
+	double deltaT = 0.0;
+	double interpolationFraction = 1.0;
+
+    const double *times = job->inputs->times;
+    const double *bMeas = job->inputs->bNEC;
 
-        dbMeas[t*3]   = ((double*)magVariables[4])[t*3 + 0] - bCore[t*3 + 0] - bCrust[t*3 + 0];
-        dbMeas[t*3+1] = ((double*)magVariables[4])[t*3 + 1] - bCore[t*3 + 1] - bCrust[t*3 + 1];
-        dbMeas[t*3+2] = ((double*)magVariables[4])[t*3 + 2] - bCore[t*3 + 2] - bCrust[t*3 + 2];
+    // Samples counted from the start of the window. Intervals end at most at its last sample.
+    size_t firstSample = job->firstSample - job->windowStart;
+    size_t lastSample = job->lastSample - job->windowStart;
+    // Past the last regular control point every sample is one
+    size_t lastIndex = ((job->nSeries - 1) / interpolationSkip) * interpolationSkip;
+    lastIndex = lastIndex > job->windowStart ? lastIndex - job->windowStart : 0;
+    if (lastIndex > job->inputs->nRecords - 1)
+        lastIndex = job->inputs->nRecords - 1;
+    size_t stride = 3 * job->inputs->nRecords;
+    size_t nValues = job->nVersions * stride;
+    double *core = NULL;
+    double *crust = NULL;
+    double *dBdt = NULL;
+    bool reuseCore = job->workspace != NULL && job->workspace->reuseCore;
+    bool reuseCrust = job->workspace != NULL && job->workspace->reuseCrust;
 
-        // Linearly interpolate at skipped epochs
-        deltaT = ((double*)magVariables[0])[t] - ((double*)magVariables[0])[t - interpolationSkip];
+    // Linearly interpolate at skipped epochs. Each version's block has the layout of the
+    // first, so the three outputs are walked in steps of stride.
+    size_t o = 0;
+    for (size_t t = firstSample + interpolationSkip; t <= lastIndex && t - interpolationSkip < lastSample && keep_running == 1; t += interpolationSkip)
+    {
+        deltaT = times[t] - times[t - interpolationSkip];
         if (deltaT <= 0.)
             deltaT = 1.0; // arbitrary
         for (ssize_t i = t-interpolationSkip + 1; i < t; i++)
         {
-            interpolationFraction = (((double*)magVariables[0])[i] - ((double*)magVariables[0])[t-interpolationSkip]) / deltaT;
-            bCore[i*3] = bCore[(t-interpolationSkip)*3] + interpolationFraction * (bCore[t*3] - bCore[(t-interpolationSkip)*3]);
-            bCore[i*3+1] = bCore[(t-interpolationSkip)*3+1] + interpolationFraction * (bCore[t*3+1] - bCore[(t-interpolationSkip)*3+1]);
-            bCore[i*3+2] = bCore[(t-interpolationSkip)*3+2] + interpolationFraction * (bCore[t*3+2] - bCore[(t-interpolationSkip)*3+2]);
+            interpolationFraction = (times[i] - times[t-interpolationSkip]) / deltaT;
+            for (o = 0; o < nValues; o += stride)
+            {
+                if (!(o == 0 && reuseCore))
+                {
+                    core = bCore + o;
+                    for (int k = 0; k < 3; k++)
+                        core[i*3+k] = core[(t-interpolationSkip)*3+k] + interpolationFraction * (core[t*3+k] - core[(t-interpolationSkip)*3+k]);
+                    if (dBdtCore != NULL)
+                    {
+                        dBdt = dBdtCore + o;
+                        for (int k = 0; k < 3; k++)
+                            dBdt[i*3+k] = dBdt[(t-interpolationSkip)*3+k] + interpolationFraction * (dBdt[t*3+k] - dBdt[(t-interpolationSkip)*3+k]);
+                    }
+                }
+                if (!(o == 0 && reuseCrust))
+                {
+                    crust = bCrust + o;
+                    for (int k = 0; k < 3; k++)
+                        crust[i*3+k] = crust[(t-interpolationSkip)*3+k] + interpolationFraction * (crust[t*3+k] - crust[(t-interpolationSkip)*3+k]);
+                }
+            }
+        }
+    }
 
-            bCrust[i*3] = bCrust[(t-interpolationSkip)*3] + interpolationFraction * (bCrust[t*3] - bCrust[(t-interpolationSkip)*3]);
-            bCrust[i*3+1] = bCrust[(t-interpolationSkip)*3+1] + interpolationFraction * (bCrust[t*3+1] - bCrust[(t-interpolationSkip)*3+1]);
-            bCrust[i*3+2] = bCrust[(t-interpolationSkip)*3+2] + interpolationFraction * (bCrust[t*3+2] - bCrust[(t-interpolationSkip)*3+2]);
+    for (o = 0; o < nValues && keep_running == 1; o += stride)
+    {
+        for (size_t t = firstSample; t < lastSample; t++)
+        {
+            dbMeas[o + t*3]   = bMeas[t*3 + 0] - bCore[o + t*3 + 0] - bCrust[o + t*3 + 0];
+            dbMeas[o + t*3+1] = bMeas[t*3 + 1] - bCore[o + t*3 + 1] - bCrust[o + t*3 + 1];
+            dbMeas[o + t*3+2] = bMeas[t*3 + 2] - bCore[o + t*3 + 2] - bCrust[o + t*3 + 2];
+        }
+    }
 
-            // Copy skipped measured fields
-            dbMeas[i*3]   = ((double*)magVariables[4])[i*3 + 0] - bCore[i*3 + 0] - bCrust[i*3 + 0];
-            dbMeas[i*3+1] = ((double*)magVariables[4])[i*3 + 1] - bCore[i*3 + 1] - bCrust[i*3 + 1];
-            dbMeas[i*3+2] = ((double*)magVariables[4])[i*3 + 2] - bCore[i*3 + 2] - bCrust[i*3 + 2];
+    return NULL;
+}
 
-        }
-        lastIndex = t;
+// Runs worker on each job, the last on the calling thread
+static int runResidualsJobs(void *(*worker)(void *), ResidualsJob *jobs, pthread_t *threads, int nThreads)
+{
+    int nStarted = 0;
+    for (; nStarted < nThreads - 1; nStarted++)
+        if (pthread_create(&threads[nStarted], NULL, worker, &jobs[nStarted]) != 0)
+            break;
+    // Jobs without a thread run here too, so the results stay the same
+    for (int j = nStarted; j < nThreads; j++)
+        worker(&jobs[j]);
+    for (int j = 0; j < nStarted; j++)
+        pthread_join(threads[j], NULL);
 
-    }
-    // Calculate actual field for remaining inputs (up to INTEGRATION_SKIP-1 of them)
-    for (size_t t = lastIndex+1; t < nInputs && keep_running == 1; t++)
-    {
-        inputTime = ((double*)magVariables[0])[t];
-        theta = (90.0 - ((double*)magVariables[1])[t]) * degrees;
-        phi = ((double*)magVariables[2])[t] * degrees;
-        r = ((double*)magVariables[3])[t]/1000.;
+    for (int j = 0; j < nThreads; j++)
+        if (jobs[j].status != CHAOS_MODEL_OK)
+            return jobs[j].status;
 
-        status = calculateField(r, theta, phi, &coeffs->core, bCore+t*3, bCore+t*3+1, bCore+t*3+2);
-        if (status != CHAOS_MODEL_OK)
-            return status;
+    return CHAOS_MODEL_OK;
+}
+
+int calculateResiduals(ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, int interpolationSkip, const MagColumns *inputs, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas)
+{
+    return calculateResidualsWindow(coeffs, nVersions, workspace, interpolationSkip, inputs->nRecords, 0, 0, inputs, bCore, bCrust, dBdtCore, dbMeas);
+}
+
+int calculateResidualsWindow(ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, int interpolationSkip, size_t nSeries, size_t firstSample, size_t firstPoint, const MagColumns *inputs, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas)
+{
+    int status = CHAOS_MODEL_OK;
+
+    if (inputs->nRecords == 0)
+        return CHAOS_MODEL_OK;
+    if (nVersions < 1 || nVersions > SHC_MAX_MODEL_VERSIONS)
+        return CHAOS_MODEL_COEFFICIENTS;
+    if (firstSample + inputs->nRecords > nSeries || controlPointSample(firstPoint, nSeries, interpolationSkip) < firstSample)
+        return CHAOS_MODEL_COEFFICIENTS;
 
-        status = calculateField(r, theta, phi, &coeffs->crust, bCrust+t*3, bCrust+t*3+1, bCrust+t*3+2);
+    // Model fields are calculated every interpolationSkip samples (control points)
+    // and at each sample after the last control point. Control points are
+    // evaluated in batches of CHAOS_BATCH_POINTS positions.
+    size_t windowEnd = firstSample + inputs->nRecords;
+    size_t nPoints = numberOfControlPoints(nSeries, interpolationSkip);
+    size_t lastPoint = firstPoint;
+    while (lastPoint < nPoints && controlPointSample(lastPoint, nSeries, interpolationSkip) < windowEnd)
+        lastPoint++;
+    size_t nBatches = (lastPoint - firstPoint + CHAOS_BATCH_POINTS - 1) / CHAOS_BATCH_POINTS;
+
+    // Each thread takes a contiguous run of whole batches. Batches are evaluated exactly
+    // as on one thread, and the core coefficients at a time do not depend on earlier
+    // updates, so the results are the same for any number of threads.
+    int nThreads = workspace != NULL && workspace->threads > 1 ? workspace->threads : 1;
+    if ((size_t)nThreads > nBatches)
+        nThreads = nBatches > 0 ? (int)nBatches : 1;
+
+    if (nThreads > 1)
+        fprintf(stdout, "%sCalculating fields on %d threads...\n", infoHeader, nThreads);
+    else
+        fprintf(stdout, "%sCalculating fields...\n", infoHeader);
+
+    ResidualsJob *jobs = calloc(nThreads, sizeof(ResidualsJob));
+    pthread_t *threads = calloc(nThreads, sizeof(pthread_t));
+    ChaosCoefficients (*copies)[SHC_MAX_MODEL_VERSIONS] = calloc(nThreads, sizeof(*copies));
+    ModelWorkspace *workspaces = calloc(nThreads, sizeof(ModelWorkspace));
+    if (jobs == NULL || threads == NULL || copies == NULL || workspaces == NULL)
+    {
+        free(jobs);
+        free(threads);
+        free(copies);
+        free(workspaces);
+        return CHAOS_MODEL_MEMORY;
+    }
+
+    for (int j = 0; j < nThreads; j++)
+    {
+        jobs[j].coeffs = coeffs;
+        jobs[j].nVersions = nVersions;
+        jobs[j].workspace = workspace;
+        jobs[j].interpolationSkip = interpolationSkip;
+        jobs[j].nSeries = nSeries;
+        jobs[j].windowStart = firstSample;
+        jobs[j].inputs = inputs;
+        jobs[j].bCore = bCore;
+        jobs[j].bCrust = bCrust;
+        jobs[j].dBdtCore = dBdtCore;
+        jobs[j].dbMeas = dbMeas;
+        jobs[j].firstPoint = firstPoint + nBatches * j / nThreads * CHAOS_BATCH_POINTS;
+        jobs[j].lastPoint = j == nThreads - 1 ? lastPoint : firstPoint + nBatches * (j + 1) / nThreads * CHAOS_BATCH_POINTS;
+        // Samples are split on the same control points
+        jobs[j].firstSample = j == 0 ? firstSample : controlPointSample(jobs[j].firstPoint, nSeries, interpolationSkip);
+        jobs[j].lastSample = j == nThreads - 1 ? windowEnd : controlPointSample(jobs[j].lastPoint, nSeries, interpolationSkip);
+        jobs[j].status = CHAOS_MODEL_OK;
+        // The last job, on the calling thread, uses the caller's coefficients and workspace
+        // and leaves them as one thread would
+        if (j == nThreads - 1)
+            continue;
+        for (int v = 0; v < nVersions && status == CHAOS_MODEL_OK; v++)
+            if (initChaosCoefficientsCopy(&copies[j][v], &coeffs[v]) != SHC_OK)
+                status = CHAOS_MODEL_MEMORY;
+        if (status == CHAOS_MODEL_OK)
+            status = initModelWorkspaceForDegree(&workspaces[j], workspace->maximumN);
         if (status != CHAOS_MODEL_OK)
-             return status;
+            break;
+        workspaces[j].truncationToleranceNT = workspace->truncationToleranceNT;
+        workspaces[j].singlePrecisionCrust = workspace->singlePrecisionCrust;
+        workspaces[j].coreUpdateIntervalSeconds = workspace->coreUpdateIntervalSeconds;
+        workspaces[j].reuseCore = workspace->reuseCore;
+        workspaces[j].reuseCrust = workspace->reuseCrust;
+        jobs[j].coeffs = copies[j];
+        jobs[j].workspace = &workspaces[j];
+    }
 
-        dbMeas[t*3]   = ((double*)magVariables[4])[t*3 + 0] - bCore[t*3 + 0] - bCrust[t*3 + 0];
-        dbMeas[t*3+1] = ((double*)magVariables[4])[t*3 + 1] - bCore[t*3 + 1] - bCrust[t*3 + 1];
-        dbMeas[t*3+2] = ((double*)magVariables[4])[t*3 + 2] - bCore[t*3 + 2] - bCrust[t*3 + 2];
+    if (status == CHAOS_MODEL_OK)
+        status = runResidualsJobs(residualsControlPoints, jobs, threads, nThreads);
+    if (status == CHAOS_MODEL_OK)
+        status = runResidualsJobs(residualsSamples, jobs, threads, nThreads);
 
+    for (int j = 0; j < nThreads - 1; j++)
+    {
+        if (workspaces[j].maximumN > 0 && workspaces[j].minimumRadiusKm < workspace->minimumRadiusKm)
+            workspace->minimumRadiusKm = workspaces[j].minimumRadiusKm;
+        freeModelWorkspace(&workspaces[j]);
+        for (int v = 0; v < nVersions; v++)
+            if (copies[j][v].core.initialized)
+                freeChaosCoefficientsCopy(&copies[j][v]);
     }
+    free(jobs);
+    free(threads);
+    free(copies);
+    free(workspaces);
 
-    return CHAOS_MODEL_OK;
+    return status;
 
 }
@@ -32,11 +32,192 @@ enum CHAOS_MODEL_STATUS
 {
     CHAOS_MODEL_OK = 0,
     CHAOS_MODEL_GSL = 0,
-    CHAOS_MODEL_COEFFICIENTS
+    CHAOS_MODEL_COEFFICIENTS,
+    CHAOS_MODEL_MEMORY
 };
 
-int calculateField(double r, double theta, double phi, SHCCoefficients *coeffs, double *bn, double *be, double *bc);
+#define CHAOS_CORE_UPDATE_NEVER -1.0
+// Seconds from 0000-01-01 (CDF_EPOCH) to 1970-01-01
+#define CHAOS_CDF_EPOCH_UNIX_OFFSET_S 62167219200.0
 
-int calculateResiduals(ChaosCoefficients *coeffs, int interpolationSkip, uint8_t *magVariables[], size_t nInputs, double *bCore, double *bCrust, double *dbMeas);
+// Coefficient sets one batched evaluation can sum against shared tables:
+// the core and its secular variation, or the crust, of each loaded model version
+#define CHAOS_BATCH_MAX_SETS (2 * SHC_MAX_MODEL_VERSIONS)
+// Points handed to the batched kernels at a time by calculateResiduals
+#define CHAOS_BATCH_POINTS 256
+
+enum CHAOS_FIELD_KERNEL
+{
+    CHAOS_FIELD_KERNEL_RECURRENCE = 0,
+    CHAOS_FIELD_KERNEL_REFERENCE
+};
+
+// Per-caller evaluation buffers. Coefficient sets are only read during evaluation,
+// so threads sharing one ChaosCoefficients each need their own workspace.
+// interpolateSHCCoefficients must not run while another thread is evaluating.
+typedef struct ModelWorkspace
+{
+    int maximumN;
+    double *aoverrpowers;
+    double *polynomials;
+    double *derivatives;
+    // Second theta derivatives and theta derivatives of polynomials, for calculateFieldGradient
+    double *secondDerivatives;
+    double *scaledDerivatives;
+    double *cosmphi;
+    double *sinmphi;
+    double *batchScratch;
+    // Degrees whose combined bound at the evaluation radius is below this many nT
+    // are skipped by the recurrence kernels. 0 evaluates every degree.
+    double truncationToleranceNT;
+    // Smallest radius (km) evaluated since initialization, for reporting the degree used
+    double minimumRadiusKm;
+    // calculateFieldBatch sums the crust in float (core and totals stay double).
+    // Per-point evaluations are not affected.
+    bool singlePrecisionCrust;
+    // calculateResiduals moves the core coefficients to the centre of each interval of
+    // this many seconds, or to each sample's time for 0. CHAOS_CORE_UPDATE_NEVER keeps
+    // the coefficients as interpolated, which is the default.
+    double coreUpdateIntervalSeconds;
+    // Components of the first model version that calculateFieldBatchVersions and
+    // calculateResiduals leave to the caller, as when reprocessing reuses a previous
+    // product's values. Their outputs are neither evaluated nor written.
+    bool reuseCore;
+    bool reuseCrust;
+    // Threads calculateResiduals divides the samples among, each with its own workspace
+    // and copy of the core coefficients. The results do not depend on the number;
+    // 0 or 1 evaluates on the calling thread only.
+    int threads;
+} ModelWorkspace;
+
+// Measurements as read from a MAG CDF file, one 64-byte aligned column per variable
+typedef struct MagColumns
+{
+    size_t nRecords;
+    size_t capacity;
+    // CDF_EPOCH (ms)
+    double *times;
+    // Geocentric latitude and longitude (degrees) and radius (m)
+    double *latitudes;
+    double *longitudes;
+    double *radii;
+    // Three values (nT) per record
+    double *bNEC;
+} MagColumns;
+
+// Columns with room for capacity records, none of them set
+int initMagColumns(MagColumns *columns, size_t capacity);
+void freeMagColumns(MagColumns *columns);
+
+// Sizes the workspace for the deepest set in coeffs
+int initModelWorkspace(ModelWorkspace *workspace, const ChaosCoefficients *coeffs);
+// Sizes the workspace for the deepest set of nVersions models
+int initModelWorkspaceForVersions(ModelWorkspace *workspace, const ChaosCoefficients *coeffs, int nVersions);
+int initModelWorkspaceForDegree(ModelWorkspace *workspace, int maximumN);
+void freeModelWorkspace(ModelWorkspace *workspace);
+
+// Highest degree of coeffs to evaluate at radius r (km) so that the omitted degrees
+// contribute at most toleranceNT. Below coeffs->minimumN if the whole set is negligible.
+int truncationDegree(const SHCCoefficients *coeffs, double r, double toleranceNT);
+// Highest degree of coeffs evaluated with this workspace so far
+int maximumDegreeUsed(const SHCCoefficients *coeffs, const ModelWorkspace *workspace);
+
+// Selects the implementation used by calculateField for all subsequent calls
+void setFieldKernel(int kernel);
+int getFieldKernel(void);
+
+int calculateField(double r, double theta, double phi, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bn, double *be, double *bc);
+// Core and crustal fields (NEC, nT) from one set of Legendre, azimuthal and radial tables
+int calculateChaosField(double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust);
+// Core and crustal fields for nPoints positions given as separate r (km), theta and phi (radians) arrays.
+// bCore and bCrust receive 3 * nPoints NEC values. Uses the widest SIMD kernel the CPU supports.
+int calculateFieldBatch(const double *r, const double *theta, const double *phi, size_t nPoints, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust);
+// The crustal part of calculateFieldBatch alone, for callers evaluating the core at several epochs
+int calculateCrustBatch(const double *r, const double *theta, const double *phi, size_t nPoints, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCrust);
+// Crustal fields of nVersions models against shared tables, one output array per version
+int calculateCrustBatchVersions(const double *r, const double *theta, const double *phi, size_t nPoints, const ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, double **bCrust);
+// As calculateFieldBatch for up to CHAOS_BATCH_MAX_SETS arbitrary coefficient sets, one output array per set
+int calculateFieldBatchSets(const double *r, const double *theta, const double *phi, size_t nPoints, const SHCCoefficients **sets, int nSets, ModelWorkspace *workspace, double **b);
+// Name of the instruction set selected for batched evaluation
+const char *batchKernelDescription(void);
+// Altitude (km) of the reference orbit for singlePrecisionCrustDeviation reports
+#define CHAOS_REFERENCE_ORBIT_ALTITUDE_KM 450.0
+// Largest N, E, C deviation (nT) of the single-precision crust from the double kernel over
+// one day of a reference circular orbit (87.35 degree inclination) at altitudeKm, and the
+// largest crustal field magnitudes on that orbit, for judging the singlePrecisionCrust mode. Leaves
+// the workspace's minimumRadiusKm as it was.
+int singlePrecisionCrustDeviation(const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double altitudeKm, double *maxDeviationNT, double *maxCrustNT);
+
+// Field (NEC, nT) and its partial derivatives from the same tables. gradient[3 * i + j]
+// is dB_i / dx_j for B_i = N, E, C and x_j = r (nT/km), theta, phi (nT/radian).
+// Uses the recurrence kernel regardless of setFieldKernel.
+int calculateFieldGradient(double r, double theta, double phi, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bNEC, double *gradient);
+// Core and crustal fields and gradients; gradCore and gradCrust receive 9 values each.
+// Core dB/dt (nT/year) is summed from the same tables unless dBdtCore is NULL.
+int calculateChaosFieldGradient(double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust, double *gradCore, double *gradCrust, double *dBdtCore);
+
+// Fields at one fixed position for any epoch. The core field is stored for each
+// B-spline coefficient of the core model (and each time of the extrapolation set),
+// so an epoch costs a sum over the splines nonzero then rather than a model evaluation.
+typedef struct SiteField
+{
+    double radiusKm;
+    double theta;
+    double phi;
+    int numberOfSplines;
+    // 3 * numberOfSplines NEC values
+    double *coreSplineFields;
+    // Core field at the two times of the extrapolation set
+    double coreExtrapolationFields[6];
+    double crust[3];
+} SiteField;
+
+// Tables for r (km), theta and phi (radians), truncated by the workspace tolerance.
+// Requires the core B-spline fit made by loadSHCCoefficients.
+int initSiteField(SiteField *site, double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace);
+void freeSiteField(SiteField *site);
+// Core and crustal fields (NEC, nT) and, unless NULL, dBdtCore (nT/year) at fractionalYear,
+// matching interpolateSHCCoefficientsAtYear followed by calculateChaosField
+int calculateSiteField(const SiteField *site, const ChaosCoefficients *coeffs, double fractionalYear, double *bCore, double *bCrust, double *dBdtCore);
+
+// Field in geocentric Cartesian components (nT) at x, y, z (km), without
+// spherical coordinates or trigonometric functions
+int calculateFieldCartesian(double x, double y, double z, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bXYZ);
+// Core and crustal fields; bCore and bCrust receive x, y, z components
+int calculateChaosFieldCartesian(double x, double y, double z, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust);
+// As calculateFieldCartesian for up to CHAOS_BATCH_MAX_SETS sets sharing one recurrence
+int calculateFieldCartesianSets(double x, double y, double z, const SHCCoefficients **sets, int nSets, ModelWorkspace *workspace, double **b);
+
+int calculateFieldReference(double r, double theta, double phi, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bn, double *be, double *bc);
+
+// Time (unix seconds) at which the core is evaluated for a sample at unixTime: the centre of
+// its update interval (aligned to multiples of intervalSeconds), or unixTime for an interval of 0
+double coreUpdateTime(double unixTime, double intervalSeconds);
+// Evaluates the core coefficients for a sample at unixTime under the workspace's update interval
+int updateCoreForTime(ChaosCoefficients *coeffs, const ModelWorkspace *workspace, double unixTime);
+
+// As calculateFieldBatch for samples at unixTimes (seconds), moving the core coefficients to
+// each sample's update interval under the workspace's coreUpdateIntervalSeconds. Unless NULL,
+// dBdtCore receives the core secular variation (NEC, nT/year) from the same tables.
+int calculateFieldBatchAtTimes(const double *r, const double *theta, const double *phi, const double *unixTimes, size_t nPoints, ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust, double *dBdtCore);
+// As calculateFieldBatchAtTimes for the nVersions models in coeffs, up to SHC_MAX_MODEL_VERSIONS.
+// Every version's sets are summed against the same tables; outputs are arrays per version.
+int calculateFieldBatchVersions(const double *r, const double *theta, const double *phi, const double *unixTimes, size_t nPoints, ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, double **bCore, double **bCrust, double **dBdtCore);
+
+// Model fields and residuals for CDF_EPOCH times with respect to each of the nVersions models
+// in coeffs. Outputs hold nVersions consecutive blocks of 3 * inputs->nRecords values, one per
+// version. dBdtCore may be NULL. Blocks the workspace marks as reused must already hold every sample.
+int calculateResiduals(ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, int interpolationSkip, const MagColumns *inputs, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas);
+// calculateResiduals for part of a series of nSeries samples: inputs holds the samples from
+// firstSample, a control point, on, and ends at a control point or the end of the series. Control
+// points from firstPoint on are evaluated; the model fields of any before it in inputs must be
+// set. Samples and control points keep their places in the series, so the results match those
+// of calculateResiduals over the whole series when firstPoint is a multiple of CHAOS_BATCH_POINTS.
+int calculateResidualsWindow(ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, int interpolationSkip, size_t nSeries, size_t firstSample, size_t firstPoint, const MagColumns *inputs, double *bCore, double *bCrust, double *dBdtCore, double *dbMeas);
+// Control point c of a series of nSeries samples: every interpolationSkip-th sample through the
+// last multiple of interpolationSkip, then every sample. nSeries for c past the last.
+size_t controlPointSample(size_t c, size_t nSeries, int interpolationSkip);
+// Number of control points in a series of nSeries samples
+size_t numberOfControlPoints(size_t nSeries, int interpolationSkip);
 
 #endif // _CHAOS_MODEL_H
@@ -0,0 +1,291 @@
+/*
+
+    CHAOS: model_batch.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "model.h"
+#include "shc.h"
+#include "legendre.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+typedef void (*BatchKernel)(const double *r, const double *theta, const double *phi, size_t nPoints, const SHCCoefficients **sets, int nSets, const LegendreTables *legendre, double toleranceNT, void *scratch, double **b);
+
+#define BATCH_KERNEL_NAME batchKernelGeneric
+#define BATCH_KERNEL_WIDTH 2
+#define BATCH_KERNEL_TARGET
+#define BATCH_KERNEL_SINGLE 0
+#include "model_batch_kernel.h"
+#undef BATCH_KERNEL_NAME
+#undef BATCH_KERNEL_WIDTH
+#undef BATCH_KERNEL_TARGET
+#undef BATCH_KERNEL_SINGLE
+
+#define BATCH_KERNEL_NAME batchKernelGenericSingle
+#define BATCH_KERNEL_WIDTH 4
+#define BATCH_KERNEL_TARGET
+#define BATCH_KERNEL_SINGLE 1
+#include "model_batch_kernel.h"
+#undef BATCH_KERNEL_NAME
+#undef BATCH_KERNEL_WIDTH
+#undef BATCH_KERNEL_TARGET
+#undef BATCH_KERNEL_SINGLE
+
+#if defined(__x86_64__) && defined(__GNUC__)
+
+#define BATCH_KERNEL_NAME batchKernelAvx2
+#define BATCH_KERNEL_WIDTH 4
+#define BATCH_KERNEL_TARGET __attribute__((target("avx2,fma")))
+#define BATCH_KERNEL_SINGLE 0
+#include "model_batch_kernel.h"
+#undef BATCH_KERNEL_NAME
+#undef BATCH_KERNEL_WIDTH
+#undef BATCH_KERNEL_TARGET
+#undef BATCH_KERNEL_SINGLE
+
+#define BATCH_KERNEL_NAME batchKernelAvx2Single
+#define BATCH_KERNEL_WIDTH 8
+#define BATCH_KERNEL_TARGET __attribute__((target("avx2,fma")))
+#define BATCH_KERNEL_SINGLE 1
+#include "model_batch_kernel.h"
+#undef BATCH_KERNEL_NAME
+#undef BATCH_KERNEL_WIDTH
+#undef BATCH_KERNEL_TARGET
+#undef BATCH_KERNEL_SINGLE
+
+#define BATCH_KERNEL_NAME batchKernelAvx512
+#define BATCH_KERNEL_WIDTH 8
+#define BATCH_KERNEL_TARGET __attribute__((target("avx512f")))
+#define BATCH_KERNEL_SINGLE 0
+#include "model_batch_kernel.h"
+#undef BATCH_KERNEL_NAME
+#undef BATCH_KERNEL_WIDTH
+#undef BATCH_KERNEL_TARGET
+#undef BATCH_KERNEL_SINGLE
+
+#define BATCH_KERNEL_NAME batchKernelAvx512Single
+#define BATCH_KERNEL_WIDTH 16
+#define BATCH_KERNEL_TARGET __attribute__((target("avx512f")))
+#define BATCH_KERNEL_SINGLE 1
+#include "model_batch_kernel.h"
+#undef BATCH_KERNEL_NAME
+#undef BATCH_KERNEL_WIDTH
+#undef BATCH_KERNEL_TARGET
+#undef BATCH_KERNEL_SINGLE
+
+#endif
+
+static BatchKernel batchKernel = NULL;
+static BatchKernel batchKernelSingle = NULL;
+static const char *batchKernelName = NULL;
+
+// Picks the widest kernels the CPU supports, once
+static void selectBatchKernel(void)
+{
+    if (batchKernel != NULL)
+        return;
+
+#if defined(__x86_64__) && defined(__GNUC__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        batchKernelName = "avx512";
+        batchKernel = batchKernelAvx512;
+        batchKernelSingle = batchKernelAvx512Single;
+        return;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        batchKernelName = "avx2";
+        batchKernel = batchKernelAvx2;
+        batchKernelSingle = batchKernelAvx2Single;
+        return;
+    }
+#endif
+    batchKernelName = "generic";
+    batchKernel = batchKernelGeneric;
+    batchKernelSingle = batchKernelGenericSingle;
+
+    return;
+}
+
+const char *batchKernelDescription(void)
+{
+    selectBatchKernel();
+    return batchKernelName;
+}
+
+// Checks the sets and workspace and runs one of the selected kernels
+static int runBatchKernel(const double *r, const double *theta, const double *phi, size_t nPoints, const SHCCoefficients **sets, int nSets, ModelWorkspace *workspace, double **b, bool single)
+{
+    if (nSets < 1 || nSets > CHAOS_BATCH_MAX_SETS)
+        return CHAOS_MODEL_COEFFICIENTS;
+    if (nPoints == 0)
+        return CHAOS_MODEL_OK;
+
+    int status = CHAOS_MODEL_OK;
+
+    // Per-point fallback for validation runs
+    if (getFieldKernel() == CHAOS_FIELD_KERNEL_REFERENCE)
+    {
+        for (size_t i = 0; i < nPoints; i++)
+        {
+            for (int c = 0; c < nSets; c++)
+            {
+                status = calculateFieldReference(r[i], theta[i], phi[i], sets[c], workspace, b[c] + 3*i, b[c] + 3*i + 1, b[c] + 3*i + 2);
+                if (status != CHAOS_MODEL_OK)
+                    return status;
+            }
+        }
+        return CHAOS_MODEL_OK;
+    }
+
+    // Recurrence factors of the deepest set cover every set
+    const LegendreTables *legendre = NULL;
+    for (int c = 0; c < nSets; c++)
+    {
+        if (sets[c]->ghByOrder == NULL || sets[c]->legendre.recurrenceA == NULL)
+            return CHAOS_MODEL_COEFFICIENTS;
+        if (legendre == NULL || sets[c]->legendre.maximumN > legendre->maximumN)
+            legendre = &sets[c]->legendre;
+    }
+
+    if (workspace == NULL || workspace->batchScratch == NULL || workspace->maximumN < legendre->maximumN)
+        return CHAOS_MODEL_MEMORY;
+
+    for (size_t i = 0; i < nPoints; i++)
+    {
+        if (r[i] < workspace->minimumRadiusKm)
+            workspace->minimumRadiusKm = r[i];
+    }
+
+    selectBatchKernel();
+
+    if (single)
+        batchKernelSingle(r, theta, phi, nPoints, sets, nSets, legendre, workspace->truncationToleranceNT, workspace->batchScratch, b);
+    else
+        batchKernel(r, theta, phi, nPoints, sets, nSets, legendre, workspace->truncationToleranceNT, workspace->batchScratch, b);
+
+    return CHAOS_MODEL_OK;
+}
+
+int calculateFieldBatch(const double *r, const double *theta, const double *phi, size_t nPoints, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust)
+{
+    const SHCCoefficients *sets[CHAOS_BATCH_MAX_SETS] = {&coeffs->core, &coeffs->crust};
+    double *b[CHAOS_BATCH_MAX_SETS] = {bCore, bCrust};
+
+    if (workspace != NULL && workspace->singlePrecisionCrust)
+    {
+        int status = runBatchKernel(r, theta, phi, nPoints, sets, 1, workspace, b, false);
+        if (status != CHAOS_MODEL_OK)
+            return status;
+        return runBatchKernel(r, theta, phi, nPoints, sets + 1, 1, workspace, b + 1, true);
+    }
+
+    return runBatchKernel(r, theta, phi, nPoints, sets, 2, workspace, b, false);
+}
+
+int calculateCrustBatch(const double *r, const double *theta, const double *phi, size_t nPoints, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCrust)
+{
+    return calculateCrustBatchVersions(r, theta, phi, nPoints, coeffs, 1, workspace, &bCrust);
+}
+
+int calculateCrustBatchVersions(const double *r, const double *theta, const double *phi, size_t nPoints, const ChaosCoefficients *coeffs, int nVersions, ModelWorkspace *workspace, double **bCrust)
+{
+    if (nVersions < 1 || nVersions > CHAOS_BATCH_MAX_SETS)
+        return CHAOS_MODEL_COEFFICIENTS;
+
+    const SHCCoefficients *sets[CHAOS_BATCH_MAX_SETS] = {NULL};
+    for (int v = 0; v < nVersions; v++)
+        sets[v] = &coeffs[v].crust;
+
+    return runBatchKernel(r, theta, phi, nPoints, sets, nVersions, workspace, bCrust, workspace != NULL && workspace->singlePrecisionCrust);
+}
+
+int calculateFieldBatchSets(const double *r, const double *theta, const double *phi, size_t nPoints, const SHCCoefficients **sets, int nSets, ModelWorkspace *workspace, double **b)
+{
+    return runBatchKernel(r, theta, phi, nPoints, sets, nSets, workspace, b, false);
+}
+
+int singlePrecisionCrustDeviation(const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double altitudeKm, double *maxDeviationNT, double *maxCrustNT)
+{
+    // Circular orbit at Swarm's inclination, sampled every 10 s for one day
+    // so that the ground track covers all longitudes
+    const double inclination = 87.35 * M_PI / 180.0;
+    const double mu = 398600.4418;
+    const double earthRotation = 2.0 * M_PI / 86164.1;
+    const double dt = 10.0;
+    double radius = EARTH_RADIUS_KM + altitudeKm;
+    double meanMotion = sqrt(mu / (radius * radius * radius));
+
+    double r[CHAOS_BATCH_POINTS];
+    double theta[CHAOS_BATCH_POINTS];
+    double phi[CHAOS_BATCH_POINTS];
+    double bDouble[3 * CHAOS_BATCH_POINTS];
+    double bSingle[3 * CHAOS_BATCH_POINTS];
+    const SHCCoefficients *sets[1] = {&coeffs->crust};
+    double *bD[1] = {bDouble};
+    double *bS[1] = {bSingle};
+    size_t nOrbit = (size_t)(86400.0 / dt);
+    size_t nPoints = 0;
+    double t = 0.0;
+    double argument = 0.0;
+    double d = 0.0;
+    int status = CHAOS_MODEL_OK;
+    // The orbit is not the caller's data, so it must not count towards the degrees reported
+    double minimumRadiusKm = workspace != NULL ? workspace->minimumRadiusKm : HUGE_VAL;
+
+    for (int j = 0; j < 3; j++)
+    {
+        maxDeviationNT[j] = 0.0;
+        maxCrustNT[j] = 0.0;
+    }
+
+    for (size_t first = 0; first < nOrbit; first += nPoints)
+    {
+        nPoints = nOrbit - first < CHAOS_BATCH_POINTS ? nOrbit - first : CHAOS_BATCH_POINTS;
+        for (size_t i = 0; i < nPoints; i++)
+        {
+            t = (double)(first + i) * dt;
+            argument = meanMotion * t;
+            r[i] = radius;
+            theta[i] = acos(sin(inclination) * sin(argument));
+            phi[i] = atan2(cos(inclination) * sin(argument), cos(argument)) - earthRotation * t;
+        }
+        status = runBatchKernel(r, theta, phi, nPoints, sets, 1, workspace, bD, false);
+        if (status == CHAOS_MODEL_OK)
+            status = runBatchKernel(r, theta, phi, nPoints, sets, 1, workspace, bS, true);
+        if (status != CHAOS_MODEL_OK)
+            break;
+        for (size_t i = 0; i < 3 * nPoints; i++)
+        {
+            d = fabs(bSingle[i] - bDouble[i]);
+            if (d > maxDeviationNT[i % 3])
+                maxDeviationNT[i % 3] = d;
+            if (fabs(bDouble[i]) > maxCrustNT[i % 3])
+                maxCrustNT[i % 3] = fabs(bDouble[i]);
+        }
+    }
+    if (workspace != NULL)
+        workspace->minimumRadiusKm = minimumRadiusKm;
+
+    return status;
+}
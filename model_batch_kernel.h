@@ -0,0 +1,237 @@
+/*
+
+    CHAOS: model_batch_kernel.h
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Body of the batched field kernel. model_batch.c includes this file once per
+// instruction set and precision after defining BATCH_KERNEL_NAME,
+// BATCH_KERNEL_WIDTH (points per vector), BATCH_KERNEL_TARGET (a target
+// attribute, possibly empty) and BATCH_KERNEL_SINGLE (1 to generate Legendre
+// values and sum coefficients in float, 0 for double).
+//
+// Each vector lane holds a different point. Legendre values are generated
+// column by column (order m outer, degree n inner) from the recurrence factors
+// in LegendreTables, so no per-point tables are stored, and each coefficient
+// set is read once per block of points in the order-major layout of ghByOrder.
+// As in schmidtLegendre, columns m > 0 carry P_n^m / sin(theta). Each set is
+// truncated per block at the degree truncationDegree gives for the block's
+// smallest radius. Column sums are added to double accumulators once per
+// order, so in single precision only the sums over n within a column are float.
+
+BATCH_KERNEL_TARGET
+static void BATCH_KERNEL_NAME(const double *r, const double *theta, const double *phi, size_t nPoints, const SHCCoefficients **sets, int nSets, const LegendreTables *legendre, double toleranceNT, void *scratch, double **b)
+{
+#if BATCH_KERNEL_SINGLE
+    typedef float real;
+    const float *recurrenceA = legendre->recurrenceASingle;
+    const float *recurrenceB = legendre->recurrenceBSingle;
+    const float *diagonal = legendre->diagonalSingle;
+#else
+    typedef double real;
+    const double *recurrenceA = legendre->recurrenceA;
+    const double *recurrenceB = legendre->recurrenceB;
+    const double *diagonal = legendre->diagonal;
+#endif
+    typedef real vec __attribute__((vector_size(sizeof(real) * BATCH_KERNEL_WIDTH)));
+    typedef double wide __attribute__((vector_size(sizeof(double) * BATCH_KERNEL_WIDTH)));
+    const int w = BATCH_KERNEL_WIDTH;
+
+    vec *aoverrpowers = (vec *)scratch;
+    vec u, s, s2, sFactor, cosphi, sinphi, aoverr, zero;
+    vec pmm, dpmm, pmmOld, cosmphi, sinmphi, cosmphiOld;
+    vec p, dp, p1, dp1, p2, dp2;
+    vec gTerm, hTerm, x;
+    vec columnN[CHAOS_BATCH_MAX_SETS];
+    vec columnE[CHAOS_BATCH_MAX_SETS];
+    vec columnC[CHAOS_BATCH_MAX_SETS];
+    wide sWide;
+    wide accN[CHAOS_BATCH_MAX_SETS];
+    wide accE[CHAOS_BATCH_MAX_SETS];
+    wide accC[CHAOS_BATCH_MAX_SETS];
+    wide accZonalC[CHAOS_BATCH_MAX_SETS];
+    const real *gh[CHAOS_BATCH_MAX_SETS];
+    const real *column[CHAOS_BATCH_MAX_SETS];
+    int setN[CHAOS_BATCH_MAX_SETS];
+    int maxN = 0;
+    double rMin = 0.0;
+    real lane[5][BATCH_KERNEL_WIDTH];
+    double sinLane[BATCH_KERNEL_WIDTH];
+    double out[4][BATCH_KERNEL_WIDTH];
+    double a = EARTH_RADIUS_KM;
+    real g = 0.0;
+    real h = 0.0;
+    size_t i = 0;
+    size_t k = 0;
+
+    for (size_t first = 0; first < nPoints; first += w)
+    {
+        // Pad the final block with copies of the last point
+        rMin = r[first];
+        for (int l = 0; l < w; l++)
+        {
+            i = first + l < nPoints ? first + l : nPoints - 1;
+            if (r[i] < rMin)
+                rMin = r[i];
+            sinLane[l] = sin(theta[i]);
+            lane[0][l] = (real)cos(theta[i]);
+            lane[1][l] = (real)sinLane[l];
+            lane[2][l] = (real)cos(phi[i]);
+            lane[3][l] = (real)sin(phi[i]);
+            lane[4][l] = (real)(a / r[i]);
+        }
+        memcpy(&u, lane[0], sizeof(vec));
+        memcpy(&s, lane[1], sizeof(vec));
+        memcpy(&cosphi, lane[2], sizeof(vec));
+        memcpy(&sinphi, lane[3], sizeof(vec));
+        memcpy(&aoverr, lane[4], sizeof(vec));
+        memcpy(&sWide, sinLane, sizeof(wide));
+        zero = aoverr * 0;
+        s2 = s * s;
+
+        maxN = 0;
+        for (int c = 0; c < nSets; c++)
+        {
+            setN[c] = truncationDegree(sets[c], rMin, toleranceNT);
+            if (setN[c] > maxN)
+                maxN = setN[c];
+        }
+
+        // (a/r)^(n+2)
+        aoverrpowers[0] = aoverr * aoverr;
+        for (int n = 1; n <= maxN; n++)
+            aoverrpowers[n] = aoverrpowers[n-1] * aoverr;
+
+        for (int c = 0; c < nSets; c++)
+        {
+            accN[c] = accE[c] = accC[c] = accZonalC[c] = sWide * 0.0;
+#if BATCH_KERNEL_SINGLE
+            column[c] = sets[c]->ghByOrderSingle;
+#else
+            column[c] = sets[c]->ghByOrder;
+#endif
+        }
+
+        pmm = zero + 1;
+        dpmm = zero;
+        cosmphi = pmm;
+        sinmphi = zero;
+        for (int m = 0; m <= maxN; m++)
+        {
+            // Sectoral term and its theta derivative, then cos(m phi), sin(m phi)
+            if (m == 1)
+            {
+                pmm = zero + 1;
+                dpmm = u;
+            }
+            else if (m > 1)
+            {
+                pmmOld = pmm;
+                pmm = diagonal[m] * s * pmmOld;
+                dpmm = diagonal[m] * s * (u * pmmOld + dpmm);
+            }
+            if (m > 0)
+            {
+                cosmphiOld = cosmphi;
+                cosmphi = cosmphiOld * cosphi - sinmphi * sinphi;
+                sinmphi = sinmphi * cosphi + cosmphiOld * sinphi;
+            }
+            // Unscaled P_n-1^m for the derivative recurrence
+            sFactor = m == 0 ? s : s2;
+
+            // Column m of each set starts after every degree of the previous
+            // columns, whether or not those were truncated
+            for (int c = 0; c < nSets; c++)
+            {
+                gh[c] = column[c];
+                if (m <= sets[c]->maximumN)
+                    column[c] += 2 * (sets[c]->maximumN - (m > sets[c]->minimumN ? m : sets[c]->minimumN) + 1);
+                columnN[c] = columnE[c] = columnC[c] = zero;
+            }
+
+            p1 = pmm;
+            dp1 = dpmm;
+            p2 = dp2 = zero;
+            k = LEGENDRE_INDEX(m, m);
+            for (int n = m; n <= maxN; k += ++n)
+            {
+                if (n == m)
+                {
+                    p = pmm;
+                    dp = dpmm;
+                }
+                else
+                {
+                    // Three-term recurrence in degree, differentiated for d/dtheta
+                    p = recurrenceA[k] * u * p1 - recurrenceB[k] * p2;
+                    dp = recurrenceA[k] * (u * dp1 - sFactor * p1) - recurrenceB[k] * dp2;
+                    p2 = p1;
+                    dp2 = dp1;
+                    p1 = p;
+                    dp1 = dp;
+                }
+                if (n == 0)
+                    continue;
+
+                for (int c = 0; c < nSets; c++)
+                {
+                    if (n < sets[c]->minimumN || n > setN[c])
+                        continue;
+                    g = gh[c][0];
+                    h = gh[c][1];
+                    gh[c] += 2;
+                    gTerm = g * cosmphi + h * sinmphi;
+                    x = aoverrpowers[n] * p;
+                    columnN[c] += gTerm * aoverrpowers[n] * dp;
+                    columnC[c] += (real)(n + 1) * gTerm * x;
+                    if (m > 0)
+                    {
+                        hTerm = h * cosmphi - g * sinmphi;
+                        columnE[c] += (real)m * hTerm * x;
+                    }
+                }
+            }
+
+            for (int c = 0; c < nSets; c++)
+            {
+                accN[c] += __builtin_convertvector(columnN[c], wide);
+                accE[c] += __builtin_convertvector(columnE[c], wide);
+                if (m == 0)
+                    accZonalC[c] += __builtin_convertvector(columnC[c], wide);
+                else
+                    accC[c] += __builtin_convertvector(columnC[c], wide);
+            }
+        }
+
+        for (int c = 0; c < nSets; c++)
+        {
+            accC[c] = accZonalC[c] + sWide * accC[c];
+            memcpy(out[0], &accN[c], sizeof(wide));
+            memcpy(out[1], &accE[c], sizeof(wide));
+            memcpy(out[2], &accC[c], sizeof(wide));
+            for (int l = 0; l < w && first + l < nPoints; l++)
+            {
+                i = first + l;
+                b[c][3*i] = out[0][l];
+                b[c][3*i+1] = -out[1][l];
+                b[c][3*i+2] = -out[2][l];
+            }
+        }
+    }
+
+    return;
+}
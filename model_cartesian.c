@@ -0,0 +1,269 @@
+/*
+
+    CHAOS: model_cartesian.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "model.h"
+#include "shc.h"
+#include "legendre.h"
+
+#include <math.h>
+
+// Field in geocentric Cartesian components from solid harmonics written in x, y, z.
+//
+// With unit vector (xh, yh, u) = (x, y, z) / r, sin^m(theta) cos(m phi) and
+// sin^m(theta) sin(m phi) are the real and imaginary parts of (xh + i yh)^m,
+// and Q_n^m(u) = P_n^m / sin^m(theta) is a polynomial in u obeying the Legendre
+// recurrence in degree, with Q_m^m constant. Differentiating
+// a (a/r)^(n+1) Q_n^m(u) Re/Im((x + i y)^m) / r^m directly in x, y and z leaves
+// sums over Q and dQ/du only, with one square root and one division per point.
+
+// Q_n^m and dQ_n^m/du for n = 2..maxN. The tables are passed as restrict
+// parameters rather than read from the workspace so that the order loops vectorize.
+static void cartesianRecurrence(const double *restrict recurrenceA, const double *restrict recurrenceB, const double *restrict diagonal, double u, int maxN, double *restrict q, double *restrict dq)
+{
+    for (int n = 2; n <= maxN; n++)
+    {
+        const double *a = recurrenceA + LEGENDRE_INDEX(n, 0);
+        const double *b = recurrenceB + LEGENDRE_INDEX(n, 0);
+        double *qn = q + LEGENDRE_INDEX(n, 0);
+        double *dqn = dq + LEGENDRE_INDEX(n, 0);
+        const double *q1 = q + LEGENDRE_INDEX(n - 1, 0);
+        const double *dq1 = dq + LEGENDRE_INDEX(n - 1, 0);
+        const double *q2 = q + LEGENDRE_INDEX(n - 2, 0);
+        const double *dq2 = dq + LEGENDRE_INDEX(n - 2, 0);
+        for (int m = 0; m <= n - 2; m++)
+        {
+            qn[m] = a[m] * u * q1[m] - b[m] * q2[m];
+            dqn[m] = a[m] * (q1[m] + u * dq1[m]) - b[m] * dq2[m];
+        }
+        // dQ_n-1^n-1/du is zero
+        qn[n - 1] = a[n - 1] * u * q1[n - 1];
+        dqn[n - 1] = a[n - 1] * q1[n - 1];
+        qn[n] = diagonal[n] * q1[n - 1];
+        dqn[n] = 0.0;
+    }
+
+    return;
+}
+
+// Fills aoverrpowers, the powers of (xh + i yh) in cosmphi and sinmphi, and
+// Q_n^m and dQ_n^m/du in polynomials and derivatives, through degree maxN
+static void calculateCartesianBasis(double xh, double yh, double u, double aoverr, const LegendreTables *legendre, int maxN, ModelWorkspace *workspace)
+{
+    double *aoverrpowers = workspace->aoverrpowers;
+    double *cosmphi = workspace->cosmphi;
+    double *sinmphi = workspace->sinmphi;
+    double *q = workspace->polynomials;
+    double *dq = workspace->derivatives;
+
+    aoverrpowers[0] = aoverr * aoverr * aoverr; // (a/r)^n+2, n starting at 1
+    for (int n = 1; n < maxN; n++)
+        aoverrpowers[n] = aoverrpowers[n-1] * aoverr;
+
+    cosmphi[0] = 1.0;
+    sinmphi[0] = 0.0;
+    for (int m = 1; m <= maxN; m++)
+    {
+        cosmphi[m] = cosmphi[m-1] * xh - sinmphi[m-1] * yh;
+        sinmphi[m] = sinmphi[m-1] * xh + cosmphi[m-1] * yh;
+    }
+
+    q[0] = 1.0;
+    dq[0] = 0.0;
+    if (maxN < 1)
+        return;
+    q[1] = u;
+    dq[1] = 1.0;
+    q[2] = 1.0;
+    dq[2] = 0.0;
+    cartesianRecurrence(legendre->recurrenceA, legendre->recurrenceB, legendre->diagonal, u, maxN, q, dq);
+
+    return;
+}
+
+// Per order m, sums over n = minN..maxN of p g Q, p h Q, p g dQ, p h dQ and
+// p g ((n+1) Q + u dQ), p h ((n+1) Q + u dQ), with p = (a/r)^(n+2).
+// Orders are independent, so the inner loop vectorizes.
+static void sumOrders(const double *restrict gh, const double *restrict aoverrpowers, const double *restrict q, const double *restrict dq, double u, int minN, int maxN, double *restrict gq, double *restrict hq, double *restrict gd, double *restrict hd, double *restrict gr, double *restrict hr)
+{
+    double p = 0.0;
+    double pn = 0.0;
+    double pq = 0.0;
+    double pd = 0.0;
+    double pr = 0.0;
+
+    for (int m = 0; m <= maxN; m++)
+    {
+        gq[m] = 0.0;
+        hq[m] = 0.0;
+        gd[m] = 0.0;
+        hd[m] = 0.0;
+        gr[m] = 0.0;
+        hr[m] = 0.0;
+    }
+
+    for (int n = minN; n <= maxN; n++)
+    {
+        const double *qn = q + LEGENDRE_INDEX(n, 0);
+        const double *dqn = dq + LEGENDRE_INDEX(n, 0);
+        p = aoverrpowers[n-1];
+        pn = p * (double)(n + 1);
+        for (int m = 0; m <= n; m++)
+        {
+            pq = p * qn[m];
+            pd = p * dqn[m];
+            pr = pn * qn[m] + u * pd;
+            gq[m] += gh[2*m] * pq;
+            hq[m] += gh[2*m+1] * pq;
+            gd[m] += gh[2*m] * pd;
+            hd[m] += gh[2*m+1] * pd;
+            gr[m] += gh[2*m] * pr;
+            hr[m] += gh[2*m+1] * pr;
+        }
+        gh += 2 * (n + 1);
+    }
+
+    return;
+}
+
+// Field of one coefficient set through degree maxN from calculateCartesianBasis tables.
+// The order sums go to the workspace's batchScratch and are combined with the
+// powers of (xh + i yh) once per order.
+static void sumFieldCartesian(const SHCCoefficients *coeffs, int maxN, double xh, double yh, double u, ModelWorkspace *workspace, double *b)
+{
+    const double *cosmphi = workspace->cosmphi;
+    const double *sinmphi = workspace->sinmphi;
+    size_t stride = (size_t)workspace->maximumN + 1;
+    double *gq = workspace->batchScratch;
+    double *hq = gq + stride;
+    double *gd = hq + stride;
+    double *hd = gd + stride;
+    double *gr = hd + stride;
+    double *hr = gr + stride;
+
+    sumOrders(coeffs->ghNow, workspace->aoverrpowers, workspace->polynomials, workspace->derivatives, u, coeffs->minimumN, maxN, gq, hq, gd, hd, gr, hr);
+
+    // Radial part of the gradient per term is (n + m + 1) Q + u dQ/du
+    double radial = gr[0];
+    double sumX = 0.0;
+    double sumY = 0.0;
+    double sumZ = gd[0];
+    for (int m = 1; m <= maxN; m++)
+    {
+        radial += cosmphi[m] * (gr[m] + (double)m * gq[m]) + sinmphi[m] * (hr[m] + (double)m * hq[m]);
+        sumZ += cosmphi[m] * gd[m] + sinmphi[m] * hd[m];
+        sumX += (double)m * (cosmphi[m-1] * gq[m] + sinmphi[m-1] * hq[m]);
+        sumY += (double)m * (cosmphi[m-1] * hq[m] - sinmphi[m-1] * gq[m]);
+    }
+
+    // B = -grad V
+    b[0] = radial * xh - sumX;
+    b[1] = radial * yh - sumY;
+    b[2] = radial * u - sumZ;
+
+    return;
+}
+
+// Rotates an NEC vector at (theta, phi) into geocentric x, y, z
+static void necToXYZ(double theta, double phi, const double *bNEC, double *bXYZ)
+{
+    double cosTheta = cos(theta);
+    double sinTheta = sin(theta);
+    double cosPhi = cos(phi);
+    double sinPhi = sin(phi);
+
+    bXYZ[0] = -bNEC[0] * cosTheta * cosPhi - bNEC[1] * sinPhi - bNEC[2] * sinTheta * cosPhi;
+    bXYZ[1] = -bNEC[0] * cosTheta * sinPhi + bNEC[1] * cosPhi - bNEC[2] * sinTheta * sinPhi;
+    bXYZ[2] = bNEC[0] * sinTheta - bNEC[2] * cosTheta;
+
+    return;
+}
+
+int calculateFieldCartesianSets(double x, double y, double z, const SHCCoefficients **sets, int nSets, ModelWorkspace *workspace, double **b)
+{
+    if (nSets < 1 || nSets > CHAOS_BATCH_MAX_SETS)
+        return CHAOS_MODEL_COEFFICIENTS;
+    if (workspace == NULL)
+        return CHAOS_MODEL_MEMORY;
+
+    int status = CHAOS_MODEL_OK;
+    double r = sqrt(x * x + y * y + z * z);
+
+    // Spherical evaluation rotated to x, y, z for validation runs
+    if (getFieldKernel() == CHAOS_FIELD_KERNEL_REFERENCE)
+    {
+        double theta = acos(z / r);
+        double phi = atan2(y, x);
+        double bNEC[3] = {0.0};
+        for (int c = 0; c < nSets; c++)
+        {
+            status = calculateFieldReference(r, theta, phi, sets[c], workspace, bNEC, bNEC + 1, bNEC + 2);
+            if (status != CHAOS_MODEL_OK)
+                return status;
+            necToXYZ(theta, phi, bNEC, b[c]);
+        }
+        return CHAOS_MODEL_OK;
+    }
+
+    const LegendreTables *legendre = NULL;
+    int setN[CHAOS_BATCH_MAX_SETS] = {0};
+    int maxN = 0;
+    for (int c = 0; c < nSets; c++)
+    {
+        if (sets[c]->ghNow == NULL || sets[c]->legendre.recurrenceA == NULL)
+            return CHAOS_MODEL_COEFFICIENTS;
+        if (legendre == NULL || sets[c]->legendre.maximumN > legendre->maximumN)
+            legendre = &sets[c]->legendre;
+        setN[c] = truncationDegree(sets[c], r, workspace->truncationToleranceNT);
+        if (setN[c] > maxN)
+            maxN = setN[c];
+    }
+    if (workspace->maximumN < legendre->maximumN)
+        return CHAOS_MODEL_MEMORY;
+
+    if (r < workspace->minimumRadiusKm)
+        workspace->minimumRadiusKm = r;
+
+    double rInverse = 1.0 / r;
+    double xh = x * rInverse;
+    double yh = y * rInverse;
+    double u = z * rInverse;
+
+    calculateCartesianBasis(xh, yh, u, EARTH_RADIUS_KM * rInverse, legendre, maxN, workspace);
+    for (int c = 0; c < nSets; c++)
+        sumFieldCartesian(sets[c], setN[c], xh, yh, u, workspace, b[c]);
+
+    return CHAOS_MODEL_OK;
+}
+
+int calculateFieldCartesian(double x, double y, double z, const SHCCoefficients *coeffs, ModelWorkspace *workspace, double *bXYZ)
+{
+    const SHCCoefficients *sets[1] = {coeffs};
+    double *b[1] = {bXYZ};
+
+    return calculateFieldCartesianSets(x, y, z, sets, 1, workspace, b);
+}
+
+int calculateChaosFieldCartesian(double x, double y, double z, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bCore, double *bCrust)
+{
+    const SHCCoefficients *sets[CHAOS_BATCH_MAX_SETS] = {&coeffs->core, &coeffs->crust};
+    double *b[CHAOS_BATCH_MAX_SETS] = {bCore, bCrust};
+
+    return calculateFieldCartesianSets(x, y, z, sets, 2, workspace, b);
+}
@@ -0,0 +1,148 @@
+/*
+
+    CHAOS: model_fixed_kernel.h
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Field kernels for a degree range fixed at compile time. model.c includes this
+// file once per range after defining FIXED_KERNEL_MIN_N, FIXED_KERNEL_MAX_N,
+// FIXED_KERNEL_SUM_NAME and FIXED_KERNEL_UNROLL (an unroll pragma for the
+// inner loops, possibly empty). Unrolling the degree loops as well makes the
+// core kernel slower. Defining FIXED_KERNEL_FIELD_NAME also generates a complete
+// evaluation with its tables on the stack, meant for the small core range.
+//
+// The sums match sumField term for term, and the tables match calculateBasis,
+// so results agree with the runtime-sized kernels to rounding.
+
+// Sums one set of packed g,h pairs (ghNow) for degrees FIXED_KERNEL_MIN_N..FIXED_KERNEL_MAX_N
+static inline void FIXED_KERNEL_SUM_NAME(const double *gh, double sinTheta, const double *aoverrpowers, const double *polynomials, const double *derivatives, const double *cosmphi, const double *sinmphi, double *bn, double *be, double *bc)
+{
+    double magneticDerivRN = 0.0;
+    double magneticDerivRNm = 0.0;
+    double magneticDerivThetaN = 0.0;
+    double magneticDerivPhiN = 0.0;
+    double br = 0.0;
+    double btheta = 0.0;
+    double bphi = 0.0;
+    double gTerm = 0.0;
+    double hTerm = 0.0;
+
+    size_t lInd = LEGENDRE_INDEX(FIXED_KERNEL_MIN_N, 0);
+
+    for (int n = FIXED_KERNEL_MIN_N; n <= FIXED_KERNEL_MAX_N; n++)
+    {
+        magneticDerivRN = gh[0] * polynomials[lInd];
+        magneticDerivThetaN = gh[0] * derivatives[lInd];
+        magneticDerivRNm = 0.0;
+        magneticDerivPhiN = 0.0;
+        gh += 2;
+        lInd++;
+        FIXED_KERNEL_UNROLL
+        for (int m = 1; m <= n; m++)
+        {
+            gTerm = gh[0] * cosmphi[m] + gh[1] * sinmphi[m];
+            hTerm = (double)m * (gh[1] * cosmphi[m] - gh[0] * sinmphi[m]);
+            magneticDerivRNm += gTerm * polynomials[lInd];
+            magneticDerivThetaN += gTerm * derivatives[lInd];
+            magneticDerivPhiN += hTerm * polynomials[lInd];
+            gh += 2;
+            lInd++;
+        }
+        magneticDerivRN += sinTheta * magneticDerivRNm;
+        magneticDerivRN *= aoverrpowers[n-1] * (-((double)n+1.0));
+        magneticDerivThetaN *= aoverrpowers[n-1];
+        magneticDerivPhiN *= aoverrpowers[n-1];
+
+        br += -magneticDerivRN;
+        btheta += -magneticDerivThetaN;
+        bphi += -magneticDerivPhiN;
+    }
+
+    *bn = -btheta;
+    *be = bphi;
+    *bc = -br;
+
+    return;
+}
+
+#ifdef FIXED_KERNEL_FIELD_NAME
+// Complete evaluation of a set with degrees 1..FIXED_KERNEL_MAX_N. The
+// recurrence is that of schmidtLegendre with constant bounds.
+static void FIXED_KERNEL_FIELD_NAME(double r, double theta, double phi, const SHCCoefficients *coeffs, double *bn, double *be, double *bc)
+{
+    double aoverrpowers[FIXED_KERNEL_MAX_N];
+    double polynomials[LEGENDRE_TERMS(FIXED_KERNEL_MAX_N)];
+    double derivatives[LEGENDRE_TERMS(FIXED_KERNEL_MAX_N)];
+    double cosmphi[FIXED_KERNEL_MAX_N + 1];
+    double sinmphi[FIXED_KERNEL_MAX_N + 1];
+
+    const double *recurrenceA = coeffs->legendre.recurrenceA;
+    const double *recurrenceB = coeffs->legendre.recurrenceB;
+    const double *diagonal = coeffs->legendre.diagonal;
+    double aoverr = EARTH_RADIUS_KM / r;
+    double u = cos(theta);
+    double s = sin(theta);
+    double s2 = s * s;
+    double cosphi = cos(phi);
+    double sinphi = sin(phi);
+    size_t k = 0;
+    size_t k1 = 0;
+    size_t k2 = 0;
+
+    aoverrpowers[0] = aoverr * aoverr * aoverr;
+    for (int n = 1; n < FIXED_KERNEL_MAX_N; n++)
+        aoverrpowers[n] = aoverrpowers[n-1] * aoverr;
+
+    cosmphi[0] = 1.0;
+    sinmphi[0] = 0.0;
+    FIXED_KERNEL_UNROLL
+    for (int m = 1; m <= FIXED_KERNEL_MAX_N; m++)
+    {
+        cosmphi[m] = cosmphi[m-1] * cosphi - sinmphi[m-1] * sinphi;
+        sinmphi[m] = sinmphi[m-1] * cosphi + cosmphi[m-1] * sinphi;
+    }
+
+    polynomials[0] = 1.0;
+    derivatives[0] = 0.0;
+    polynomials[1] = u;
+    derivatives[1] = -s;
+    polynomials[2] = 1.0;
+    derivatives[2] = u;
+    for (int n = 2; n <= FIXED_KERNEL_MAX_N; n++)
+    {
+        k = LEGENDRE_INDEX(n, 0);
+        k1 = LEGENDRE_INDEX(n - 1, 0);
+        k2 = LEGENDRE_INDEX(n - 2, 0);
+        polynomials[k] = recurrenceA[k] * u * polynomials[k1] - recurrenceB[k] * polynomials[k2];
+        derivatives[k] = recurrenceA[k] * (u * derivatives[k1] - s * polynomials[k1]) - recurrenceB[k] * derivatives[k2];
+        FIXED_KERNEL_UNROLL
+        for (int m = 1; m <= n - 2; m++)
+        {
+            polynomials[k + m] = recurrenceA[k + m] * u * polynomials[k1 + m] - recurrenceB[k + m] * polynomials[k2 + m];
+            derivatives[k + m] = recurrenceA[k + m] * (u * derivatives[k1 + m] - s2 * polynomials[k1 + m]) - recurrenceB[k + m] * derivatives[k2 + m];
+        }
+        polynomials[k + n - 1] = recurrenceA[k + n - 1] * u * polynomials[k1 + n - 1];
+        derivatives[k + n - 1] = recurrenceA[k + n - 1] * (u * derivatives[k1 + n - 1] - s2 * polynomials[k1 + n - 1]);
+        polynomials[k + n] = diagonal[n] * s * polynomials[k1 + n - 1];
+        derivatives[k + n] = diagonal[n] * s * (u * polynomials[k1 + n - 1] + derivatives[k1 + n - 1]);
+    }
+
+    FIXED_KERNEL_SUM_NAME(coeffs->ghNow, s, aoverrpowers, polynomials, derivatives, cosmphi, sinmphi, bn, be, bc);
+
+    return;
+}
+#endif // FIXED_KERNEL_FIELD_NAME
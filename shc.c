@@ -19,14 +19,61 @@
 */
 
 #include "shc.h"
+#include "shc_cache.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fts.h>
 #include <time.h>
+#include <math.h>
 
-#include <gsl/gsl_sf_legendre.h>
+// "7.12" from CHAOS-7.12_core.shc
+static void modelVersionFromFilename(const char *filename, char *version)
+{
+    const char *start = strncmp(filename, "CHAOS-", 6) == 0 ? filename + 6 : filename;
+    const char *end = strstr(start, "_core");
+    size_t len = end != NULL ? (size_t)(end - start) : strlen(start);
+    if (len > SHC_VERSION_SIZE - 1)
+        len = SHC_VERSION_SIZE - 1;
+    memcpy(version, start, len);
+    version[len] = '\0';
+
+    return;
+}
+
+// The set of coeffs an SHC file of that name holds, or NULL
+static SHCCoefficients *modelComponent(ChaosCoefficients *coeffs, const char *filename)
+{
+    size_t len = strlen(filename);
+    if (len >= 18 && strcmp(filename + len - 8, "core.shc") == 0)
+    {
+        modelVersionFromFilename(filename, coeffs->version);
+        return &coeffs->core;
+    }
+    else if (len >= 31 && strcmp(filename + len - 16, "extrapolated.shc") == 0)
+        return &coeffs->coreExtrapolation;
+    else if (len >= 20 && strcmp(filename + len - 10, "static.shc") == 0)
+        return &coeffs->crust;
+
+    return NULL;
+}
+
+// Derives the secular variation set once the files are loaded
+static int finishModelCoefficients(ChaosCoefficients *coeffs)
+{
+    int status = SHC_OK;
+    if (coeffs->core.initialized)
+    {
+        status = initSecularVariationCoefficients(&coeffs->coreSecularVariation, &coeffs->core);
+        if (status != SHC_OK)
+            return status;
+    }
+
+    coeffs->initialized = coeffs->core.initialized && coeffs->coreExtrapolation.initialized && coeffs->crust.initialized;
+
+    return SHC_OK;
+}
 
 int loadModelCoefficients(const char *coeffDir, ChaosCoefficients *coeffs)
 {
@@ -48,15 +95,7 @@ int loadModelCoefficients(const char *coeffDir, ChaosCoefficients *coeffs)
     // This assumes only one version of CHAOS SHC files are present in the directory
     while (f)
     {
-        if (f->fts_namelen >= 18 && strcmp(f->fts_name + f->fts_namelen - 8, "core.shc") == 0)
-            c = &coeffs->core;
-        else if (f->fts_namelen >= 31 && strcmp(f->fts_name + f->fts_namelen - 16, "extrapolated.shc") == 0)
-            c = &coeffs->coreExtrapolation;
-        else if (f->fts_namelen >= 20 && strcmp(f->fts_name + f->fts_namelen - 10, "static.shc") == 0)
-            c = &coeffs->crust;
-        else
-            c = NULL;
-
+        c = modelComponent(coeffs, f->fts_name);
         if (c != NULL)
         {
             strncpy((char *)c->coeffFilename, f->fts_path, FILENAME_MAX-1);
@@ -70,14 +109,66 @@ int loadModelCoefficients(const char *coeffDir, ChaosCoefficients *coeffs)
         f = fts_read(fts);
     }
 
-    coeffs->initialized = coeffs->core.initialized && coeffs->coreExtrapolation.initialized && coeffs->crust.initialized;
+    fts_close(fts);
+
+    return finishModelCoefficients(coeffs);
+}
+
+int loadEmbeddedModelCoefficients(ChaosCoefficients *coeffs)
+{
+    bzero(coeffs, sizeof(ChaosCoefficients));
+
+#ifdef CHAOS_EMBEDDED_MODEL
+    int status = SHC_OK;
+    SHCCoefficients *c = NULL;
+    for (int i = 0; i < shcEmbeddedFileCount; i++)
+    {
+        c = modelComponent(coeffs, shcEmbeddedFiles[i].name);
+        if (c == NULL)
+            continue;
+        strncpy((char *)c->coeffFilename, shcEmbeddedFiles[i].name, FILENAME_MAX-1);
+        status = loadEmbeddedSHCCoefficients(c, shcEmbeddedFiles[i].image, shcEmbeddedFiles[i].imageSize);
+        if (status != SHC_OK)
+            return status;
+    }
+
+    return finishModelCoefficients(coeffs);
+#else
+    return SHC_NOT_EMBEDDED;
+#endif
+}
+
+int loadModelVersions(const char **coeffDirs, int nVersions, ChaosCoefficients *coeffs)
+{
+    int status = SHC_OK;
+
+    for (int v = 0; v < nVersions; v++)
+    {
+        status = loadModelCoefficients(coeffDirs[v], &coeffs[v]);
+        if (status != SHC_OK)
+            return status;
+    }
 
     return SHC_OK;
 }
 
-int loadSHCCoefficients(SHCCoefficients *coeffs)
+// FNV-1a, continuing from hash
+static uint64_t hashBytes(uint64_t hash, const void *data, size_t nBytes)
+{
+    const unsigned char *bytes = (const unsigned char *)data;
+    for (size_t i = 0; i < nBytes; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+// Parses the SHC text file, fits the splines and fills the power spectrum:
+// everything shc_cache.c stores
+static int readSHCFile(SHCCoefficients *coeffs)
 {
-	int status = 0;
 	char line[255];
 
 	FILE *f = fopen(coeffs->coeffFilename, "r");	
@@ -85,7 +176,6 @@ int loadSHCCoefficients(SHCCoefficients *coeffs)
 		return SHC_FILE_READ;
 
 	int minN = 0, maxN = 0, nTimes = 0, splineOrder = 0, splineSteps = 0; 
-	size_t nTerms = 0;
     size_t nCoeffs = 0;
     size_t nInfoChars = 0;
     size_t len = 0;
@@ -111,24 +201,19 @@ int loadSHCCoefficients(SHCCoefficients *coeffs)
 	coeffs->bSplineOrder = splineOrder;
 	coeffs->bSplineSteps = splineSteps;
 
-	nTerms = gsl_sf_legendre_array_n(maxN);
-	coeffs->numberOfTerms = nTerms;
-
     nCoeffs = maxN * (maxN + 2) - (minN-1) * (minN - 1 +2);
 
-	coeffs->polynomials = (double *)calloc(nTerms, sizeof(double));
-	coeffs->derivatives = (double *)calloc(nTerms, sizeof(double));
-	coeffs->aoverrpowers = (double *)calloc(maxN,  sizeof(double));
 	coeffs->times = (double*)calloc(nTimes, sizeof(double));
 	// Uses more memory than needed for coefficients, particularly in case of static field. 
     // Could be revised
 	coeffs->gTimeSeries = (double*)calloc(nCoeffs * nTimes, sizeof(double));
 	coeffs->hTimeSeries = (double*)calloc(nCoeffs * nTimes, sizeof(double));
-	coeffs->gNow = (double*)calloc(nCoeffs, sizeof(double));
-	coeffs->hNow = (double*)calloc(nCoeffs, sizeof(double));
-	if (coeffs->polynomials == NULL || coeffs->aoverrpowers == NULL || coeffs->times == NULL || coeffs->gTimeSeries == NULL || coeffs->hTimeSeries == NULL || coeffs->gNow == NULL || coeffs->hNow == NULL)
+    coeffs->powerSpectrum = (double*)calloc(maxN + 1, sizeof(double));
+    coeffs->degreeFieldBound = (double*)calloc(maxN + 1, sizeof(double));
+	if (coeffs->times == NULL || coeffs->gTimeSeries == NULL || coeffs->hTimeSeries == NULL || coeffs->powerSpectrum == NULL || coeffs->degreeFieldBound == NULL)
 	{
-        status = SHC_MEMORY;
+        fclose(f);
+        return SHC_MEMORY;
 	}
 
 	int il, im;
@@ -145,7 +230,6 @@ int loadSHCCoefficients(SHCCoefficients *coeffs)
 	size_t hRead = 0;
     size_t gCoeffs = 0;
     size_t hCoeffs = 0;
-    int m = 0;
     size_t coeffCounter = 0;
     while (coeffCounter < nCoeffs)
     {
@@ -187,13 +271,59 @@ int loadSHCCoefficients(SHCCoefficients *coeffs)
         coeffCounter++;
 	}
 
+    fclose(f);
+
     if (coeffCounter != nCoeffs)
         return SHC_NUMBER_OF_COEFFICIENTS;
 
     coeffs->gCoeffs = gCoeffs;
     coeffs->hCoeffs = hCoeffs;
 
-    fclose(f);
+    int header[5] = {minN, maxN, nTimes, splineOrder, splineSteps};
+    uint64_t hash = hashBytes(14695981039346656037ULL, header, sizeof(header));
+    hash = hashBytes(hash, coeffs->times, nTimes * sizeof(double));
+    hash = hashBytes(hash, coeffs->gTimeSeries, gRead * sizeof(double));
+    coeffs->contentHash = hashBytes(hash, coeffs->hTimeSeries, hRead * sizeof(double));
+
+    // Series the header does not describe as a spline are interpolated linearly
+    if (nTimes > 1 && fitSHCSplines(coeffs) == SHC_MEMORY)
+        return SHC_MEMORY;
+
+    calculatePowerSpectrum(coeffs);
+
+    return SHC_OK;
+}
+
+// Per-process evaluation arrays, once the coefficients are read or attached
+static int initSHCEvaluation(SHCCoefficients *coeffs)
+{
+    int minN = coeffs->minimumN;
+    int maxN = coeffs->maximumN;
+	size_t nTerms = LEGENDRE_TERMS(maxN);
+	coeffs->numberOfTerms = nTerms;
+    size_t nCoeffs = maxN * (maxN + 2) - (minN-1) * (minN - 1 +2);
+
+	coeffs->gNow = (double*)calloc(nCoeffs, sizeof(double));
+	coeffs->hNow = (double*)calloc(nCoeffs, sizeof(double));
+	coeffs->gDotNow = (double*)calloc(nCoeffs, sizeof(double));
+	coeffs->hDotNow = (double*)calloc(nCoeffs, sizeof(double));
+    // One g,h pair per (n, m) from (minN, 0) to (maxN, maxN)
+    coeffs->numberOfPackedTerms = nTerms - LEGENDRE_TERMS(minN - 1);
+    coeffs->ghNow = (double*)calloc(2 * coeffs->numberOfPackedTerms, sizeof(double));
+    coeffs->ghByOrder = (double*)calloc(2 * coeffs->numberOfPackedTerms, sizeof(double));
+    coeffs->ghByOrderSingle = (float*)calloc(2 * coeffs->numberOfPackedTerms, sizeof(float));
+	if (coeffs->gNow == NULL || coeffs->hNow == NULL || coeffs->gDotNow == NULL || coeffs->hDotNow == NULL || coeffs->ghNow == NULL || coeffs->ghByOrder == NULL || coeffs->ghByOrderSingle == NULL)
+        return SHC_MEMORY;
+    if (coeffs->numberOfTimes > 1)
+    {
+        coeffs->gBracket = (double*)calloc(nCoeffs, sizeof(double));
+        coeffs->hBracket = (double*)calloc(nCoeffs, sizeof(double));
+        if (coeffs->gBracket == NULL || coeffs->hBracket == NULL)
+            return SHC_MEMORY;
+    }
+    // Recurrence factors for the Legendre functions, shared by every evaluation
+    if (initLegendreTables(&coeffs->legendre, maxN) != LEGENDRE_OK)
+        return SHC_MEMORY;
 
     coeffs->initialized = true;
 
@@ -201,24 +331,50 @@ int loadSHCCoefficients(SHCCoefficients *coeffs)
 
 }
 
+int loadSHCCoefficients(SHCCoefficients *coeffs)
+{
+	int status = SHC_OK;
+
+    // The binary cache holds what readSHCFile derives from the text; on a miss the
+    // text is parsed and the cache rewritten for the next run where possible
+    if (loadSHCCache(coeffs) != SHC_OK)
+    {
+        status = readSHCFile(coeffs);
+        if (status != SHC_OK)
+            return status;
+        (void)writeSHCCache(coeffs);
+    }
+
+    return initSHCEvaluation(coeffs);
+}
+
+int loadEmbeddedSHCCoefficients(SHCCoefficients *coeffs, const void *image, size_t imageSize)
+{
+    int status = attachSHCCache(coeffs, image, imageSize);
+    if (status != SHC_OK)
+        return status;
+    coeffs->cacheMapping = image;
+    coeffs->cacheMappingSize = 0;
+
+    return initSHCEvaluation(coeffs);
+}
+
+
 
 void freeChaosCoefficients(ChaosCoefficients *coeffs)
 {
     freeSHCCoefficients(&coeffs->core);
     freeSHCCoefficients(&coeffs->coreExtrapolation);
     freeSHCCoefficients(&coeffs->crust);
+    freeSHCCoefficients(&coeffs->coreSecularVariation);
 
     return;
 }
 
 void freeSHCCoefficients(SHCCoefficients *coeffs)
 {    
-	if (coeffs->polynomials != NULL)
-        free(coeffs->polynomials);
-	if (coeffs->derivatives != NULL)
-        free(coeffs->derivatives);
-	if (coeffs->aoverrpowers != NULL)
-        free(coeffs->aoverrpowers);
+    // Unmaps and forgets the arrays that point into a binary cache
+    freeSHCCache(coeffs);
 	if (coeffs->times != NULL)
         free(coeffs->times);
 	if (coeffs->gTimeSeries != NULL)
@@ -229,6 +385,157 @@ void freeSHCCoefficients(SHCCoefficients *coeffs)
         free(coeffs->gNow);
 	if (coeffs->hNow != NULL)
         free(coeffs->hNow);
+	if (coeffs->gDotNow != NULL)
+        free(coeffs->gDotNow);
+	if (coeffs->hDotNow != NULL)
+        free(coeffs->hDotNow);
+	if (coeffs->gBracket != NULL)
+        free(coeffs->gBracket);
+	if (coeffs->hBracket != NULL)
+        free(coeffs->hBracket);
+	if (coeffs->breaks != NULL)
+        free(coeffs->breaks);
+	if (coeffs->knots != NULL)
+        free(coeffs->knots);
+	if (coeffs->gSplines != NULL)
+        free(coeffs->gSplines);
+	if (coeffs->hSplines != NULL)
+        free(coeffs->hSplines);
+	if (coeffs->ghNow != NULL)
+        free(coeffs->ghNow);
+	if (coeffs->ghByOrder != NULL)
+        free(coeffs->ghByOrder);
+	if (coeffs->ghByOrderSingle != NULL)
+        free(coeffs->ghByOrderSingle);
+	if (coeffs->powerSpectrum != NULL)
+        free(coeffs->powerSpectrum);
+	if (coeffs->degreeFieldBound != NULL)
+        free(coeffs->degreeFieldBound);
+    freeLegendreTables(&coeffs->legendre);
+
+    return;
+}
+
+// A private copy of n values of source, or NULL if source is NULL
+static void *copyValues(const void *source, size_t n, size_t size, bool *ok)
+{
+    if (source == NULL)
+        return NULL;
+    void *copy = malloc((n + 1) * size);
+    if (copy == NULL)
+    {
+        *ok = false;
+        return NULL;
+    }
+    memcpy(copy, source, n * size);
+
+    return copy;
+}
+
+// Shares everything of source but the arrays the coefficient updates write
+static int copyEvaluationArrays(SHCCoefficients *copy, const SHCCoefficients *source)
+{
+    bool ok = true;
+    size_t nPacked = 2 * source->numberOfPackedTerms;
+
+    memcpy(copy, source, sizeof(SHCCoefficients));
+    copy->gNow = copyValues(source->gNow, source->gCoeffs, sizeof(double), &ok);
+    copy->hNow = copyValues(source->hNow, source->hCoeffs, sizeof(double), &ok);
+    copy->gDotNow = copyValues(source->gDotNow, source->gCoeffs, sizeof(double), &ok);
+    copy->hDotNow = copyValues(source->hDotNow, source->hCoeffs, sizeof(double), &ok);
+    copy->gBracket = copyValues(source->gBracket, source->gCoeffs, sizeof(double), &ok);
+    copy->hBracket = copyValues(source->hBracket, source->hCoeffs, sizeof(double), &ok);
+    copy->ghNow = copyValues(source->ghNow, nPacked, sizeof(double), &ok);
+    copy->ghByOrder = copyValues(source->ghByOrder, nPacked, sizeof(double), &ok);
+    copy->ghByOrderSingle = copyValues(source->ghByOrderSingle, nPacked, sizeof(float), &ok);
+
+    return ok ? SHC_OK : SHC_MEMORY;
+}
+
+static void freeEvaluationArrays(SHCCoefficients *copy)
+{
+    free(copy->gNow);
+    free(copy->hNow);
+    free(copy->gDotNow);
+    free(copy->hDotNow);
+    free(copy->gBracket);
+    free(copy->hBracket);
+    free(copy->ghNow);
+    free(copy->ghByOrder);
+    free(copy->ghByOrderSingle);
+    bzero(copy, sizeof(SHCCoefficients));
+
+    return;
+}
+
+int initChaosCoefficientsCopy(ChaosCoefficients *copy, const ChaosCoefficients *source)
+{
+    // The crust and extrapolation sets are only read once interpolated
+    memcpy(copy, source, sizeof(ChaosCoefficients));
+    int status = copyEvaluationArrays(&copy->core, &source->core);
+    if (source->coreSecularVariation.initialized && copyEvaluationArrays(&copy->coreSecularVariation, &source->coreSecularVariation) != SHC_OK)
+        status = SHC_MEMORY;
+    if (status != SHC_OK)
+    {
+        freeChaosCoefficientsCopy(copy);
+        return status;
+    }
+
+    return SHC_OK;
+}
+
+void freeChaosCoefficientsCopy(ChaosCoefficients *copy)
+{
+    freeEvaluationArrays(&copy->core);
+    if (copy->coreSecularVariation.initialized)
+        freeEvaluationArrays(&copy->coreSecularVariation);
+    bzero(copy, sizeof(ChaosCoefficients));
+
+    return;
+}
+
+void calculatePowerSpectrum(SHCCoefficients *coeffs)
+{
+    int minN = coeffs->minimumN;
+    int maxN = coeffs->maximumN;
+    int nTimes = coeffs->numberOfTimes;
+    const double *gnm = coeffs->gTimeSeries;
+    const double *hnm = coeffs->hTimeSeries;
+    size_t gIndex = 0;
+    size_t hIndex = 0;
+    double power = 0.0;
+    double g = 0.0;
+    double h = 0.0;
+
+    coeffs->totalFieldBound = 0.0;
+
+    // Coefficients are stored n-major with m increasing, nTimes values each
+    for (int n = minN; n <= maxN; n++)
+    {
+        coeffs->powerSpectrum[n] = 0.0;
+        for (int t = 0; t < nTimes; t++)
+        {
+            power = 0.0;
+            for (int m = 0; m <= n; m++)
+            {
+                g = gnm[(gIndex + m) * nTimes + t];
+                power += g * g;
+                if (m > 0)
+                {
+                    h = hnm[(hIndex + m - 1) * nTimes + t];
+                    power += h * h;
+                }
+            }
+            if (power > coeffs->powerSpectrum[n])
+                coeffs->powerSpectrum[n] = power;
+        }
+        gIndex += n + 1;
+        hIndex += n;
+        // Schmidt functions satisfy sum_m P^2 = 1 and sum_m (dP/dtheta)^2 = sum_m (m P / sin(theta))^2 = n(n+1)/2,
+        // so by Cauchy-Schwarz |B_n| <= (a/r)^(n+2) sqrt((n+1)(2n+1) powerSpectrum[n])
+        coeffs->degreeFieldBound[n] = sqrt((double)(n + 1) * (double)(2 * n + 1) * coeffs->powerSpectrum[n]);
+        coeffs->totalFieldBound += coeffs->degreeFieldBound[n];
+    }
 
     return;
 }
@@ -245,6 +552,12 @@ int interpolateSHCCoefficients(ChaosCoefficients *coeffs, int year, int month, i
 	if (status != SHC_OK)
 		return status;
 
+    return interpolateSHCCoefficientsAtYear(coeffs, fractionalYear);
+}
+
+// Sets the core gNow, hNow and their derivatives for fractionalYear without repacking
+static int interpolateCoreCoefficients(ChaosCoefficients *coeffs, double fractionalYear)
+{
 	ssize_t coefficientTimeIndex = 0;
 	ssize_t coefficientTimeIndexPlus1 = 0;
 	double timeFraction = 0.0;
@@ -254,6 +567,8 @@ int interpolateSHCCoefficients(ChaosCoefficients *coeffs, int year, int month, i
     double *times = NULL;
     double *gnmNow = coeffs->core.gNow;
     double *hnmNow = coeffs->core.hNow;
+    double *gnmDotNow = coeffs->core.gDotNow;
+    double *hnmDotNow = coeffs->core.hDotNow;
     double *gnm = NULL;
     double *hnm = NULL;
     size_t gCoeffs = 0;
@@ -278,6 +593,13 @@ int interpolateSHCCoefficients(ChaosCoefficients *coeffs, int year, int month, i
         deltaTime = times[coefficientTimeIndexPlus1] - times[coefficientTimeIndex];
         timeFraction = (fractionalYear - times[0]) / deltaTime;
     }
+    else if (coeffs->core.gSplines != NULL)
+    {
+        // The model itself, at any time within the core series
+        evaluateSHCSplines(&coeffs->core, fractionalYear);
+        gCoeffs = 0;
+        hCoeffs = 0;
+    }
     else
     {
         nTimes = coeffs->core.numberOfTimes;
@@ -302,7 +624,7 @@ int interpolateSHCCoefficients(ChaosCoefficients *coeffs, int year, int month, i
         }
         else
         {
-            // Linear interpolation is sufficient given the number of model times is 5x the knot points.
+            // Without a spline description of the series, interpolate linearly between model times
             coefficientTimeIndexPlus1 = coefficientTimeIndex + 1;
             deltaTime = times[coefficientTimeIndexPlus1] - times[coefficientTimeIndex];
         }
@@ -310,18 +632,33 @@ int interpolateSHCCoefficients(ChaosCoefficients *coeffs, int year, int month, i
     }
     for (int i = 0; i < gCoeffs; i++)
     {
-        gnmNow[i] = gnm[i*nTimes + coefficientTimeIndex] + timeFraction * (gnm[i*nTimes + coefficientTimeIndexPlus1] - gnm[i*nTimes + coefficientTimeIndex]);
+        gnmDotNow[i] = (gnm[i*nTimes + coefficientTimeIndexPlus1] - gnm[i*nTimes + coefficientTimeIndex]) / deltaTime;
+        gnmNow[i] = gnm[i*nTimes + coefficientTimeIndex] + timeFraction * deltaTime * gnmDotNow[i];
     }
     for (int i = 0; i < hCoeffs; i++)
     {
-        hnmNow[i] = hnm[i*nTimes + coefficientTimeIndex] + timeFraction * (hnm[i*nTimes + coefficientTimeIndexPlus1] - hnm[i*nTimes + coefficientTimeIndex]);
+        hnmDotNow[i] = (hnm[i*nTimes + coefficientTimeIndexPlus1] - hnm[i*nTimes + coefficientTimeIndex]) / deltaTime;
+        hnmNow[i] = hnm[i*nTimes + coefficientTimeIndex] + timeFraction * deltaTime * hnmDotNow[i];
     }
+    coeffs->core.epoch = fractionalYear;
+
+    return SHC_OK;
+}
+
+int interpolateSHCCoefficientsAtYear(ChaosCoefficients *coeffs, double fractionalYear)
+{
+    int status = interpolateCoreCoefficients(coeffs, fractionalYear);
+    if (status != SHC_OK)
+        return status;
+    // Per-sample updates start a new bracket
+    coeffs->coreBracketStart = 0.0;
+    coeffs->coreBracketEnd = 0.0;
 
 	// Crustal field is static, so copy g and h into gNow and hNow
 	// If there is more than 1 time for the crustal field, abort
 	if (coeffs->crust.numberOfTimes != 1)
 	{
-		fprintf(stderr, "Expected 1 static (i.e. crustal) SHC time, got %d times\n", nTimes);
+		fprintf(stderr, "Expected 1 static (i.e. crustal) SHC time, got %d times\n", coeffs->crust.numberOfTimes);
 		return SHC_INTERPOLATION;
 	}
 	for (int i = 0; i < coeffs->crust.gCoeffs; i++)
@@ -329,10 +666,396 @@ int interpolateSHCCoefficients(ChaosCoefficients *coeffs, int year, int month, i
 
 	for (int i = 0; i < coeffs->crust.hCoeffs; i++)
 		coeffs->crust.hNow[i] = coeffs->crust.hTimeSeries[i];
+    coeffs->crust.epoch = fractionalYear;
+
+    packSHCCoefficients(&coeffs->core);
+    packSHCCoefficients(&coeffs->crust);
+    if (coeffs->coreSecularVariation.initialized)
+        packSecularVariation(&coeffs->coreSecularVariation, &coeffs->core);
 
     return SHC_OK;
 }
 
+int stepSHCCoefficients(SHCCoefficients *coeffs, double fractionalYear)
+{
+    if (coeffs->gBracket == NULL)
+        return SHC_INTERPOLATION;
+
+    double dt = fractionalYear - coeffs->bracketEpoch;
+    for (size_t i = 0; i < coeffs->gCoeffs; i++)
+        coeffs->gNow[i] = coeffs->gBracket[i] + dt * coeffs->gDotNow[i];
+    for (size_t i = 0; i < coeffs->hCoeffs; i++)
+        coeffs->hNow[i] = coeffs->hBracket[i] + dt * coeffs->hDotNow[i];
+    coeffs->epoch = fractionalYear;
+    packSHCCoefficients(coeffs);
+
+    return SHC_OK;
+}
+
+int updateCoreCoefficients(ChaosCoefficients *coeffs, double fractionalYear)
+{
+    SHCCoefficients *core = &coeffs->core;
+    int status = SHC_OK;
+
+    if (fractionalYear == core->epoch && fractionalYear >= coeffs->coreBracketStart && fractionalYear < coeffs->coreBracketEnd)
+        return SHC_OK;
+
+    if (fractionalYear < coeffs->coreBracketStart || fractionalYear >= coeffs->coreBracketEnd)
+    {
+        // Brackets are aligned to multiples of their width so that results do not depend on
+        // where processing started
+        double start = floor(fractionalYear / SHC_CORE_BRACKET_YEARS) * SHC_CORE_BRACKET_YEARS;
+        status = interpolateCoreCoefficients(coeffs, start + 0.5 * SHC_CORE_BRACKET_YEARS);
+        if (status != SHC_OK)
+            return status;
+        memcpy(core->gBracket, core->gNow, core->gCoeffs * sizeof(double));
+        memcpy(core->hBracket, core->hNow, core->hCoeffs * sizeof(double));
+        core->bracketEpoch = core->epoch;
+        coeffs->coreBracketStart = start;
+        coeffs->coreBracketEnd = start + SHC_CORE_BRACKET_YEARS;
+        // Constant within the bracket
+        if (coeffs->coreSecularVariation.initialized)
+            packSecularVariation(&coeffs->coreSecularVariation, core);
+    }
+
+    return stepSHCCoefficients(core, fractionalYear);
+}
+
+// Values and time derivatives (per year) of the B-splines that are nonzero at t,
+// which must lie within the breaks; returns the index of the first of them.
+// De Boor's recurrence: the derivatives come from the splines one order lower.
+static int bSplineBasis(const SHCCoefficients *coeffs, double t, double *values, double *derivatives)
+{
+    int order = coeffs->bSplineOrder;
+    int nIntervals = coeffs->numberOfBreaks - 1;
+    const double *breaks = coeffs->breaks;
+    const double *knots = coeffs->knots;
+    double left[SHC_MAX_SPLINE_ORDER] = {0.0};
+    double right[SHC_MAX_SPLINE_ORDER] = {0.0};
+    double saved = 0.0;
+    double temp = 0.0;
+
+    // CHAOS breaks are evenly spaced, so the interval follows from t; the loops absorb rounding
+    int interval = (int)((t - breaks[0]) / (breaks[nIntervals] - breaks[0]) * (double)nIntervals);
+    if (interval < 0)
+        interval = 0;
+    if (interval > nIntervals - 1)
+        interval = nIntervals - 1;
+    while (interval > 0 && t < breaks[interval])
+        interval--;
+    while (interval < nIntervals - 1 && t >= breaks[interval + 1])
+        interval++;
+
+    // Knot span [knots[span], knots[span+1]) holds t
+    int span = interval + order - 1;
+    int first = span - order + 1;
+
+    values[0] = 1.0;
+    for (int j = 1; j < order; j++)
+    {
+        if (j == order - 1)
+        {
+            // values[0..order-2] are the splines of order - 1 starting at first + 1
+            for (int r = 0; r < order; r++)
+            {
+                derivatives[r] = 0.0;
+                if (r > 0)
+                    derivatives[r] += values[r-1] / (knots[first + r + order - 1] - knots[first + r]);
+                if (r < order - 1)
+                    derivatives[r] -= values[r] / (knots[first + r + order] - knots[first + r + 1]);
+                derivatives[r] *= (double)(order - 1);
+            }
+        }
+        left[j] = t - knots[span + 1 - j];
+        right[j] = knots[span + j] - t;
+        saved = 0.0;
+        for (int r = 0; r < j; r++)
+        {
+            temp = values[r] / (right[r + 1] + left[j - r]);
+            values[r] = saved + right[r + 1] * temp;
+            saved = left[j - r] * temp;
+        }
+        values[j] = saved;
+    }
+
+    return first;
+}
+
+// Least-squares B-spline coefficients for each series, from the normal equations
+// of the collocation matrix at the model times. The CHAOS tables sample the
+// spline bSplineSteps times per break interval, so the fit reproduces the model.
+int fitSHCSplines(SHCCoefficients *coeffs)
+{
+    int order = coeffs->bSplineOrder;
+    int steps = coeffs->bSplineSteps;
+    int nTimes = coeffs->numberOfTimes;
+    if (order < 2 || order > SHC_MAX_SPLINE_ORDER || steps < 1 || nTimes < 2 || (nTimes - 1) % steps != 0)
+        return SHC_INTERPOLATION;
+
+    int nBreaks = (nTimes - 1) / steps + 1;
+    int nKnots = nBreaks + 2 * (order - 1);
+    int nSplines = nKnots - order;
+    if (nSplines > nTimes)
+        return SHC_INTERPOLATION;
+
+    coeffs->breaks = (double*)calloc(nBreaks, sizeof(double));
+    coeffs->knots = (double*)calloc(nKnots, sizeof(double));
+    coeffs->gSplines = (double*)calloc(coeffs->gCoeffs * nSplines + 1, sizeof(double));
+    coeffs->hSplines = (double*)calloc(coeffs->hCoeffs * nSplines + 1, sizeof(double));
+    double *collocation = (double*)calloc((size_t)nTimes * order, sizeof(double));
+    int *firstSpline = (int*)calloc(nTimes, sizeof(int));
+    double *normal = (double*)calloc((size_t)nSplines * nSplines, sizeof(double));
+    double *rhs = (double*)calloc(nSplines, sizeof(double));
+    double derivatives[SHC_MAX_SPLINE_ORDER] = {0.0};
+    int status = SHC_OK;
+
+    if (coeffs->breaks == NULL || coeffs->knots == NULL || coeffs->gSplines == NULL || coeffs->hSplines == NULL || collocation == NULL || firstSpline == NULL || normal == NULL || rhs == NULL)
+    {
+        status = SHC_MEMORY;
+        goto cleanup;
+    }
+
+    coeffs->numberOfBreaks = nBreaks;
+    coeffs->numberOfSplines = nSplines;
+    for (int b = 0; b < nBreaks; b++)
+        coeffs->breaks[b] = coeffs->times[b * steps];
+    for (int k = 0; k < nKnots; k++)
+    {
+        if (k < order)
+            coeffs->knots[k] = coeffs->breaks[0];
+        else if (k >= nKnots - order)
+            coeffs->knots[k] = coeffs->breaks[nBreaks - 1];
+        else
+            coeffs->knots[k] = coeffs->breaks[k - order + 1];
+    }
+
+    // Normal matrix from the order nonzero splines at each time
+    for (int t = 0; t < nTimes; t++)
+    {
+        double *row = collocation + (size_t)t * order;
+        firstSpline[t] = bSplineBasis(coeffs, coeffs->times[t], row, derivatives);
+        for (int a = 0; a < order; a++)
+            for (int b = 0; b < order; b++)
+                normal[(size_t)(firstSpline[t] + a) * nSplines + firstSpline[t] + b] += row[a] * row[b];
+    }
+
+    // Cholesky factor in the lower triangle
+    double sum = 0.0;
+    for (int i = 0; i < nSplines; i++)
+    {
+        for (int j = 0; j <= i; j++)
+        {
+            sum = normal[(size_t)i * nSplines + j];
+            for (int k = 0; k < j; k++)
+                sum -= normal[(size_t)i * nSplines + k] * normal[(size_t)j * nSplines + k];
+            if (i == j)
+            {
+                if (sum <= 0.0)
+                {
+                    status = SHC_INTERPOLATION;
+                    goto cleanup;
+                }
+                normal[(size_t)i * nSplines + i] = sqrt(sum);
+            }
+            else
+                normal[(size_t)i * nSplines + j] = sum / normal[(size_t)j * nSplines + j];
+        }
+    }
+
+    size_t nSeries = coeffs->gCoeffs + coeffs->hCoeffs;
+    for (size_t s = 0; s < nSeries; s++)
+    {
+        const double *series = s < coeffs->gCoeffs ? coeffs->gTimeSeries + s * nTimes : coeffs->hTimeSeries + (s - coeffs->gCoeffs) * nTimes;
+        double *splines = s < coeffs->gCoeffs ? coeffs->gSplines + s * nSplines : coeffs->hSplines + (s - coeffs->gCoeffs) * nSplines;
+        for (int i = 0; i < nSplines; i++)
+            rhs[i] = 0.0;
+        for (int t = 0; t < nTimes; t++)
+            for (int a = 0; a < order; a++)
+                rhs[firstSpline[t] + a] += collocation[(size_t)t * order + a] * series[t];
+        for (int i = 0; i < nSplines; i++)
+        {
+            sum = rhs[i];
+            for (int k = 0; k < i; k++)
+                sum -= normal[(size_t)i * nSplines + k] * rhs[k];
+            rhs[i] = sum / normal[(size_t)i * nSplines + i];
+        }
+        for (int i = nSplines - 1; i >= 0; i--)
+        {
+            sum = rhs[i];
+            for (int k = i + 1; k < nSplines; k++)
+                sum -= normal[(size_t)k * nSplines + i] * splines[k];
+            splines[i] = sum / normal[(size_t)i * nSplines + i];
+        }
+    }
+
+cleanup:
+    if (status != SHC_OK)
+    {
+        free(coeffs->breaks);
+        free(coeffs->knots);
+        free(coeffs->gSplines);
+        free(coeffs->hSplines);
+        coeffs->breaks = NULL;
+        coeffs->knots = NULL;
+        coeffs->gSplines = NULL;
+        coeffs->hSplines = NULL;
+        coeffs->numberOfBreaks = 0;
+        coeffs->numberOfSplines = 0;
+    }
+    free(collocation);
+    free(firstSpline);
+    free(normal);
+    free(rhs);
+
+    return status;
+}
+
+int splineWeights(const SHCCoefficients *coeffs, double fractionalYear, double *values, double *derivatives)
+{
+    int order = coeffs->bSplineOrder;
+    double t = fractionalYear;
+    bool held = false;
+
+    // Constant extrapolation, as for the tabulated series
+    if (t < coeffs->breaks[0])
+    {
+        t = coeffs->breaks[0];
+        held = true;
+    }
+    else if (t > coeffs->breaks[coeffs->numberOfBreaks - 1])
+    {
+        t = coeffs->breaks[coeffs->numberOfBreaks - 1];
+        held = true;
+    }
+
+    int first = bSplineBasis(coeffs, t, values, derivatives);
+    if (held)
+        for (int k = 0; k < order; k++)
+            derivatives[k] = 0.0;
+
+    return first;
+}
+
+int evaluateSHCSplines(SHCCoefficients *coeffs, double fractionalYear)
+{
+    if (coeffs->gSplines == NULL)
+        return SHC_INTERPOLATION;
+
+    int order = coeffs->bSplineOrder;
+    int nSplines = coeffs->numberOfSplines;
+    double values[SHC_MAX_SPLINE_ORDER] = {0.0};
+    double derivatives[SHC_MAX_SPLINE_ORDER] = {0.0};
+    const double *s = NULL;
+    double value = 0.0;
+    double derivative = 0.0;
+
+    int first = splineWeights(coeffs, fractionalYear, values, derivatives);
+
+    // order terms per coefficient, whatever the length of the series
+    for (size_t i = 0; i < coeffs->gCoeffs + coeffs->hCoeffs; i++)
+    {
+        s = i < coeffs->gCoeffs ? coeffs->gSplines + i * nSplines + first : coeffs->hSplines + (i - coeffs->gCoeffs) * nSplines + first;
+        value = 0.0;
+        derivative = 0.0;
+        for (int k = 0; k < order; k++)
+        {
+            value += values[k] * s[k];
+            derivative += derivatives[k] * s[k];
+        }
+        if (i < coeffs->gCoeffs)
+        {
+            coeffs->gNow[i] = value;
+            coeffs->gDotNow[i] = derivative;
+        }
+        else
+        {
+            coeffs->hNow[i - coeffs->gCoeffs] = value;
+            coeffs->hDotNow[i - coeffs->gCoeffs] = derivative;
+        }
+    }
+    coeffs->epoch = fractionalYear;
+
+    return SHC_OK;
+}
+
+// Copies gNow and hNow into ghNow in the order calculateField sums them,
+// and into ghByOrder (and its float copy) in the order the batched kernels sum them
+void packSHCCoefficients(SHCCoefficients *coeffs)
+{
+    double *gh = coeffs->ghNow;
+    size_t gRead = 0;
+    size_t hRead = 0;
+    int minN = coeffs->minimumN;
+    int maxN = coeffs->maximumN;
+
+    for (int n = minN; n <= maxN; n++)
+    {
+        *gh++ = coeffs->gNow[gRead++];
+        *gh++ = 0.0;
+        for (int m = 1; m <= n; m++)
+        {
+            *gh++ = coeffs->gNow[gRead++];
+            *gh++ = coeffs->hNow[hRead++];
+        }
+    }
+
+    // Pair (n, m) sits at 2 * (n(n+1)/2 + m - minN(minN+1)/2) in ghNow
+    size_t offset = (size_t)minN * (minN + 1) / 2;
+    size_t index = 0;
+    gh = coeffs->ghByOrder;
+    for (int m = 0; m <= maxN; m++)
+    {
+        for (int n = m > minN ? m : minN; n <= maxN; n++)
+        {
+            index = 2 * ((size_t)n * (n + 1) / 2 + m - offset);
+            *gh++ = coeffs->ghNow[index];
+            *gh++ = coeffs->ghNow[index + 1];
+        }
+    }
+    for (size_t i = 0; i < 2 * coeffs->numberOfPackedTerms; i++)
+        coeffs->ghByOrderSingle[i] = (float)coeffs->ghByOrder[i];
+
+    return;
+}
+
+int initSecularVariationCoefficients(SHCCoefficients *coeffs, const SHCCoefficients *source)
+{
+    bzero(coeffs, sizeof(SHCCoefficients));
+    snprintf((char *)coeffs->coeffFilename, FILENAME_MAX, "%s", source->coeffFilename);
+
+    coeffs->minimumN = source->minimumN;
+    coeffs->maximumN = source->maximumN;
+    coeffs->numberOfTimes = 1;
+    coeffs->numberOfTerms = source->numberOfTerms;
+    coeffs->gCoeffs = source->gCoeffs;
+    coeffs->hCoeffs = source->hCoeffs;
+    coeffs->numberOfPackedTerms = source->numberOfPackedTerms;
+    coeffs->gNow = (double*)calloc(source->gCoeffs + 1, sizeof(double));
+    coeffs->hNow = (double*)calloc(source->hCoeffs + 1, sizeof(double));
+    coeffs->ghNow = (double*)calloc(2 * coeffs->numberOfPackedTerms, sizeof(double));
+    coeffs->ghByOrder = (double*)calloc(2 * coeffs->numberOfPackedTerms, sizeof(double));
+    coeffs->ghByOrderSingle = (float*)calloc(2 * coeffs->numberOfPackedTerms, sizeof(float));
+    if (coeffs->gNow == NULL || coeffs->hNow == NULL || coeffs->ghNow == NULL || coeffs->ghByOrder == NULL || coeffs->ghByOrderSingle == NULL)
+        return SHC_MEMORY;
+    if (initLegendreTables(&coeffs->legendre, coeffs->maximumN) != LEGENDRE_OK)
+        return SHC_MEMORY;
+
+    // No degreeFieldBound: the truncation tolerance is in nT, not nT/year, so every degree is summed
+    coeffs->initialized = true;
+
+    return SHC_OK;
+}
+
+void packSecularVariation(SHCCoefficients *coeffs, const SHCCoefficients *source)
+{
+    memcpy(coeffs->gNow, source->gDotNow, source->gCoeffs * sizeof(double));
+    memcpy(coeffs->hNow, source->hDotNow, source->hCoeffs * sizeof(double));
+    coeffs->epoch = source->epoch;
+    packSHCCoefficients(coeffs);
+
+    return;
+}
+
 // Calculates day of year: 1 January is day 1.
 int yearFraction(long year, long month, long day, double* fractionalYear)
 {
@@ -353,3 +1076,14 @@ int yearFraction(long year, long month, long day, double* fractionalYear)
     *fractionalYear = (double) year + (double)(dateStructUpdated->tm_yday + 1)/365.25;
     return SHC_OK;
 }
+
+int yearFractionFromUnixTime(double unixTime, double *fractionalYear)
+{
+    time_t date = (time_t)floor(unixTime);
+    struct tm dateStruct;
+    if (gmtime_r(&date, &dateStruct) == NULL)
+        return SHC_FRACTIONAL_YEAR;
+    double daySeconds = (double)(dateStruct.tm_hour * 3600 + dateStruct.tm_min * 60 + dateStruct.tm_sec) + (unixTime - (double)date);
+    *fractionalYear = (double)(dateStruct.tm_year + 1900) + ((double)(dateStruct.tm_yday + 1) + daySeconds / 86400.0) / 365.25;
+    return SHC_OK;
+}
@@ -21,10 +21,18 @@
 #ifndef _CHAOS_SHC_H
 #define _CHAOS_SHC_H
 
+#include "legendre.h"
+
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #define SHC_INFO_BUFFER_SIZE 1024
+// Highest B-spline order fitSHCSplines accepts
+#define SHC_MAX_SPLINE_ORDER 16
+// Model releases loadModelVersions loads for evaluation in one pass
+#define SHC_MAX_MODEL_VERSIONS 4
+#define SHC_VERSION_SIZE 32
 
 enum SHCError {
     SHC_OK = 0,
@@ -34,7 +42,8 @@ enum SHCError {
     SHC_NUMBER_OF_COEFFICIENTS,
     SHC_MEMORY,
     SHC_INTERPOLATION,
-    SHC_FRACTIONAL_YEAR
+    SHC_FRACTIONAL_YEAR,
+    SHC_NOT_EMBEDDED
 
 };
 
@@ -46,7 +55,7 @@ typedef struct SHCCoefficients
     int minimumN;
     int maximumN;
     int numberOfTimes;
-    size_t numberOfTerms; // For GSL storage
+    size_t numberOfTerms; // Legendre terms through maximumN
     size_t gCoeffs;
     size_t hCoeffs;
     int bSplineOrder;
@@ -56,29 +65,117 @@ typedef struct SHCCoefficients
     double *hTimeSeries;
     double *gNow;
     double *hNow;
-    double *polynomials;
-    double *derivatives;
-    double *aoverrpowers;
+    // Time derivatives of gNow and hNow (nT/year); zero for static sets
+    double *gDotNow;
+    double *hDotNow;
+    // Fractional year of gNow and hNow
+    double epoch;
+    // gNow and hNow at bracketEpoch, from which stepSHCCoefficients follows the
+    // secular variation; allocated for time-dependent sets only
+    double bracketEpoch;
+    double *gBracket;
+    double *hBracket;
+    // B-spline representation of the time series, fitted at load time when the
+    // header describes one: breaks are every bSplineSteps-th time, and the knots
+    // repeat the first and last breaks bSplineOrder times
+    int numberOfBreaks;
+    double *breaks;
+    double *knots;
+    int numberOfSplines;
+    // numberOfSplines spline coefficients per g and per h
+    double *gSplines;
+    double *hSplines;
+    // gNow and hNow interleaved as g,h pairs in (n, m) summation order,
+    // with h = 0 stored for m = 0 so the stride is constant
+    size_t numberOfPackedTerms;
+    double *ghNow;
+    // The same pairs ordered by m, then n, for the batched kernels
+    double *ghByOrder;
+    // ghByOrder rounded to float, for the single-precision batched kernels
+    float *ghByOrderSingle;
+    LegendreTables legendre;
+    // Sum of g^2 + h^2 for each degree n, the largest over the model times
+    double *powerSpectrum;
+    // Bound on |B| from degree n at r = a: sqrt((n+1)(2n+1) powerSpectrum[n])
+    double *degreeFieldBound;
+    // Sum of degreeFieldBound over all degrees
+    double totalFieldBound;
+    // 64-bit FNV-1a hash of the header values, times and coefficients as read, so that
+    // files differing only in comments or formatting hash alike; 0 if not loaded
+    uint64_t contentHash;
+    // Read-only mapping of the binary cache (shc_cache.h) that times, the time series,
+    // the spline fit and the power spectrum point into, if loaded from one. For an image
+    // compiled into the library, cacheMapping is the image and cacheMappingSize is 0.
+    const void *cacheMapping;
+    size_t cacheMappingSize;
 } SHCCoefficients;
 
 typedef struct ChaosCoefficients
 {
     bool initialized;
+    // Release named by the core file, e.g. "7.12" for CHAOS-7.12_core.shc
+    char version[SHC_VERSION_SIZE];
     SHCCoefficients core;
     SHCCoefficients coreExtrapolation;
     SHCCoefficients crust;
+    // Time derivative (nT/year) of the core coefficients as a set of its own, so that
+    // the field kernels evaluate dB/dt of the core like a field
+    SHCCoefficients coreSecularVariation;
+    // Fractional years of the bracket the core coefficients were last evaluated in
+    double coreBracketStart;
+    double coreBracketEnd;
 } ChaosCoefficients;
 
+// Width of the brackets within which updateCoreCoefficients steps the core linearly
+#define SHC_CORE_BRACKET_YEARS (1.0 / 365.25)
+
 
 int loadModelCoefficients(const char *coeffDir, ChaosCoefficients *coeffs);
+// Loads one release from each of nVersions directories into coeffs[0..nVersions-1],
+// stopping at the first error. Check each set's initialized flag, and free all of them.
+int loadModelVersions(const char **coeffDirs, int nVersions, ChaosCoefficients *coeffs);
 int loadSHCCoefficients(SHCCoefficients *coeffs);
+// As loadModelCoefficients for the release compiled into the library with the CMake option
+// CHAOS_EMBED_MODEL, without touching the filesystem; SHC_NOT_EMBEDDED if there is none
+int loadEmbeddedModelCoefficients(ChaosCoefficients *coeffs);
+// As loadSHCCoefficients from a cache image in memory (shc_cache.h) that outlives coeffs
+int loadEmbeddedSHCCoefficients(SHCCoefficients *coeffs, const void *image, size_t imageSize);
 
 void freeChaosCoefficients(ChaosCoefficients *coeffs);
+// Copies source for evaluation on another thread. The copy has its own core and secular
+// variation coefficients to update and shares the rest, so source must outlive it.
+int initChaosCoefficientsCopy(ChaosCoefficients *copy, const ChaosCoefficients *source);
+void freeChaosCoefficientsCopy(ChaosCoefficients *copy);
 void freeSHCCoefficients(SHCCoefficients *coeffs);
 
+// Updates gNow, hNow and the packed copies in place; not safe while other threads evaluate the model
 int interpolateSHCCoefficients(ChaosCoefficients *coeffs, int year, int month, int day);
+// As interpolateSHCCoefficients for a fractional year
+int interpolateSHCCoefficientsAtYear(ChaosCoefficients *coeffs, double fractionalYear);
+// Converts the time series to B-spline coefficients; SHC_INTERPOLATION if the header does not describe a spline
+int fitSHCSplines(SHCCoefficients *coeffs);
+// Weights and time derivatives of the bSplineOrder splines nonzero at fractionalYear, clamped to
+// the breaks as evaluateSHCSplines does; returns the index of the first. Requires a spline fit.
+int splineWeights(const SHCCoefficients *coeffs, double fractionalYear, double *values, double *derivatives);
+// Sets gNow, hNow, gDotNow and hDotNow from the B-spline fit, holding the end values outside the breaks
+int evaluateSHCSplines(SHCCoefficients *coeffs, double fractionalYear);
+// Sets gNow and hNow to gBracket and hBracket plus the secular variation since bracketEpoch, and repacks
+int stepSHCCoefficients(SHCCoefficients *coeffs, double fractionalYear);
+// Moves the core coefficients to fractionalYear for per-sample epochs. The model is evaluated once
+// at the centre of each SHC_CORE_BRACKET_YEARS bracket; other times within it are stepped along
+// the secular variation there, to within 1e-5 nT of the model for CHAOS-7.
+int updateCoreCoefficients(ChaosCoefficients *coeffs, double fractionalYear);
+void packSHCCoefficients(SHCCoefficients *coeffs);
+// Allocates coeffs as the time derivative of the time-dependent set source
+int initSecularVariationCoefficients(SHCCoefficients *coeffs, const SHCCoefficients *source);
+// Copies gDotNow and hDotNow of source into coeffs and packs them
+void packSecularVariation(SHCCoefficients *coeffs, const SHCCoefficients *source);
+// Fills powerSpectrum, degreeFieldBound and totalFieldBound from the coefficient time series
+void calculatePowerSpectrum(SHCCoefficients *coeffs);
 
 int yearFraction(long year, long month, long day, double* fractionalYear);
+// As yearFraction, continuing through the day: midnight gives the yearFraction value
+int yearFractionFromUnixTime(double unixTime, double *fractionalYear);
 
 
 #endif // _CHAOS_SHC_H
@@ -0,0 +1,288 @@
+/*
+
+    CHAOS: shc_cache.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "shc_cache.h"
+#include "shc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Pointers to the cached arrays of coeffs, in header order, and the number of
+// doubles each holds
+static void cacheArrays(SHCCoefficients *coeffs, double ***arrays, uint64_t *counts)
+{
+    uint64_t nTimes = (uint64_t)coeffs->numberOfTimes;
+    uint64_t nSplines = (uint64_t)coeffs->numberOfSplines;
+    bool spline = coeffs->numberOfSplines > 0;
+
+    arrays[0] = &coeffs->times;
+    counts[0] = nTimes;
+    arrays[1] = &coeffs->gTimeSeries;
+    counts[1] = coeffs->gCoeffs * nTimes;
+    arrays[2] = &coeffs->hTimeSeries;
+    counts[2] = coeffs->hCoeffs * nTimes;
+    arrays[3] = &coeffs->breaks;
+    counts[3] = spline ? (uint64_t)coeffs->numberOfBreaks : 0;
+    arrays[4] = &coeffs->knots;
+    counts[4] = spline ? (uint64_t)(coeffs->numberOfBreaks + 2 * (coeffs->bSplineOrder - 1)) : 0;
+    arrays[5] = &coeffs->gSplines;
+    counts[5] = spline ? coeffs->gCoeffs * nSplines + 1 : 0;
+    arrays[6] = &coeffs->hSplines;
+    counts[6] = spline ? coeffs->hCoeffs * nSplines + 1 : 0;
+    arrays[7] = &coeffs->powerSpectrum;
+    counts[7] = (uint64_t)coeffs->maximumN + 1;
+    arrays[8] = &coeffs->degreeFieldBound;
+    counts[8] = (uint64_t)coeffs->maximumN + 1;
+
+    return;
+}
+
+// FNV-1a over 8-byte words of the file, then its trailing bytes. Not for
+// security: it only tells whether the SHC file changed since it was cached.
+static bool hashFile(const char *filename, uint64_t *size, uint64_t *hash)
+{
+    FILE *f = fopen(filename, "r");
+    if (f == NULL)
+        return false;
+
+    uint64_t h = 14695981039346656037ULL;
+    uint64_t word = 0;
+    uint64_t total = 0;
+    unsigned char buffer[65536];
+    size_t nRead = 0;
+    size_t i = 0;
+    while ((nRead = fread(buffer, 1, sizeof(buffer), f)) > 0)
+    {
+        for (i = 0; i + 8 <= nRead; i += 8)
+        {
+            memcpy(&word, buffer + i, 8);
+            h = (h ^ word) * 1099511628211ULL;
+        }
+        for (; i < nRead; i++)
+            h = (h ^ buffer[i]) * 1099511628211ULL;
+        total += nRead;
+    }
+    bool ok = ferror(f) == 0;
+    fclose(f);
+
+    *size = total;
+    *hash = h;
+
+    return ok;
+}
+
+bool shcCacheFilename(const char *shcFilename, char *cacheFilename)
+{
+    const char *cacheDir = getenv(SHC_CACHE_DIR_ENV);
+    int length = 0;
+    if (cacheDir != NULL)
+    {
+        char name[FILENAME_MAX] = {0};
+        snprintf(name, FILENAME_MAX, "%s", shcFilename);
+        length = snprintf(cacheFilename, FILENAME_MAX, "%s/%s%s", cacheDir, basename(name), SHC_CACHE_SUFFIX);
+    }
+    else
+        length = snprintf(cacheFilename, FILENAME_MAX, "%s%s", shcFilename, SHC_CACHE_SUFFIX);
+
+    return length >= 0 && length < FILENAME_MAX;
+}
+
+static bool cacheEnabled(void)
+{
+    const char *cacheDir = getenv(SHC_CACHE_DIR_ENV);
+
+    return cacheDir == NULL || cacheDir[0] != '\0';
+}
+
+int attachSHCCache(SHCCoefficients *coeffs, const void *image, size_t imageSize)
+{
+    if (imageSize < sizeof(SHCCacheHeader))
+        return SHC_FILE_CONTENTS;
+
+    const SHCCacheHeader *header = (const SHCCacheHeader *)image;
+    if (memcmp(header->magic, SHC_CACHE_MAGIC, sizeof(header->magic)) != 0 || header->formatVersion != SHC_CACHE_FORMAT_VERSION || header->headerSize != sizeof(SHCCacheHeader) || header->one != 1.0 || header->info[SHC_INFO_BUFFER_SIZE - 1] != '\0')
+        return SHC_FILE_CONTENTS;
+
+    coeffs->minimumN = header->minimumN;
+    coeffs->maximumN = header->maximumN;
+    coeffs->numberOfTimes = header->numberOfTimes;
+    coeffs->bSplineOrder = header->bSplineOrder;
+    coeffs->bSplineSteps = header->bSplineSteps;
+    coeffs->numberOfBreaks = header->numberOfBreaks;
+    coeffs->numberOfSplines = header->numberOfSplines;
+    coeffs->gCoeffs = header->gCoeffs;
+    coeffs->hCoeffs = header->hCoeffs;
+    coeffs->totalFieldBound = header->totalFieldBound;
+    coeffs->contentHash = header->contentHash;
+
+    // Each array must be where the header says, as long as the dimensions imply
+    double **arrays[SHC_CACHE_ARRAYS];
+    uint64_t counts[SHC_CACHE_ARRAYS];
+    cacheArrays(coeffs, arrays, counts);
+    for (int a = 0; a < SHC_CACHE_ARRAYS; a++)
+        if (header->count[a] != counts[a] || header->offset[a] % SHC_CACHE_ALIGNMENT != 0 || header->offset[a] < sizeof(SHCCacheHeader) || header->offset[a] + counts[a] * sizeof(double) > imageSize)
+            return SHC_FILE_CONTENTS;
+    for (int a = 0; a < SHC_CACHE_ARRAYS; a++)
+        *arrays[a] = counts[a] > 0 ? (double *)((const char *)image + header->offset[a]) : NULL;
+
+    memcpy((char *)coeffs->info, header->info, SHC_INFO_BUFFER_SIZE);
+
+    return SHC_OK;
+}
+
+int loadSHCCache(SHCCoefficients *coeffs)
+{
+    if (!cacheEnabled())
+        return SHC_FILE_READ;
+
+    char cacheFilename[FILENAME_MAX] = {0};
+    if (!shcCacheFilename(coeffs->coeffFilename, cacheFilename))
+        return SHC_FILE_READ;
+
+    int fd = open(cacheFilename, O_RDONLY);
+    if (fd < 0)
+        return SHC_FILE_READ;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(SHCCacheHeader))
+    {
+        close(fd);
+        return SHC_FILE_READ;
+    }
+    size_t mappingSize = (size_t)info.st_size;
+    void *mapping = mmap(NULL, mappingSize, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+        return SHC_FILE_READ;
+
+    const SHCCacheHeader *header = (const SHCCacheHeader *)mapping;
+    uint64_t sourceSize = 0;
+    uint64_t sourceHash = 0;
+    if (!hashFile(coeffs->coeffFilename, &sourceSize, &sourceHash) || sourceSize != header->sourceSize || sourceHash != header->sourceHash || attachSHCCache(coeffs, mapping, mappingSize) != SHC_OK)
+    {
+        munmap(mapping, mappingSize);
+        return SHC_FILE_READ;
+    }
+    coeffs->cacheMapping = mapping;
+    coeffs->cacheMappingSize = mappingSize;
+
+    return SHC_OK;
+}
+
+int writeSHCCacheImage(const SHCCoefficients *coeffs, FILE *f)
+{
+    SHCCacheHeader header;
+    bzero(&header, sizeof(header));
+    memcpy(header.magic, SHC_CACHE_MAGIC, sizeof(header.magic));
+    header.formatVersion = SHC_CACHE_FORMAT_VERSION;
+    header.headerSize = sizeof(SHCCacheHeader);
+    header.one = 1.0;
+    if (!hashFile(coeffs->coeffFilename, &header.sourceSize, &header.sourceHash))
+        return SHC_FILE_READ;
+    header.contentHash = coeffs->contentHash;
+    header.minimumN = coeffs->minimumN;
+    header.maximumN = coeffs->maximumN;
+    header.numberOfTimes = coeffs->numberOfTimes;
+    header.bSplineOrder = coeffs->bSplineOrder;
+    header.bSplineSteps = coeffs->bSplineSteps;
+    header.numberOfBreaks = coeffs->numberOfBreaks;
+    header.numberOfSplines = coeffs->numberOfSplines;
+    header.gCoeffs = coeffs->gCoeffs;
+    header.hCoeffs = coeffs->hCoeffs;
+    header.totalFieldBound = coeffs->totalFieldBound;
+    memcpy(header.info, coeffs->info, SHC_INFO_BUFFER_SIZE - 1);
+
+    double **arrays[SHC_CACHE_ARRAYS];
+    cacheArrays((SHCCoefficients *)coeffs, arrays, header.count);
+    uint64_t offset = sizeof(SHCCacheHeader);
+    for (int a = 0; a < SHC_CACHE_ARRAYS; a++)
+    {
+        offset = (offset + SHC_CACHE_ALIGNMENT - 1) / SHC_CACHE_ALIGNMENT * SHC_CACHE_ALIGNMENT;
+        header.offset[a] = offset;
+        offset += header.count[a] * sizeof(double);
+    }
+
+    static const char padding[SHC_CACHE_ALIGNMENT] = {0};
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    long position = (long)sizeof(header);
+    for (int a = 0; a < SHC_CACHE_ARRAYS && ok; a++)
+    {
+        ok = fwrite(padding, 1, header.offset[a] - position, f) == header.offset[a] - position;
+        if (ok && header.count[a] > 0)
+            ok = fwrite(*arrays[a], sizeof(double), header.count[a], f) == header.count[a];
+        position = header.offset[a] + header.count[a] * sizeof(double);
+    }
+
+    return ok ? SHC_OK : SHC_FILE_READ;
+}
+
+int writeSHCCache(const SHCCoefficients *coeffs)
+{
+    if (!cacheEnabled())
+        return SHC_OK;
+
+    // Written under a temporary name and renamed, so readers never map a partial cache
+    char cacheFilename[FILENAME_MAX] = {0};
+    char temporaryFilename[FILENAME_MAX] = {0};
+    if (!shcCacheFilename(coeffs->coeffFilename, cacheFilename))
+        return SHC_FILE_READ;
+    int length = snprintf(temporaryFilename, FILENAME_MAX, "%s.%ld", cacheFilename, (long)getpid());
+    if (length < 0 || length >= FILENAME_MAX)
+        return SHC_FILE_READ;
+    FILE *f = fopen(temporaryFilename, "w");
+    if (f == NULL)
+        return SHC_FILE_READ;
+
+    bool ok = writeSHCCacheImage(coeffs, f) == SHC_OK;
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(temporaryFilename, cacheFilename) != 0)
+    {
+        unlink(temporaryFilename);
+        return SHC_FILE_READ;
+    }
+
+    return SHC_OK;
+}
+
+void freeSHCCache(SHCCoefficients *coeffs)
+{
+    if (coeffs->cacheMapping == NULL)
+        return;
+
+    double **arrays[SHC_CACHE_ARRAYS];
+    uint64_t counts[SHC_CACHE_ARRAYS];
+    cacheArrays(coeffs, arrays, counts);
+    for (int a = 0; a < SHC_CACHE_ARRAYS; a++)
+        *arrays[a] = NULL;
+
+    // Embedded images are not mapped
+    if (coeffs->cacheMappingSize > 0)
+        munmap((void *)coeffs->cacheMapping, coeffs->cacheMappingSize);
+    coeffs->cacheMapping = NULL;
+    coeffs->cacheMappingSize = 0;
+
+    return;
+}
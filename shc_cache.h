@@ -0,0 +1,100 @@
+/*
+
+    CHAOS: shc_cache.h
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CHAOS_SHC_CACHE_H
+#define _CHAOS_SHC_CACHE_H
+
+#include "shc.h"
+
+#include <stdio.h>
+#include <stdint.h>
+
+// Binary copies of parsed SHC files: the time series, B-spline fit and power
+// spectrum as aligned arrays behind a versioned header carrying the source
+// file's size and hash. Caches are written next to the SHC file as
+// <file>.cache, or to the directory named by SHC_CACHE_DIR_ENV if set; an
+// empty value disables them. They are mapped read-only, so concurrent
+// processes share one copy of the pages.
+
+#define SHC_CACHE_DIR_ENV "CHAOS_SHC_CACHE_DIR"
+#define SHC_CACHE_SUFFIX ".cache"
+#define SHC_CACHE_MAGIC "CHAOSSHC"
+// Increment when the header or array layout changes
+#define SHC_CACHE_FORMAT_VERSION 1
+#define SHC_CACHE_ALIGNMENT 64
+#define SHC_CACHE_ARRAYS 9
+
+typedef struct SHCCacheHeader
+{
+    char magic[8];
+    uint32_t formatVersion;
+    uint32_t headerSize;
+    // 1.0 as written, rejecting caches from a machine of another byte order
+    double one;
+    uint64_t sourceSize;
+    uint64_t sourceHash;
+    uint64_t contentHash;
+    int32_t minimumN;
+    int32_t maximumN;
+    int32_t numberOfTimes;
+    int32_t bSplineOrder;
+    int32_t bSplineSteps;
+    int32_t numberOfBreaks;
+    int32_t numberOfSplines;
+    int32_t unused;
+    uint64_t gCoeffs;
+    uint64_t hCoeffs;
+    double totalFieldBound;
+    // Byte offsets from the start of the file and lengths in doubles of times,
+    // gTimeSeries, hTimeSeries, breaks, knots, gSplines, hSplines, powerSpectrum
+    // and degreeFieldBound; offsets are multiples of SHC_CACHE_ALIGNMENT
+    uint64_t offset[SHC_CACHE_ARRAYS];
+    uint64_t count[SHC_CACHE_ARRAYS];
+    char info[SHC_INFO_BUFFER_SIZE];
+} SHCCacheHeader;
+
+// A cache image compiled into the library by shc_embed, with the name of its SHC file
+typedef struct SHCEmbeddedFile
+{
+    const char *name;
+    const unsigned char *image;
+    size_t imageSize;
+} SHCEmbeddedFile;
+
+// Generated by shc_embed when CHAOS_EMBED_MODEL is on
+extern const SHCEmbeddedFile shcEmbeddedFiles[];
+extern const int shcEmbeddedFileCount;
+
+// Points the cached arrays of coeffs into a cache image in memory after checking its
+// header and layout, but not its source file. SHC_FILE_CONTENTS if it is not usable.
+int attachSHCCache(SHCCoefficients *coeffs, const void *image, size_t imageSize);
+// Maps the cache of coeffs->coeffFilename if it matches the file, pointing the cached
+// arrays into it. SHC_FILE_READ if there is no usable cache.
+int loadSHCCache(SHCCoefficients *coeffs);
+// Writes the cache for a freshly parsed set; other processes see it only once complete
+int writeSHCCache(const SHCCoefficients *coeffs);
+// Writes the cache image of a freshly parsed set to f
+int writeSHCCacheImage(const SHCCoefficients *coeffs, FILE *f);
+// Unmaps the cache of coeffs, if any, and clears the pointers into it
+void freeSHCCache(SHCCoefficients *coeffs);
+// Where the cache of an SHC file lives. False if the name does not fit in FILENAME_MAX.
+bool shcCacheFilename(const char *shcFilename, char *cacheFilename);
+
+#endif // _CHAOS_SHC_CACHE_H
@@ -0,0 +1,110 @@
+/*
+
+    CHAOS: shc_embed.c
+
+    Copyright (C) 2023  Johnathan K Burchill
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Build-time generator for CHAOS_EMBED_MODEL: writes the cache images of one
+// release as constant tables for loadEmbeddedModelCoefficients
+
+#include "shc.h"
+#include "shc_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libgen.h>
+
+// Emits one image as a constant byte array aligned like the arrays in it
+static int emitImage(FILE *out, int index, const SHCCoefficients *coeffs)
+{
+    char *image = NULL;
+    size_t imageSize = 0;
+    FILE *stream = open_memstream(&image, &imageSize);
+    if (stream == NULL)
+        return SHC_MEMORY;
+    int status = writeSHCCacheImage(coeffs, stream);
+    if (fclose(stream) != 0 && status == SHC_OK)
+        status = SHC_MEMORY;
+    if (status != SHC_OK)
+    {
+        free(image);
+        return status;
+    }
+
+    fprintf(out, "static const unsigned char shcImage%d[%zu] __attribute__((aligned(%d))) = {\n", index, imageSize, SHC_CACHE_ALIGNMENT);
+    for (size_t i = 0; i < imageSize; i++)
+        fprintf(out, "%d%s", (unsigned char)image[i], i + 1 == imageSize ? "\n" : (i % 32 == 31 ? ",\n" : ","));
+    fprintf(out, "};\n\n");
+    free(image);
+
+    return SHC_OK;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s coeffDir output.c\n", argv[0]);
+        fprintf(stderr, "  Writes the SHC files of the CHAOS release in coeffDir as C tables for loadEmbeddedModelCoefficients\n");
+        exit(EXIT_FAILURE);
+    }
+
+    // Parse the text, leaving no caches in the source tree
+    setenv(SHC_CACHE_DIR_ENV, "", 1);
+    ChaosCoefficients coeffs;
+    int status = loadModelCoefficients(argv[1], &coeffs);
+    if (status != SHC_OK || !coeffs.initialized)
+    {
+        fprintf(stderr, "%s: could not load CHAOS coefficients from %s: status %d\n", argv[0], argv[1], status);
+        freeChaosCoefficients(&coeffs);
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "%s: could not open %s\n", argv[0], argv[2]);
+        freeChaosCoefficients(&coeffs);
+        exit(EXIT_FAILURE);
+    }
+
+    const SHCCoefficients *components[3] = {&coeffs.core, &coeffs.coreExtrapolation, &coeffs.crust};
+    fprintf(out, "// Generated by shc_embed from %s (CHAOS-%s); do not edit\n\n#include \"shc_cache.h\"\n\n", argv[1], coeffs.version);
+    for (int i = 0; i < 3 && status == SHC_OK; i++)
+        status = emitImage(out, i, components[i]);
+    fprintf(out, "const SHCEmbeddedFile shcEmbeddedFiles[] = {\n");
+    char name[FILENAME_MAX] = {0};
+    for (int i = 0; i < 3; i++)
+    {
+        snprintf(name, FILENAME_MAX, "%s", components[i]->coeffFilename);
+        fprintf(out, "    {\"%s\", shcImage%d, sizeof(shcImage%d)},\n", basename(name), i, i);
+    }
+    fprintf(out, "};\n\nconst int shcEmbeddedFileCount = 3;\n");
+    if (fclose(out) != 0 && status == SHC_OK)
+        status = SHC_FILE_READ;
+
+    freeChaosCoefficients(&coeffs);
+    if (status != SHC_OK)
+    {
+        fprintf(stderr, "%s: could not write %s: status %d\n", argv[0], argv[2], status);
+        remove(argv[2]);
+        exit(EXIT_FAILURE);
+    }
+
+    return EXIT_SUCCESS;
+}
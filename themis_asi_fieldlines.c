@@ -63,6 +63,7 @@ int main (int argc, char *argv[])
 
     double minimumAltitudekm = 0.0;
     double accuracy = 0.001;
+    double truncationToleranceNT = 0.0;
 
     bool showProgress = false;
 
@@ -94,6 +95,18 @@ int main (int argc, char *argv[])
             accuracy = value;
             nOptions++;
         }
+        if (strncmp("--truncation-tolerance-nT=", argv[i], 26) == 0)
+        {
+            char *lastParsedChar = argv[i]+26;
+            double value = strtod(argv[i] + 26, &lastParsedChar);
+            if (lastParsedChar == argv[i] + 26 || value < 0.0)
+            {
+                fprintf(stderr, "%s: unable to parse %s\n", argv[0], argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            truncationToleranceNT = value;
+            nOptions++;
+        }
         if (strcmp("--progress", argv[i]) == 0)
         {
             nOptions++;
@@ -109,7 +122,7 @@ int main (int argc, char *argv[])
     if (argc - nOptions != 5)
     {
         printf("Incorrect number of arguments.\n");
-        printf("usage: %s calibrationFile coeffDir startAltkm targetAltkm [--minimum-altitude-km=value] [--accuracy=value] [--progress]\n", argv[0]);
+        printf("usage: %s calibrationFile coeffDir startAltkm targetAltkm [--minimum-altitude-km=value] [--truncation-tolerance-nT=value] [--accuracy=value] [--progress]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -298,9 +311,17 @@ int main (int argc, char *argv[])
     }
 
 	ChaosCoefficients coeffs = {0};
+    ModelWorkspace workspace = {0};
 
 
     status = initializeTracer(coeffDir, (int)year, (int)month, (int)day, &coeffs);
+    if (initModelWorkspace(&workspace, &coeffs) != CHAOS_MODEL_OK)
+    {
+        fprintf(stderr, "Could not allocate model workspace.\n");
+        freeChaosCoefficients(&coeffs);
+        exit(EXIT_FAILURE);
+    }
+    workspace.truncationToleranceNT = truncationToleranceNT;
     long steps = 0;
 
     double latitude = 0.0;
@@ -316,7 +337,7 @@ int main (int argc, char *argv[])
         {
             sphericalAltKm = geocentricPositionCorners[i][j][2] / 1000.0 - EARTH_RADIUS_KM;
             // Results in geocentric latitude, longitude, and spherical altitude in km(geocentric radius minus mean earth radius)
-            status = trace(&coeffs, -1, accuracy, geocentricPositionCorners[i][j][0], geocentricPositionCorners[i][j][1], sphericalAltKm, minimumAltitudekm, targetAltKm, &latitude, &longitude, &altitude, &steps);
+            status = trace(&coeffs, &workspace, -1, accuracy, geocentricPositionCorners[i][j][0], geocentricPositionCorners[i][j][1], sphericalAltKm, minimumAltitudekm, targetAltKm, &latitude, &longitude, &altitude, &steps);
             tracedGeocentricPositionCorners[i][j][0] = latitude;
             tracedGeocentricPositionCorners[i][j][1] = longitude;
             tracedGeocentricPositionCorners[i][j][2] = 1000.0 * (altitude + EARTH_RADIUS_KM);
@@ -332,6 +353,10 @@ int main (int argc, char *argv[])
     if (showProgress)
         fprintf(stderr, "\n");
 
+    // Recorded in the CDF metadata
+    int coreMaximumN = maximumDegreeUsed(&coeffs.core, &workspace);
+    int crustMaximumN = maximumDegreeUsed(&coeffs.crust, &workspace);
+    freeModelWorkspace(&workspace);
     freeChaosCoefficients(&coeffs);
 
     // Export trace results to CDF
@@ -715,6 +740,24 @@ int main (int argc, char *argv[])
         return EXIT_FAILURE;
     }
 
+    cdfStatus = CDFcreateAttr(cdf, "Model_truncation", GLOBAL_SCOPE, &attrNum);
+    if (cdfStatus != CDF_OK)
+    {
+        CDFcloseCDF(cdf);
+        return EXIT_FAILURE;
+    }
+    char truncation[255] = {0};
+    if (truncationToleranceNT > 0.0)
+        snprintf(truncation, 255, "Tolerance %g nT; core maximum degree %d; crust maximum degree %d", truncationToleranceNT, coreMaximumN, crustMaximumN);
+    else
+        snprintf(truncation, 255, "None; core maximum degree %d; crust maximum degree %d", coreMaximumN, crustMaximumN);
+    cdfStatus = CDFputAttrgEntry(cdf, attrNum, entry, CDF_CHAR, strlen(truncation), truncation);
+    if (cdfStatus != CDF_OK)
+    {
+        CDFcloseCDF(cdf);
+        return EXIT_FAILURE;
+    }
+
     cdfStatus = CDFcreateAttr(cdf, "TEXT", GLOBAL_SCOPE, &attrNum);
     if (cdfStatus != CDF_OK)
     {
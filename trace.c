@@ -45,7 +45,7 @@ int initializeTracer(char *coeffDir, int year, int month, int day, ChaosCoeffici
     }
 }
 
-int trace(ChaosCoefficients *coeffs, int startingDirection, double accuracy, double latitude, double longitude, double alt1km, double minAltkm, double maxAltkm, double *latitude2, double *longitude2, double *altitude2, long *stepsTaken)
+int trace(const ChaosCoefficients *coeffs, ModelWorkspace *workspace, int startingDirection, double accuracy, double latitude, double longitude, double alt1km, double minAltkm, double maxAltkm, double *latitude2, double *longitude2, double *altitude2, long *stepsTaken)
 {
 
     if (latitude2 == NULL || longitude2 == NULL || altitude2 == NULL)
@@ -71,7 +71,7 @@ int trace(ChaosCoefficients *coeffs, int startingDirection, double accuracy, dou
     double earthRadiuskm = EARTH_RADIUS_KM;
     double r = earthRadiuskm + alt1km;
     // Test calculation to see if we can calculate field without error
-    status = internalFieldNEC(r, theta, phi, coeffs, bField);
+    status = internalFieldNEC(r, theta, phi, coeffs, workspace, bField);
     if (status != CHAOS_MODEL_OK)
         return status;
 
@@ -93,6 +93,7 @@ int trace(ChaosCoefficients *coeffs, int startingDirection, double accuracy, dou
 
     TracingState state = {0};
     state.coeffs = coeffs;
+    state.workspace = workspace;
     state.startingDirection = (double) startingDirection; // +1 is parallel to B
     state.currentDirection = state.startingDirection;
     state.speed = 10.0; // km/s
@@ -167,47 +168,12 @@ int force(double t, const double y[], double f[], void *data)
     (void)t;
     TracingState *s = (TracingState*)data;
 
-    double r = 0.0;
-    double theta = 0.0;
-    double phi = 0.0;
     double startingDirection = s->startingDirection;
     double currentDirection = s->currentDirection;
 
-    // BNEC
-    double b[3] = {0.0};
-    // BXYZ
+    // BXYZ, evaluated in Cartesian form to avoid spherical coordinates and the NEC basis
     double bxyz[3] = {0.0};
-
-    r = sqrt(y[0] * y[0] + y[1] * y[1] + y[2] * y[2]);
-    theta = acos(y[2] / r);
-    phi = atan2(y[1], y[0]);
-    internalFieldNEC(r, theta, phi, s->coeffs, b);
-
-    double n[3] = {0.0};
-    double e[3] = {0.0};
-    double c[3] = {0.0};
-
-    c[0] = -sin(theta) * cos(phi);
-    c[1] = -sin(theta) * sin(phi);
-    c[2] = -cos(theta);
-
-    e[0] = c[1] * 1.0;
-    e[1] = -c[0] * 1.0;
-    e[2] = 0.0;
-
-    n[0] = e[1] * c[2] - e[2] * c[1];
-    n[1] = -e[0] * c[2] + e[2] * c[0];
-    n[2] = e[0] * c[1] - e[1] * c[0];
-
-    double nMag = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
-    n[0] /= nMag;
-    n[1] /= nMag;
-    n[2] /= nMag;
-
-    // Calculate bx, by, bz
-    bxyz[0] = b[0] * n[0] + b[1] * e[0] + b[2] * c[0];       
-    bxyz[1] = b[0] * n[1] + b[1] * e[1] + b[2] * c[1];       
-    bxyz[2] = b[0] * n[2] + b[1] * e[2] + b[2] * c[2];       
+    internalFieldXYZ(y[0], y[1], y[2], s->coeffs, s->workspace, bxyz);
 
     double bMag = sqrt(bxyz[0] * bxyz[0] + bxyz[1] * bxyz[1] + bxyz[2] * bxyz[2]);
 
@@ -220,26 +186,34 @@ int force(double t, const double y[], double f[], void *data)
 
 }
 
-int internalFieldNEC(double r, double theta, double phi, ChaosCoefficients *coeffs, double *bInt)
+int internalFieldNEC(double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bInt)
 {
-    double b[3] = {0.0, 0.0, 0.0};
+    double bCore[3] = {0.0, 0.0, 0.0};
+    double bCrust[3] = {0.0, 0.0, 0.0};
 
-    int status = CHAOS_MODEL_OK;
-    status = calculateField(r, theta, phi, &coeffs->core, b, b+1, b+2);
+    int status = calculateChaosField(r, theta, phi, coeffs, workspace, bCore, bCrust);
     if (status != CHAOS_MODEL_OK)
         return status;
 
-    *bInt = *b;
-    *(bInt + 1) = *(b + 1);
-    *(bInt + 2) = *(b + 2);
+    *bInt = bCore[0] + bCrust[0];
+    *(bInt + 1) = bCore[1] + bCrust[1];
+    *(bInt + 2) = bCore[2] + bCrust[2];
+
+    return CHAOS_MODEL_OK;
+}
+
+int internalFieldXYZ(double x, double y, double z, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bInt)
+{
+    double bCore[3] = {0.0, 0.0, 0.0};
+    double bCrust[3] = {0.0, 0.0, 0.0};
 
-    status = calculateField(r, theta, phi, &coeffs->crust, b, b+1, b+2);
+    int status = calculateChaosFieldCartesian(x, y, z, coeffs, workspace, bCore, bCrust);
     if (status != CHAOS_MODEL_OK)
         return status;
 
-    *bInt += *b;
-    *(bInt + 1) += *(b + 1);
-    *(bInt + 2) += *(b + 2);
+    *bInt = bCore[0] + bCrust[0];
+    *(bInt + 1) = bCore[1] + bCrust[1];
+    *(bInt + 2) = bCore[2] + bCrust[2];
 
     return CHAOS_MODEL_OK;
 }
\ No newline at end of file
@@ -22,8 +22,7 @@
 #define _TRACE_H
 
 #include "shc.h"
-
-#define EARTH_RADIUS_KM 6371.2
+#include "model.h"
 
 enum ChaosTraceStatus
 {
@@ -35,7 +34,8 @@ enum ChaosTraceStatus
 
 typedef struct TracingState
 {
-    ChaosCoefficients *coeffs;
+    const ChaosCoefficients *coeffs;
+    ModelWorkspace *workspace;
     double startingDirection;
     double currentDirection;
     double speed;
@@ -43,10 +43,13 @@ typedef struct TracingState
 
 int initializeTracer(char *coeffDir, int year, int month, int day, ChaosCoefficients *coeffs);
 
-int trace(ChaosCoefficients *coeffs, int startingDirection, double accuracy, double latitude, double longitude, double alt1km, double minAltkm, double maxAltkm, double *latitude2, double *longitude2, double *altitude2, long *stepsTaken);
+// workspace is from initModelWorkspace; one per concurrent trace
+int trace(const ChaosCoefficients *coeffs, ModelWorkspace *workspace, int startingDirection, double accuracy, double latitude, double longitude, double alt1km, double minAltkm, double maxAltkm, double *latitude2, double *longitude2, double *altitude2, long *stepsTaken);
 
 int force(double t, const double y[], double f[], void *data);
-int internalFieldNEC(double r, double theta, double phi, ChaosCoefficients *coeffs, double *bInt);
+int internalFieldNEC(double r, double theta, double phi, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bInt);
+// Geocentric x, y, z components (nT) at x, y, z (km)
+int internalFieldXYZ(double x, double y, double z, const ChaosCoefficients *coeffs, ModelWorkspace *workspace, double *bInt);
 
 
 #endif // _TRACE_H
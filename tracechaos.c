@@ -42,6 +42,7 @@ int main (int argc, char *argv[])
 
     double minimumAltitudekm = 0.0;
     double accuracy = 0.001;
+    double truncationToleranceNT = 0.0;
 
     for (int i = 0; i < argc; i++)
     {
@@ -69,13 +70,25 @@ int main (int argc, char *argv[])
             accuracy = value;
             nOptions++;
         }
+        if (strncmp("--truncation-tolerance-nT=", argv[i], 26) == 0)
+        {
+            char *lastParsedChar = argv[i]+26;
+            double value = strtod(argv[i] + 26, &lastParsedChar);
+            if (lastParsedChar == argv[i] + 26 || value < 0.0)
+            {
+                fprintf(stderr, "%s: unable to parse %s\n", argv[0], argv[i]);
+                exit(EXIT_FAILURE);
+            }
+            truncationToleranceNT = value;
+            nOptions++;
+        }
     }
 
 
     if (argc - nOptions != 12)
     {
         printf("Incorrect number of arguments.\n");
-        printf("usage: %s coeffDir tracingDirection year month day glat glon startAlt stopAlt1 stopAlt2 altitudeStep [--minimum-altitude-km=value]\n", argv[0]);
+        printf("usage: %s coeffDir tracingDirection year month day glat glon startAlt stopAlt1 stopAlt2 altitudeStep [--minimum-altitude-km=value] [--truncation-tolerance-nT=value]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
 
@@ -96,8 +109,16 @@ int main (int argc, char *argv[])
     double longitude2 = 0.0;
 
 	ChaosCoefficients coeffs = {0};
+    ModelWorkspace workspace = {0};
 
     status = initializeTracer(coeffDir, year, month, day, &coeffs);
+    if (initModelWorkspace(&workspace, &coeffs) != CHAOS_MODEL_OK)
+    {
+        fprintf(stderr, "Could not allocate model workspace.\n");
+        freeChaosCoefficients(&coeffs);
+        exit(EXIT_FAILURE);
+    }
+    workspace.truncationToleranceNT = truncationToleranceNT;
 
 
     // Does not work if we go too far along the field line. 
@@ -107,12 +128,16 @@ int main (int argc, char *argv[])
     for (double alt = stopAlt1; alt <= stopAlt2; alt+=deltaAltkm)
     {
         // Inefficient. Could store steps along the way in the trace function
-        status = trace(&coeffs, startingDirection, accuracy, latitude1, longitude1, startAlt, minimumAltitudekm, alt, &latitude2, &longitude2, &finalAltitude, &steps);
+        status = trace(&coeffs, &workspace, startingDirection, accuracy, latitude1, longitude1, startAlt, minimumAltitudekm, alt, &latitude2, &longitude2, &finalAltitude, &steps);
 
         printf("%lf %lf %lf %lf %lf %lf %ld\n", latitude1, longitude1, startAlt, latitude2, longitude2, finalAltitude, steps);
 
     }
 
+    if (truncationToleranceNT > 0.0)
+        fprintf(stderr, "%sTruncation tolerance %g nT: core to degree %d, crust to degree %d\n", infoHeader, truncationToleranceNT, maximumDegreeUsed(&coeffs.core, &workspace), maximumDegreeUsed(&coeffs.crust, &workspace));
+
+    freeModelWorkspace(&workspace);
     freeChaosCoefficients(&coeffs);
 
     return EXIT_SUCCESS;